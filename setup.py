@@ -60,9 +60,12 @@ def main():
                                           "src/topology.c",
                                           "src/partitions.c",
                                           "src/cache.c",
-                                          "src/probe.c",],
+                                          "src/probe.c",
+                                          "src/workers.c",
+                                          "src/async.c",
+                                          "src/hashtable.c",],
                                  include_dirs=["/usr/include"],
-                                 libraries=["blkid"],
+                                 libraries=["blkid", "pthread"],
                                  library_dirs=["/usr/lib"],
                                  define_macros=macros,
                                  extra_compile_args=["-std=c99", "-Wall", "-Wextra", "-Werror"])],
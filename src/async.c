@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2020  Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "async.h"
+
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define UNUSED __attribute__((unused))
+
+/* blocking I/O, so don't limit the shared pool to the number of CPUs */
+#define ASYNC_MIN_WORKERS 4
+
+/* One context per event loop: finished jobs are queued in 'done' and the loop
+ * is woken up through the eventfd registered with loop.add_reader(). The context
+ * doesn't keep the loop alive, it is closed when the loop is closed or destroyed. */
+typedef struct {
+    PyObject_HEAD
+    JobQueue done;
+    int efd;
+    Py_ssize_t njobs;  /* submitted jobs that were not freed yet */
+    bool closed;
+} AsyncContextObject;
+
+static WorkerPool *async_pool = NULL;
+/* weak reference to the loop -> context */
+static PyObject *async_contexts = NULL;
+/* closed contexts waiting for their running jobs */
+static PyObject *async_closed = NULL;
+static PyObject *get_running_loop = NULL;
+
+
+static void AsyncContext_dealloc (AsyncContextObject *self) {
+    /* every queued job holds a reference to the context, so the queue is empty here
+     * and no worker can signal the eventfd anymore */
+    job_queue_destroy (&(self->done));
+
+    if (self->efd >= 0)
+        close (self->efd);
+
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static void async_future_set (PyObject *future, PyObject *result) {
+    PyObject *done = NULL;
+    PyObject *exc_type = NULL;
+    PyObject *exc_value = NULL;
+    PyObject *exc_tb = NULL;
+    PyObject *ret = NULL;
+
+    if (!result) {
+        PyErr_Fetch (&exc_type, &exc_value, &exc_tb);
+        PyErr_NormalizeException (&exc_type, &exc_value, &exc_tb);
+    }
+
+    /* the future could have been cancelled while the job was running */
+    done = PyObject_CallMethod (future, "done", NULL);
+    if (done && !PyObject_IsTrue (done)) {
+        if (result)
+            ret = PyObject_CallMethod (future, "set_result", "(O)", result);
+        else
+            ret = PyObject_CallMethod (future, "set_exception", "(O)", exc_value);
+        Py_XDECREF (ret);
+    }
+    Py_XDECREF (done);
+    PyErr_Clear ();
+
+    Py_XDECREF (exc_type);
+    Py_XDECREF (exc_value);
+    Py_XDECREF (exc_tb);
+}
+
+/* Completes and frees the jobs finished after the loop of the context was closed, the
+ * results can't be delivered anymore but the objects the jobs belong to are updated. */
+static void async_context_drain (AsyncContextObject *self) {
+    AsyncJob *job = NULL;
+    PyObject *result = NULL;
+
+    Py_INCREF (self);
+    while ((job = (AsyncJob *) job_queue_pop (&(self->done), 0)) != NULL) {
+        result = job->complete (job);
+        Py_XDECREF (result);
+        PyErr_Clear ();
+        job->job.free ((Job *) job);
+    }
+    Py_DECREF (self);
+}
+
+/* Drops the context of a closed (or destroyed) loop stored under 'key' in async_contexts,
+ * contexts with running jobs are kept in async_closed until the jobs finish. */
+static int async_context_close (AsyncContextObject *self, PyObject *key) {
+    int ret = 0;
+
+    Py_INCREF (self);
+    self->closed = true;
+
+    ret = PyDict_DelItem (async_contexts, key);
+    async_context_drain (self);
+
+    if (ret == 0 && self->njobs > 0) {
+        if (!async_closed)
+            async_closed = PyList_New (0);
+        ret = async_closed ? PyList_Append (async_closed, (PyObject *) self) : -1;
+    }
+    Py_DECREF (self);
+
+    return ret;
+}
+
+/* drops the jobs of closed contexts finished since the last call */
+static int async_closed_collect (void) {
+    AsyncContextObject *context = NULL;
+
+    if (!async_closed)
+        return 0;
+
+    for (Py_ssize_t i = PyList_GET_SIZE (async_closed) - 1; i >= 0; i--) {
+        context = (AsyncContextObject *) PyList_GET_ITEM (async_closed, i);
+        async_context_drain (context);
+        if (context->njobs == 0 && PySequence_DelItem (async_closed, i) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static PyObject *AsyncContext_complete (AsyncContextObject *self, PyObject *Py_UNUSED (ignored)) {
+    uint64_t count = 0;
+    AsyncJob *job = NULL;
+    PyObject *result = NULL;
+
+    if (self->closed)
+        Py_RETURN_NONE;
+
+    /* reset the counter first, jobs finished after this point will signal it again */
+    if (read (self->efd, &count, sizeof (count)) < 0 && errno != EAGAIN) {
+        PyErr_SetFromErrno (PyExc_OSError);
+        return NULL;
+    }
+
+    Py_INCREF (self);
+    while ((job = (AsyncJob *) job_queue_pop (&(self->done), 0)) != NULL) {
+        result = job->complete (job);
+
+        if (job->future)
+            async_future_set (job->future, result);
+        else if (!result)
+            PyErr_WriteUnraisable ((PyObject *) self);
+
+        Py_XDECREF (result);
+        job->job.free ((Job *) job);
+    }
+    Py_DECREF (self);
+
+    Py_RETURN_NONE;
+}
+
+/* callback of the weak reference to the loop, called when the loop is destroyed */
+static PyObject *AsyncContext_close (AsyncContextObject *self, PyObject *ref) {
+    if (!self->closed && async_context_close (self, ref) < 0)
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef AsyncContext_methods[] = {
+    {"_complete", (PyCFunction) AsyncContext_complete, METH_NOARGS, NULL},
+    {"_close", (PyCFunction) AsyncContext_close, METH_O, NULL},
+    {NULL, NULL, 0, NULL},
+};
+
+PyTypeObject AsyncContextType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid._AsyncContext",
+    .tp_basicsize = sizeof (AsyncContextObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) AsyncContext_dealloc,
+    .tp_methods = AsyncContext_methods,
+};
+
+PyObject *_Async_get_running_loop (void) {
+    PyObject *asyncio = NULL;
+
+    if (!get_running_loop) {
+        asyncio = PyImport_ImportModule ("asyncio");
+        if (!asyncio)
+            return NULL;
+
+        get_running_loop = PyObject_GetAttrString (asyncio, "get_running_loop");
+        Py_DECREF (asyncio);
+        if (!get_running_loop)
+            return NULL;
+    }
+
+    return PyObject_CallObject (get_running_loop, NULL);
+}
+
+/* Closes contexts of event loops that were closed but are still alive, e.g. because
+ * the futures of jobs that were never completed reference them. */
+static int async_contexts_prune (void) {
+    PyObject *refs = NULL;
+    PyObject *ref = NULL;
+    PyObject *loop = NULL;
+    PyObject *closed = NULL;
+    PyObject *context = NULL;
+    int ret = 0;
+
+    refs = PyDict_Keys (async_contexts);
+    if (!refs)
+        return -1;
+
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE (refs) && ret == 0; i++) {
+        ref = PyList_GET_ITEM (refs, i);
+
+        /* destroyed loops are handled by the weak reference callback */
+        loop = PyObject_CallObject (ref, NULL);
+        if (!loop) {
+            ret = -1;
+            break;
+        }
+        if (loop == Py_None) {
+            Py_DECREF (loop);
+            continue;
+        }
+
+        closed = PyObject_CallMethod (loop, "is_closed", NULL);
+        Py_DECREF (loop);
+        if (!closed)
+            ret = -1;
+        else if (PyObject_IsTrue (closed)) {
+            context = PyDict_GetItemWithError (async_contexts, ref);
+            if (context)
+                ret = async_context_close ((AsyncContextObject *) context, ref);
+            else if (PyErr_Occurred ())
+                ret = -1;
+        }
+        Py_XDECREF (closed);
+    }
+
+    Py_DECREF (refs);
+
+    return ret;
+}
+
+static PyObject *async_get_context (PyObject *loop) {
+    AsyncContextObject *context = NULL;
+    PyObject *callback = NULL;
+    PyObject *ref = NULL;
+    PyObject *ret = NULL;
+
+    if (!async_contexts) {
+        async_contexts = PyDict_New ();
+        if (!async_contexts)
+            return NULL;
+    }
+
+    if (async_closed_collect () < 0 || async_contexts_prune () < 0)
+        return NULL;
+
+    /* weak references to the same live object compare (and hash) equal */
+    ref = PyWeakref_NewRef (loop, NULL);
+    if (!ref)
+        return NULL;
+
+    context = (AsyncContextObject *) PyDict_GetItemWithError (async_contexts, ref);
+    Py_DECREF (ref);
+    if (context) {
+        Py_INCREF (context);
+        return (PyObject *) context;
+    } else if (PyErr_Occurred ())
+        return NULL;
+
+    context = PyObject_New (AsyncContextObject, &AsyncContextType);
+    if (!context) {
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new async context");
+        return NULL;
+    }
+
+    job_queue_init (&(context->done));
+    context->njobs = 0;
+    context->closed = false;
+
+    context->efd = eventfd (0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (context->efd < 0) {
+        PyErr_SetFromErrno (PyExc_OSError);
+        Py_DECREF (context);
+        return NULL;
+    }
+    context->done.notify_fd = context->efd;
+
+    callback = PyObject_GetAttrString ((PyObject *) context, "_complete");
+    if (!callback) {
+        Py_DECREF (context);
+        return NULL;
+    }
+
+    ret = PyObject_CallMethod (loop, "add_reader", "iO", context->efd, callback);
+    Py_DECREF (callback);
+    if (!ret) {
+        Py_DECREF (context);
+        return NULL;
+    }
+    Py_DECREF (ret);
+
+    callback = PyObject_GetAttrString ((PyObject *) context, "_close");
+    if (!callback) {
+        Py_DECREF (context);
+        return NULL;
+    }
+
+    ref = PyWeakref_NewRef (loop, callback);
+    Py_DECREF (callback);
+    if (!ref) {
+        Py_DECREF (context);
+        return NULL;
+    }
+
+    if (PyDict_SetItem (async_contexts, ref, (PyObject *) context) < 0) {
+        Py_DECREF (ref);
+        Py_DECREF (context);
+        return NULL;
+    }
+    Py_DECREF (ref);
+
+    return (PyObject *) context;
+}
+
+/* Submits the job to the shared worker pool, the result is delivered on the
+ * currently running event loop. Returns a new asyncio future (or None without
+ * 'with_future'), on failure the job is freed and NULL is returned. */
+PyObject *_Async_submit (AsyncJob *job, bool with_future) {
+    PyObject *loop = NULL;
+    int nworkers = 0;
+
+    job->context = NULL;
+    job->future = NULL;
+
+    loop = _Async_get_running_loop ();
+    if (!loop)
+        goto error;
+
+    job->context = async_get_context (loop);
+    if (!job->context)
+        goto error;
+    ((AsyncContextObject *) job->context)->njobs++;
+
+    if (with_future) {
+        job->future = PyObject_CallMethod (loop, "create_future", NULL);
+        if (!job->future)
+            goto error;
+    }
+
+    if (!async_pool) {
+        nworkers = worker_pool_default_size ();
+        if (nworkers < ASYNC_MIN_WORKERS)
+            nworkers = ASYNC_MIN_WORKERS;
+
+        async_pool = worker_pool_new (nworkers);
+        if (!async_pool) {
+            PyErr_SetString (PyExc_RuntimeError, "Failed to start worker threads");
+            goto error;
+        }
+    }
+
+    Py_DECREF (loop);
+
+    worker_pool_submit (async_pool, (Job *) job, &(((AsyncContextObject *) job->context)->done));
+
+    if (with_future) {
+        Py_INCREF (job->future);
+        return job->future;
+    }
+
+    Py_RETURN_NONE;
+
+error:
+    Py_XDECREF (loop);
+    job->job.free ((Job *) job);
+
+    return NULL;
+}
+
+/* releases the references held by the job, to be used from the 'free' functions */
+void _Async_job_clear (AsyncJob *job) {
+    Py_CLEAR (job->future);
+    if (job->context)
+        ((AsyncContextObject *) job->context)->njobs--;
+    Py_CLEAR (job->context);
+}
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2020  Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef ASYNC_H
+#define ASYNC_H
+
+#include <Python.h>
+
+#include <stdbool.h>
+
+#include "workers.h"
+
+/* 'job.run' is called on a worker thread without the GIL, 'complete' and 'job.free'
+ * are called with the GIL from the event loop thread. 'complete' returns result
+ * for the future or NULL with an exception set. */
+typedef struct AsyncJob AsyncJob;
+
+struct AsyncJob {
+    Job job;
+    PyObject *context;
+    PyObject *future;
+    PyObject *(*complete) (AsyncJob *job);
+};
+
+extern PyTypeObject AsyncContextType;
+
+PyObject *_Async_get_running_loop (void);
+PyObject *_Async_submit (AsyncJob *job, bool with_future);
+void _Async_job_clear (AsyncJob *job);
+
+#endif /* ASYNC_H */
@@ -17,18 +17,50 @@
  */
 
 #include "cache.h"
+#include "workers.h"
 
 #include <blkid/blkid.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/netlink.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #define UNUSED __attribute__((unused))
 
+#define CACHE_BUSY_ERROR "Cache is being updated by another thread"
+
+
+static void cache_index_free_tag (void *index) {
+    hash_table_free ((HashTable *) index, NULL);
+}
+
+static void cache_index_free (CacheObject *self) {
+    hash_table_free (self->index, cache_index_free_tag);
+    self->index = NULL;
+}
 
 PyObject *Cache_new (PyTypeObject *type,  PyObject *args UNUSED, PyObject *kwargs UNUSED) {
     CacheObject *self = (CacheObject*) type->tp_alloc (type, 0);
 
-    if (self)
+    if (self) {
         self->cache = NULL;
+        self->filename = NULL;
+        self->generation = 0;
+        self->index = NULL;
+        self->index_generation = 0;
+        self->uevent_fd = -1;
+        self->verified = NULL;
+        self->busy = false;
+    }
 
     return (PyObject *) self;
 }
@@ -42,8 +74,33 @@ int Cache_init (CacheObject *self UNUSED, PyObject *args, PyObject *kwargs) {
         return -1;
     }
 
+    if (self->busy) {
+        PyErr_SetString (PyExc_RuntimeError, CACHE_BUSY_ERROR);
+        return -1;
+    }
+
+    if (self->cache) {
+        blkid_put_cache (self->cache);
+        self->cache = NULL;
+        self->generation++;
+    }
+
+    hash_table_free (self->verified, free);
+    self->verified = NULL;
+
+    free (self->filename);
+    self->filename = NULL;
+    if (filename) {
+        self->filename = strdup (filename);
+        if (!self->filename) {
+            PyErr_NoMemory ();
+            return -1;
+        }
+    }
+
     ret = blkid_get_cache (&(self->cache), filename);
     if (ret < 0) {
+        self->cache = NULL;
         PyErr_SetString (PyExc_RuntimeError, "Failed to get cache");
         return -1;
     }
@@ -52,26 +109,407 @@ int Cache_init (CacheObject *self UNUSED, PyObject *args, PyObject *kwargs) {
 }
 
 void Cache_dealloc (CacheObject *self) {
+    /* writes the changes back to the cache file */
+    if (self->cache)
+        blkid_put_cache (self->cache);
+
+    if (self->uevent_fd >= 0)
+        close (self->uevent_fd);
+
+    cache_index_free (self);
+    hash_table_free (self->verified, free);
+    free (self->filename);
     Py_TYPE (self)->tp_free ((PyObject *) self);
 }
 
+static int cache_check (CacheObject *self) {
+    if (!self->cache) {
+        PyErr_SetString (PyExc_ValueError, "Cache is closed");
+        return -1;
+    }
+
+    if (self->busy) {
+        PyErr_SetString (PyExc_RuntimeError, CACHE_BUSY_ERROR);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* libblkid re-probes a known device only if its node was modified since the last
+ * probe (or after a few minutes), this makes sure the next verification probes it;
+ * UTIME_NOW would use the coarse filesystem clock which can lag behind the probe
+ * timestamp, so the current time is set explicitly */
+static int cache_touch_device (const char *devname) {
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { 0, 0 } };
+
+    clock_gettime (CLOCK_REALTIME, &(times[1]));
+
+    /* fails without CAP_FOWNER for nodes owned by someone else */
+    return utimensat (AT_FDCWD, devname, times, 0);
+}
+
+static double cache_monotonic_time (void) {
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* remembers when the device was verified for verify_all(max_age), failures are ignored
+ * (the device is just verified again next time) */
+static void cache_mark_verified (CacheObject *self, const char *devname, double now) {
+    double *last = NULL;
+
+    if (!self->verified) {
+        self->verified = hash_table_new (0);
+        if (!self->verified)
+            return;
+    }
+
+    last = hash_table_lookup (self->verified, devname);
+    if (!last) {
+        last = malloc (sizeof (double));
+        if (!last)
+            return;
+        if (hash_table_insert (self->verified, devname, last) != 0) {
+            free (last);
+            return;
+        }
+    }
+
+    *last = now;
+}
+
+static PyObject *cache_device_new (CacheObject *self, blkid_dev device) {
+    DeviceObject *dev_obj = NULL;
+    const char *devname = blkid_dev_devname (device);
+
+    dev_obj = PyObject_New (DeviceObject, &DeviceType);
+    if (!dev_obj) {
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new Device object");
+        return NULL;
+    }
+
+    dev_obj->device = device;
+    Py_INCREF (self);
+    dev_obj->cache = self;
+    dev_obj->generation = self->generation;
+    dev_obj->tags = NULL;
+    dev_obj->tags_generation = 0;
+    dev_obj->devname = devname ? strdup (devname) : NULL;
+    if (devname && !dev_obj->devname) {
+        Py_DECREF (dev_obj);
+        return PyErr_NoMemory ();
+    }
+
+    return (PyObject *) dev_obj;
+}
+
+/* Candidate devices are probed on worker threads first, only to get their
+ * superblocks into the page cache, libblkid then probes them again (serially,
+ * it isn't thread safe) without waiting for the slow devices. Paths are handed
+ * out to the workers from a shared counter. */
+typedef struct {
+    char **paths;
+    bool *found;
+    size_t count;
+    size_t next;
+} ProbeAllRange;
+
+typedef struct {
+    Job job;
+    ProbeAllRange *range;
+} ProbeAllJob;
+
+static void probe_all_job_run (Job *job) {
+    ProbeAllRange *range = ((ProbeAllJob *) job)->range;
+    blkid_probe probe = NULL;
+    size_t i = 0;
+    int fd = -1;
+
+    probe = blkid_new_probe ();
+    if (!probe)
+        return;
+
+    /* same chains libblkid uses when probing devices for the cache */
+    blkid_probe_enable_superblocks (probe, 1);
+    blkid_probe_enable_partitions (probe, 1);
+    blkid_probe_set_partitions_flags (probe, BLKID_PARTS_ENTRY_DETAILS);
+
+    while ((i = __atomic_fetch_add (&(range->next), 1, __ATOMIC_RELAXED)) < range->count) {
+        fd = open (range->paths[i], O_RDONLY|O_CLOEXEC|O_NONBLOCK);
+        if (fd < 0)
+            continue;
+
+        if (blkid_probe_set_device (probe, fd, 0, 0) == 0)
+            range->found[i] = blkid_do_safeprobe (probe) == 0;
+
+        /* the probe still refers to the closed fd, it is reset by the next set_device */
+        close (fd);
+    }
+
+    blkid_free_probe (probe);
+}
+
+static void probe_all_job_free (Job *job) {
+    free (job);
+}
+
+static void probe_all_range_free (ProbeAllRange *range) {
+    for (size_t i = 0; i < range->count; i++)
+        free (range->paths[i]);
+    free (range->paths);
+    free (range->found);
+}
+
+static int probe_all_range_add (ProbeAllRange *range, size_t *allocated, const char *name) {
+    char **paths = NULL;
+    char *path = NULL;
+
+    if (asprintf (&path, "/dev/%s", name) < 0)
+        return -1;
+
+    /* sysfs and /proc/partitions use '!' instead of '/' in the names */
+    for (char *c = path; *c; c++) {
+        if (*c == '!')
+            *c = '/';
+    }
+
+    for (size_t i = 0; i < range->count; i++) {
+        if (strcmp (range->paths[i], path) == 0) {
+            free (path);
+            return 0;
+        }
+    }
+
+    if (range->count == *allocated) {
+        *allocated = *allocated ? *allocated * 2 : 64;
+        paths = realloc (range->paths, *allocated * sizeof (char *));
+        if (!paths) {
+            free (path);
+            return -1;
+        }
+        range->paths = paths;
+    }
+
+    range->paths[range->count++] = path;
+
+    return 0;
+}
+
+/* the same candidates blkid_probe_all() (/proc/partitions) and
+ * blkid_probe_all_removable() (removable disks in sysfs) use */
+static int probe_all_range_init (ProbeAllRange *range, bool removable) {
+    FILE *proc = NULL;
+    DIR *dir = NULL;
+    struct dirent *entry = NULL;
+    char line[256];
+    char name[128];
+    char path[PATH_MAX];
+    unsigned long long size = 0;
+    size_t allocated = 0;
+    int fd = -1;
+    char value = 0;
+    int ret = 0;
+
+    memset (range, 0, sizeof (ProbeAllRange));
+
+    proc = fopen ("/proc/partitions", "re");
+    if (!proc)
+        return -1;
+
+    while (ret == 0 && fgets (line, sizeof (line), proc)) {
+        if (sscanf (line, " %*u %*u %llu %127s", &size, name) != 2)
+            continue;
+
+        /* extended partitions are just one block big */
+        if (size <= 1)
+            continue;
+
+        ret = probe_all_range_add (range, &allocated, name);
+    }
+    fclose (proc);
+
+    if (ret == 0 && removable) {
+        dir = opendir ("/sys/block");
+        while (ret == 0 && dir && (entry = readdir (dir)) != NULL) {
+            if (entry->d_name[0] == '.')
+                continue;
+
+            snprintf (path, sizeof (path), "/sys/block/%s/removable", entry->d_name);
+            fd = open (path, O_RDONLY|O_CLOEXEC);
+            if (fd < 0)
+                continue;
+            if (read (fd, &value, 1) == 1 && value == '1')
+                ret = probe_all_range_add (range, &allocated, entry->d_name);
+            close (fd);
+        }
+        if (dir)
+            closedir (dir);
+    }
+
+    if (ret == 0 && range->count > 0) {
+        range->found = calloc (range->count, sizeof (bool));
+        if (!range->found)
+            ret = -1;
+    }
+
+    if (ret < 0)
+        probe_all_range_free (range);
+
+    return ret;
+}
+
+/* probes the candidates in parallel and adds them to the cache, returns -1 with an exception set */
+static int cache_probe_all_parallel (CacheObject *self, bool removable, bool new, int workers) {
+    ProbeAllRange range;
+    ProbeAllJob *job = NULL;
+    WorkerPool *pool = NULL;
+    JobQueue done;
+    size_t ncandidates = 0;
+    int nworkers = 0;
+    int submitted = 0;
+    int finished = 0;
+    int ret = 0;
+
+    if (probe_all_range_init (&range, removable) < 0) {
+        PyErr_SetFromErrno (PyExc_OSError);
+        return -1;
+    }
+
+    /* the GIL is released while waiting for the workers and while libblkid updates
+     * the cache, other threads can't use (or close) it meanwhile */
+    self->busy = true;
+
+    /* known devices are skipped entirely with new_only */
+    if (new) {
+        for (size_t i = 0; i < range.count; i++) {
+            if (blkid_get_dev (self->cache, range.paths[i], BLKID_DEV_FIND)) {
+                free (range.paths[i]);
+                continue;
+            }
+            range.paths[ncandidates++] = range.paths[i];
+        }
+        range.count = ncandidates;
+    }
+
+    nworkers = range.count < (size_t) workers ? (int) range.count : workers;
+    if (nworkers > 0) {
+        pool = worker_pool_new (nworkers);
+        if (!pool) {
+            self->busy = false;
+            probe_all_range_free (&range);
+            PyErr_SetString (PyExc_RuntimeError, "Failed to start worker threads");
+            return -1;
+        }
+        nworkers = pool->nthreads;
+
+        job_queue_init (&done);
+        for (int i = 0; i < nworkers; i++) {
+            job = calloc (1, sizeof (ProbeAllJob));
+            if (!job)
+                break;
+            job->job.run = probe_all_job_run;
+            job->job.free = probe_all_job_free;
+            job->range = &range;
+            worker_pool_submit (pool, (Job *) job, &done);
+            submitted++;
+        }
+
+        while (finished < submitted) {
+            Py_BEGIN_ALLOW_THREADS
+            job = (ProbeAllJob *) job_queue_pop (&done, 100);
+            Py_END_ALLOW_THREADS
+
+            /* the results are in the range, the job itself is no longer needed */
+            if (job) {
+                probe_all_job_free ((Job *) job);
+                finished++;
+                continue;
+            }
+
+            if (PyErr_CheckSignals () < 0) {
+                /* no more devices for the running workers */
+                __atomic_store_n (&(range.next), range.count, __ATOMIC_RELAXED);
+                Py_BEGIN_ALLOW_THREADS
+                worker_pool_free (pool);
+                Py_END_ALLOW_THREADS
+                job_queue_destroy (&done);
+                self->busy = false;
+                probe_all_range_free (&range);
+                return -1;
+            }
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        worker_pool_free (pool);
+        Py_END_ALLOW_THREADS
+        job_queue_destroy (&done);
+    }
+
+    /* libblkid probes the devices again, now from the page cache filled by the workers */
+    Py_BEGIN_ALLOW_THREADS
+    /* devices without anything detected are only verified if they are already
+     * known (libblkid removes them), new ones wouldn't be added anyway */
+    for (size_t i = 0; i < range.count; i++) {
+        if (!range.found[i] && !blkid_get_dev (self->cache, range.paths[i], BLKID_DEV_FIND))
+            continue;
+        blkid_get_dev (self->cache, range.paths[i], BLKID_DEV_NORMAL);
+    }
+
+    /* anything the candidates above missed (devices with non-standard names...) */
+    ret = blkid_probe_all_new (self->cache);
+    Py_END_ALLOW_THREADS
+    self->busy = false;
+
+    probe_all_range_free (&range);
+
+    if (ret < 0) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to probe new devices");
+        return -1;
+    }
+
+    return 0;
+}
+
 PyDoc_STRVAR(Cache_probe_all__doc__,
-"probe_all (removable=False, new_only=False)\n\n"
+"probe_all (removable=False, new_only=False, workers=0)\n\n"
 "Probes all block devices.\n\n"
 "With removable=True also adds removable block devices to cache. Don't forget that "
 "removable devices could be pretty slow. It's very bad idea to call this function by default."
-"With new_only=True this will scan only newly connected devices.");
+"With new_only=True this will scan only newly connected devices.\n"
+"With workers > 0 the devices are first read by 'workers' native threads in parallel "
+"so waiting for slow devices overlaps, the cache is then updated from the already "
+"read data. The GIL is released meanwhile, using the cache from another thread before "
+"probe_all() returns raises RuntimeError.");
 static PyObject *Cache_probe_all (CacheObject *self, PyObject *args, PyObject *kwargs) {
-    bool removable = false;
-    bool new = false;
-    char *kwlist[] = { "removable", "new_only", NULL };
+    int removable = 0;
+    int new = 0;
+    int workers = 0;
+    char *kwlist[] = { "removable", "new_only", "workers", NULL };
     int ret = 0;
 
-    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "|pp", kwlist, &removable, &new)) {
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "|ppi", kwlist, &removable, &new, &workers)) {
         return NULL;
     }
 
-    if (new) {
+    if (workers < 0) {
+        PyErr_SetString (PyExc_ValueError, "Number of workers must not be negative");
+        return NULL;
+    }
+
+    if (cache_check (self) < 0)
+        return NULL;
+
+    /* devices that disappeared are removed from the cache */
+    self->generation++;
+
+    if (workers > 0) {
+        if (cache_probe_all_parallel (self, removable, new, workers) < 0)
+            return NULL;
+    } else if (new) {
         ret = blkid_probe_all_new (self->cache);
         if (ret < 0) {
             PyErr_SetString (PyExc_RuntimeError, "Failed to probe new devices");
@@ -100,6 +538,10 @@ PyDoc_STRVAR(Cache_gc__doc__,
 "gc\n\n"
 "Removes garbage (non-existing devices) from the cache.");
 static PyObject *Cache_gc (CacheObject *self, PyObject *Py_UNUSED (ignored))  {
+    if (cache_check (self) < 0)
+        return NULL;
+
+    self->generation++;
     blkid_gc_cache (self->cache);
 
     Py_RETURN_NONE;
@@ -112,25 +554,18 @@ static PyObject *Cache_get_device (CacheObject *self, PyObject *args, PyObject *
     const char *name = NULL;
     char *kwlist[] = { "name", NULL };
     blkid_dev device = NULL;
-    DeviceObject *dev_obj = NULL;
 
     if (!PyArg_ParseTupleAndKeywords (args, kwargs, "s", kwlist, &name))
         return NULL;
 
+    if (cache_check (self) < 0)
+        return NULL;
+
     device = blkid_get_dev (self->cache, name, BLKID_DEV_FIND);
     if (device == NULL)
         Py_RETURN_NONE;
 
-    dev_obj = PyObject_New (DeviceObject, &DeviceType);
-    if (!dev_obj) {
-        PyErr_SetString (PyExc_MemoryError, "Failed to create a new Device object");
-        return NULL;
-    }
-
-    dev_obj->device = device;
-    dev_obj->cache = self->cache;
-
-    return (PyObject *)  dev_obj;
+    return cache_device_new (self, device);
 }
 
 PyDoc_STRVAR(Cache_find_device__doc__,
@@ -143,25 +578,1113 @@ static PyObject *Cache_find_device (CacheObject *self, PyObject *args, PyObject
     const char *value = NULL;
     char *kwlist[] = { "tag", "value", NULL };
     blkid_dev device = NULL;
-    DeviceObject *dev_obj = NULL;
 
     if (!PyArg_ParseTupleAndKeywords (args, kwargs, "ss", kwlist, &tag, &value))
         return NULL;
 
+    if (cache_check (self) < 0)
+        return NULL;
+
+    /* candidates are verified and removed if they no longer exist */
+    self->generation++;
+
     device = blkid_find_dev_with_tag (self->cache, tag, value);
     if (device == NULL)
         Py_RETURN_NONE;
 
-    dev_obj = PyObject_New (DeviceObject, &DeviceType);
-    if (!dev_obj) {
-        PyErr_SetString (PyExc_MemoryError, "Failed to create a new Device object");
+    return cache_device_new (self, device);
+}
+
+/* (Re)builds the tag indexes if the devices could have changed since the last build.
+ * The first device with a tag value wins, the order is the order of the devices in
+ * the cache. */
+static int cache_index_update (CacheObject *self) {
+    blkid_dev_iterate dev_iter;
+    blkid_tag_iterate tag_iter;
+    blkid_dev device = NULL;
+    HashTable *tag_index = NULL;
+    const char *type = NULL;
+    const char *value = NULL;
+    int ret = 0;
+
+    if (self->index && self->index_generation == self->generation)
+        return 0;
+
+    cache_index_free (self);
+
+    self->index = hash_table_new (0);
+    if (!self->index) {
+        PyErr_NoMemory ();
+        return -1;
+    }
+
+    dev_iter = blkid_dev_iterate_begin (self->cache);
+    while (ret >= 0 && blkid_dev_next (dev_iter, &device) == 0) {
+        tag_iter = blkid_tag_iterate_begin (device);
+        while (ret >= 0 && blkid_tag_next (tag_iter, &type, &value) == 0) {
+            tag_index = hash_table_lookup (self->index, type);
+            if (!tag_index) {
+                tag_index = hash_table_new (0);
+                if (!tag_index || hash_table_insert (self->index, type, tag_index) < 0) {
+                    hash_table_free (tag_index, NULL);
+                    ret = -1;
+                    break;
+                }
+            }
+
+            ret = hash_table_insert (tag_index, value, device);
+        }
+        blkid_tag_iterate_end (tag_iter);
+    }
+    blkid_dev_iterate_end (dev_iter);
+
+    if (ret < 0) {
+        cache_index_free (self);
+        PyErr_NoMemory ();
+        return -1;
+    }
+
+    self->index_generation = self->generation;
+
+    return 0;
+}
+
+PyDoc_STRVAR(Cache_lookup__doc__,
+"lookup (tag, value)\n\n"
+"Returns a device which matches a particular tag/value pair or None.\n"
+"Unlike find_device() this uses in-memory hash indexes of all tags, which are rebuilt "
+"only when the cache changes (probe_all(), gc()...), and the device is not verified. "
+"If there is more than one matching device, the first one in the cache is returned.");
+static PyObject *Cache_lookup (CacheObject *self, PyObject *args, PyObject *kwargs) {
+    const char *tag = NULL;
+    const char *value = NULL;
+    char *kwlist[] = { "tag", "value", NULL };
+    HashTable *tag_index = NULL;
+    blkid_dev device = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "ss", kwlist, &tag, &value))
+        return NULL;
+
+    if (cache_check (self) < 0 || cache_index_update (self) < 0)
+        return NULL;
+
+    tag_index = hash_table_lookup (self->index, tag);
+    if (tag_index)
+        device = hash_table_lookup (tag_index, value);
+
+    if (!device)
+        Py_RETURN_NONE;
+
+    return cache_device_new (self, device);
+}
+
+/* lazy iteration over devices in the cache, see Cache.iter_devices() */
+typedef struct {
+    PyObject_HEAD
+    CacheObject *cache;
+    blkid_dev_iterate iter;
+    unsigned long generation;
+} CacheDeviceIteratorObject;
+
+static void CacheDeviceIterator_dealloc (CacheDeviceIteratorObject *self) {
+    if (self->iter)
+        blkid_dev_iterate_end (self->iter);
+
+    Py_XDECREF (self->cache);
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static PyObject *CacheDeviceIterator_next (CacheDeviceIteratorObject *self) {
+    blkid_dev device = NULL;
+
+    if (!self->iter)
+        return NULL;
+
+    if (!self->cache->cache || self->generation != self->cache->generation) {
+        PyErr_SetString (PyExc_RuntimeError, "Cache changed during iteration");
+        return NULL;
+    }
+
+    if (blkid_dev_next (self->iter, &device) != 0) {
+        blkid_dev_iterate_end (self->iter);
+        self->iter = NULL;
+        return NULL;
+    }
+
+    return cache_device_new (self->cache, device);
+}
+
+PyTypeObject CacheDeviceIteratorType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid._CacheDeviceIterator",
+    .tp_basicsize = sizeof (CacheDeviceIteratorObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) CacheDeviceIterator_dealloc,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) CacheDeviceIterator_next,
+};
+
+PyDoc_STRVAR(Cache_iter_devices__doc__,
+"iter_devices ()\n\n"
+"Returns an iterator over all devices in the cache, unlike Cache.devices the Device objects "
+"are created one by one. Changing the cache (probe_all(), gc()...) during the iteration "
+"raises RuntimeError.");
+static PyObject *Cache_iter_devices (CacheObject *self, PyObject *Py_UNUSED (ignored)) {
+    CacheDeviceIteratorObject *iter = NULL;
+
+    if (cache_check (self) < 0)
+        return NULL;
+
+    iter = PyObject_New (CacheDeviceIteratorObject, &CacheDeviceIteratorType);
+    if (!iter) {
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new device iterator");
+        return NULL;
+    }
+
+    Py_INCREF (self);
+    iter->cache = self;
+    iter->generation = self->generation;
+    iter->iter = blkid_dev_iterate_begin (self->cache);
+    if (!iter->iter) {
+        Py_DECREF (iter);
+        return PyErr_NoMemory ();
+    }
+
+    return (PyObject *) iter;
+}
+
+/* devname of the device with the tag from the index, 'spec' is a NAME=value string */
+static const char *cache_resolve_tag (CacheObject *self, const char *spec, int *ret) {
+    HashTable *tag_index = NULL;
+    blkid_dev device = NULL;
+    char *type = NULL;
+    char *value = NULL;
+
+    *ret = blkid_parse_tag_string (spec, &type, &value);
+    if (*ret < 0)
+        return NULL;
+
+    tag_index = type ? hash_table_lookup (self->index, type) : NULL;
+    if (tag_index && value)
+        device = hash_table_lookup (tag_index, value);
+
+    free (type);
+    free (value);
+
+    return device ? blkid_dev_devname (device) : NULL;
+}
+
+PyDoc_STRVAR(Cache_resolve_many__doc__,
+"resolve_many (specs)\n\n"
+"Resolves all 'specs' at once and returns a dictionary mapping every spec to the device name "
+"or None if no device matches.\n"
+"Tags (e.g. \"UUID=...\" or \"LABEL=...\") are parsed with blkid.parse_tag_string() and looked "
+"up in the indexes used by Cache.lookup(), so only devices already in the cache are found "
+"and no device is probed or verified. Paths (e.g. /dev/dm-0) are converted to their canonical "
+"names like with blkid.evaluate_spec().");
+static PyObject *Cache_resolve_many (CacheObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *py_specs = NULL;
+    char *kwlist[] = { "specs", NULL };
+    PyObject *specs = NULL;
+    PyObject *py_spec = NULL;
+    PyObject *result = NULL;
+    PyObject *py_devname = NULL;
+    const char *spec = NULL;
+    const char *devname = NULL;
+    char *path = NULL;
+    int ret = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O", kwlist, &py_specs))
+        return NULL;
+
+    if (cache_check (self) < 0)
+        return NULL;
+
+    specs = PySequence_Fast (py_specs, "specs must be a sequence of strings");
+    if (!specs)
+        return NULL;
+
+    result = PyDict_New ();
+    if (!result || cache_index_update (self) < 0)
+        goto error;
+
+    for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE (specs); i++) {
+        py_spec = PySequence_Fast_GET_ITEM (specs, i);
+        spec = PyUnicode_AsUTF8 (py_spec);
+        if (!spec)
+            goto error;
+
+        path = NULL;
+        devname = NULL;
+        if (strchr (spec, '=') && *spec != '/') {
+            devname = cache_resolve_tag (self, spec, &ret);
+            if (ret < 0) {
+                PyErr_Format (PyExc_ValueError, "Failed to parse tag '%s'", spec);
+                goto error;
+            }
+        } else {
+            /* paths don't use the cache */
+            path = blkid_evaluate_spec (spec, NULL);
+            devname = path;
+        }
+
+        if (devname)
+            py_devname = PyUnicode_FromString (devname);
+        else {
+            Py_INCREF (Py_None);
+            py_devname = Py_None;
+        }
+        free (path);
+
+        if (!py_devname || PyDict_SetItem (result, py_spec, py_devname) < 0) {
+            Py_XDECREF (py_devname);
+            goto error;
+        }
+        Py_DECREF (py_devname);
+    }
+
+    Py_DECREF (specs);
+
+    return result;
+
+error:
+    Py_DECREF (specs);
+    Py_XDECREF (result);
+
+    return NULL;
+}
+
+/* All cached tags are compared with what is on the device, if they match the
+ * device is considered unchanged and libblkid doesn't need to probe it again. */
+typedef struct {
+    char *devname;
+    char **tags;        /* name and value pairs from the cache */
+    int ntags;
+    bool unchanged;
+} VerifyAllEntry;
+
+typedef struct {
+    VerifyAllEntry *entries;
+    size_t count;
+    size_t next;
+} VerifyAllRange;
+
+typedef struct {
+    Job job;
+    VerifyAllRange *range;
+} VerifyAllJob;
+
+/* the tag libblkid stores in the cache for the probing value 'name' (see
+ * blkid_verify()), NULL if the value is not cached */
+static const char *verify_all_tag_name (const char *name) {
+    if (strncmp (name, "PART_ENTRY_", 11) == 0) {
+        if (strcmp (name, "PART_ENTRY_UUID") == 0)
+            return "PARTUUID";
+        if (strcmp (name, "PART_ENTRY_NAME") == 0)
+            return "PARTLABEL";
+        return NULL;
+    }
+
+    /* SYSTEM_ID, APPLICATION_ID... */
+    if (strstr (name, "_ID"))
+        return NULL;
+
+    return name;
+}
+
+static bool verify_all_entry_unchanged (VerifyAllEntry *entry, blkid_probe probe) {
+    const char *name = NULL;
+    const char *value = NULL;
+    int nvalues = 0;
+    int matched = 0;
+    int i = 0;
+
+    nvalues = blkid_probe_numof_values (probe);
+    for (int n = 0; n < nvalues; n++) {
+        if (blkid_probe_get_value (probe, n, &name, &value, NULL) != 0)
+            continue;
+
+        name = verify_all_tag_name (name);
+        if (!name)
+            continue;
+
+        for (i = 0; i < entry->ntags; i++) {
+            if (strcmp (name, entry->tags[i * 2]) == 0)
+                break;
+        }
+
+        /* a new tag or a different value */
+        if (i == entry->ntags || strcmp (value, entry->tags[i * 2 + 1]) != 0)
+            return false;
+        matched++;
+    }
+
+    /* a cached tag that is no longer on the device */
+    return matched == entry->ntags;
+}
+
+static void verify_all_job_run (Job *job) {
+    VerifyAllRange *range = ((VerifyAllJob *) job)->range;
+    VerifyAllEntry *entry = NULL;
+    blkid_probe probe = NULL;
+    size_t i = 0;
+    int fd = -1;
+
+    probe = blkid_new_probe ();
+    if (!probe)
+        return;
+
+    /* the same values blkid_verify() stores as tags */
+    blkid_probe_enable_superblocks (probe, 1);
+    blkid_probe_set_superblocks_flags (probe, BLKID_SUBLKS_LABEL | BLKID_SUBLKS_UUID |
+                                              BLKID_SUBLKS_TYPE | BLKID_SUBLKS_SECTYPE);
+    blkid_probe_enable_partitions (probe, 1);
+    blkid_probe_set_partitions_flags (probe, BLKID_PARTS_ENTRY_DETAILS);
+
+    while ((i = __atomic_fetch_add (&(range->next), 1, __ATOMIC_RELAXED)) < range->count) {
+        entry = &(range->entries[i]);
+
+        /* like libblkid, cached data is kept for devices we can't read, devices that
+         * can't be opened for other reasons are left to libblkid to remove */
+        fd = open (entry->devname, O_RDONLY|O_CLOEXEC|O_NONBLOCK);
+        if (fd < 0) {
+            entry->unchanged = errno == EPERM || errno == EACCES;
+            continue;
+        }
+
+        if (blkid_probe_set_device (probe, fd, 0, 0) == 0 && blkid_do_safeprobe (probe) >= 0)
+            entry->unchanged = verify_all_entry_unchanged (entry, probe);
+
+        close (fd);
+    }
+
+    blkid_free_probe (probe);
+}
+
+static void verify_all_job_free (Job *job) {
+    free (job);
+}
+
+static void verify_all_range_free (VerifyAllRange *range) {
+    for (size_t i = 0; i < range->count; i++) {
+        free (range->entries[i].devname);
+        for (int j = 0; j < range->entries[i].ntags * 2; j++)
+            free (range->entries[i].tags[j]);
+        free (range->entries[i].tags);
+    }
+    free (range->entries);
+}
+
+static int verify_all_entry_init (VerifyAllEntry *entry, blkid_dev device) {
+    blkid_tag_iterate iter;
+    const char *type = NULL;
+    const char *value = NULL;
+    char **tags = NULL;
+    int allocated = 0;
+    int ret = 0;
+
+    entry->devname = strdup (blkid_dev_devname (device));
+    if (!entry->devname)
+        return -1;
+
+    iter = blkid_tag_iterate_begin (device);
+    while (ret == 0 && blkid_tag_next (iter, &type, &value) == 0) {
+        if (entry->ntags == allocated) {
+            allocated = allocated ? allocated * 2 : 8;
+            tags = realloc (entry->tags, allocated * 2 * sizeof (char *));
+            if (!tags) {
+                ret = -1;
+                break;
+            }
+            entry->tags = tags;
+        }
+
+        entry->tags[entry->ntags * 2] = strdup (type);
+        entry->tags[entry->ntags * 2 + 1] = strdup (value);
+        entry->ntags++;
+        if (!entry->tags[entry->ntags * 2 - 2] || !entry->tags[entry->ntags * 2 - 1])
+            ret = -1;
+    }
+    blkid_tag_iterate_end (iter);
+
+    return ret;
+}
+
+/* devices not verified in the last 'max_age' seconds (or never, 0 means all devices) */
+static int verify_all_range_init (CacheObject *self, VerifyAllRange *range, double max_age, double now) {
+    blkid_dev_iterate iter;
+    blkid_dev device = NULL;
+    VerifyAllEntry *entries = NULL;
+    double *last = NULL;
+    size_t allocated = 0;
+    int ret = 0;
+
+    memset (range, 0, sizeof (VerifyAllRange));
+
+    iter = blkid_dev_iterate_begin (self->cache);
+    while (ret == 0 && blkid_dev_next (iter, &device) == 0) {
+        last = self->verified ? hash_table_lookup (self->verified, blkid_dev_devname (device)) : NULL;
+        if (max_age > 0 && last && now - *last < max_age)
+            continue;
+
+        if (range->count == allocated) {
+            allocated = allocated ? allocated * 2 : 64;
+            entries = realloc (range->entries, allocated * sizeof (VerifyAllEntry));
+            if (!entries) {
+                ret = -1;
+                break;
+            }
+            range->entries = entries;
+        }
+
+        memset (&(range->entries[range->count]), 0, sizeof (VerifyAllEntry));
+        ret = verify_all_entry_init (&(range->entries[range->count]), device);
+        range->count++;
+    }
+    blkid_dev_iterate_end (iter);
+
+    if (ret < 0)
+        verify_all_range_free (range);
+
+    return ret;
+}
+
+static int cache_count_devices (CacheObject *self) {
+    blkid_dev_iterate iter;
+    blkid_dev device = NULL;
+    int count = 0;
+
+    iter = blkid_dev_iterate_begin (self->cache);
+    while (blkid_dev_next (iter, &device) == 0)
+        count++;
+    blkid_dev_iterate_end (iter);
+
+    return count;
+}
+
+PyDoc_STRVAR(Cache_verify_all__doc__,
+"verify_all (max_age=0, workers=0)\n\n"
+"Revalidates devices that were not verified (by verify_all() or Device.verify()) in "
+"the last 'max_age' seconds, 0 means all devices. The devices are read in parallel by "
+"native worker threads without the GIL, only devices with any of the cached tags changed "
+"are probed again by libblkid, devices that disappeared are removed and the cache is "
+"garbage collected.\n"
+"'workers' is the number of worker threads, by default one thread per online CPU is used.\n\n"
+"Returns a dictionary with the number of 'refreshed', 'unchanged' and 'removed' devices. "
+"'stale' devices changed, but libblkid kept their cached data because it probed them "
+"recently and their device node couldn't be touched to force a new probe (this needs "
+"CAP_FOWNER for nodes owned by other users), they are verified again next time.");
+static PyObject *Cache_verify_all (CacheObject *self, PyObject *args, PyObject *kwargs) {
+    double max_age = 0;
+    int workers = 0;
+    char *kwlist[] = { "max_age", "workers", NULL };
+    VerifyAllRange range;
+    VerifyAllEntry *entry = NULL;
+    VerifyAllJob *job = NULL;
+    WorkerPool *pool = NULL;
+    JobQueue done;
+    blkid_dev device = NULL;
+    double now = 0;
+    int submitted = 0;
+    int finished = 0;
+    int refreshed = 0;
+    int unchanged = 0;
+    int removed = 0;
+    int stale = 0;
+    int count = 0;
+    bool touched = false;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "|di", kwlist, &max_age, &workers))
+        return NULL;
+
+    if (max_age < 0) {
+        PyErr_SetString (PyExc_ValueError, "Maximum age must not be negative");
+        return NULL;
+    }
+
+    if (cache_check (self) < 0)
+        return NULL;
+
+    now = cache_monotonic_time ();
+    if (verify_all_range_init (self, &range, max_age, now) < 0)
+        return PyErr_NoMemory ();
+
+    if (workers < 1)
+        workers = worker_pool_default_size ();
+    if ((size_t) workers > range.count)
+        workers = (int) range.count;
+
+    if (workers > 0) {
+        pool = worker_pool_new (workers);
+        if (!pool) {
+            verify_all_range_free (&range);
+            PyErr_SetString (PyExc_RuntimeError, "Failed to start worker threads");
+            return NULL;
+        }
+
+        job_queue_init (&done);
+        for (int i = 0; i < pool->nthreads; i++) {
+            job = calloc (1, sizeof (VerifyAllJob));
+            if (!job)
+                break;
+            job->job.run = verify_all_job_run;
+            job->job.free = verify_all_job_free;
+            job->range = &range;
+            worker_pool_submit (pool, (Job *) job, &done);
+            submitted++;
+        }
+
+        while (finished < submitted) {
+            Py_BEGIN_ALLOW_THREADS
+            job = (VerifyAllJob *) job_queue_pop (&done, 100);
+            Py_END_ALLOW_THREADS
+
+            /* the results are in the range, the job itself is no longer needed */
+            if (job) {
+                verify_all_job_free ((Job *) job);
+                finished++;
+                continue;
+            }
+
+            if (PyErr_CheckSignals () < 0) {
+                __atomic_store_n (&(range.next), range.count, __ATOMIC_RELAXED);
+                Py_BEGIN_ALLOW_THREADS
+                worker_pool_free (pool);
+                Py_END_ALLOW_THREADS
+                job_queue_destroy (&done);
+                verify_all_range_free (&range);
+                return NULL;
+            }
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        worker_pool_free (pool);
+        Py_END_ALLOW_THREADS
+        job_queue_destroy (&done);
+    }
+
+    /* devices could be freed from here on */
+    self->generation++;
+
+    for (size_t i = 0; i < range.count; i++) {
+        entry = &(range.entries[i]);
+
+        if (entry->unchanged) {
+            unchanged++;
+            cache_mark_verified (self, entry->devname, now);
+            continue;
+        }
+
+        device = blkid_get_dev (self->cache, entry->devname, BLKID_DEV_FIND);
+        if (!device)
+            continue;
+
+        /* without the touch libblkid would return the cached data of a device
+         * probed recently, so it's left stale and verified again next time */
+        touched = cache_touch_device (entry->devname) == 0;
+        if (!blkid_verify (self->cache, device))
+            removed++;
+        else if (touched) {
+            refreshed++;
+            cache_mark_verified (self, entry->devname, now);
+        } else
+            stale++;
+    }
+
+    verify_all_range_free (&range);
+
+    count = cache_count_devices (self);
+    blkid_gc_cache (self->cache);
+    removed += count - cache_count_devices (self);
+
+    return Py_BuildValue ("{s:i,s:i,s:i,s:i}", "refreshed", refreshed, "unchanged", unchanged,
+                          "removed", removed, "stale", stale);
+}
+
+PyDoc_STRVAR(Cache_save__doc__,
+"save ()\n\n"
+"Writes the cache to the cache file (if it was changed) and reloads it.\n"
+"libblkid doesn't report errors when writing the file, results of a cache that can't be "
+"written (e.g. the default cache file without root access) are lost by saving it.");
+static PyObject *Cache_save (CacheObject *self, PyObject *Py_UNUSED (ignored)) {
+    int ret = 0;
+
+    if (cache_check (self) < 0)
+        return NULL;
+
+    /* libblkid writes the cache only when releasing it */
+    blkid_put_cache (self->cache);
+    self->cache = NULL;
+    self->generation++;
+
+    ret = blkid_get_cache (&(self->cache), self->filename);
+    if (ret < 0) {
+        self->cache = NULL;
+        PyErr_SetString (PyExc_RuntimeError, "Failed to reload cache");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Cache_close__doc__,
+"close ()\n\n"
+"Writes the cache to the cache file (if it was changed) and frees it. Devices from "
+"the cache can't be used after closing it and watching for uevents is stopped. Calling "
+"close() more than once is allowed.");
+static PyObject *Cache_close (CacheObject *self, PyObject *Py_UNUSED (ignored)) {
+    if (self->busy) {
+        PyErr_SetString (PyExc_RuntimeError, CACHE_BUSY_ERROR);
+        return NULL;
+    }
+
+    if (self->cache) {
+        blkid_put_cache (self->cache);
+        self->cache = NULL;
+        self->generation++;
+    }
+
+    if (self->uevent_fd >= 0) {
+        close (self->uevent_fd);
+        self->uevent_fd = -1;
+    }
+
+    cache_index_free (self);
+    hash_table_free (self->verified, free);
+    self->verified = NULL;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *Cache_enter (CacheObject *self, PyObject *Py_UNUSED (ignored)) {
+    if (cache_check (self) < 0)
+        return NULL;
+
+    Py_INCREF (self);
+    return (PyObject *) self;
+}
+
+static PyObject *Cache_exit (CacheObject *self, PyObject *args UNUSED) {
+    return Cache_close (self, NULL);
+}
+
+/*********************** SNAPSHOT FORMAT ***********************/
+/* Native byte order, a snapshot from a different architecture fails the version check.
+ * The header is followed by an array of absolute offsets of the device records, every
+ * record is the number of tags (uint32_t) followed by the NUL-terminated device name
+ * and name/value pairs of the tags. */
+#define CACHE_SNAPSHOT_MAGIC "BLKIDSNP"
+#define CACHE_SNAPSHOT_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t ndevices;
+    uint64_t size;
+} CacheSnapshotHeader;
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t allocated;
+} SnapshotBuffer;
+
+static int snapshot_buffer_append (SnapshotBuffer *buf, const void *data, size_t len) {
+    char *new_data = NULL;
+    size_t allocated = buf->allocated ? buf->allocated : 4096;
+
+    while (buf->len + len > allocated)
+        allocated *= 2;
+
+    if (allocated != buf->allocated) {
+        new_data = realloc (buf->data, allocated);
+        if (!new_data)
+            return -1;
+        buf->data = new_data;
+        buf->allocated = allocated;
+    }
+
+    memcpy (buf->data + buf->len, data, len);
+    buf->len += len;
+
+    return 0;
+}
+
+static int snapshot_buffer_append_string (SnapshotBuffer *buf, const char *str) {
+    return snapshot_buffer_append (buf, str, strlen (str) + 1);
+}
+
+/* appends one device record, returns the number of tags or -1 on failure */
+static int snapshot_add_device (SnapshotBuffer *records, blkid_dev device) {
+    blkid_tag_iterate iter;
+    const char *type = NULL;
+    const char *value = NULL;
+    size_t start = records->len;
+    uint32_t ntags = 0;
+    int ret = 0;
+
+    if (snapshot_buffer_append (records, &ntags, sizeof (ntags)) < 0 ||
+        snapshot_buffer_append_string (records, blkid_dev_devname (device) ? blkid_dev_devname (device) : "") < 0)
+        return -1;
+
+    iter = blkid_tag_iterate_begin (device);
+    while (ret == 0 && blkid_tag_next (iter, &type, &value) == 0) {
+        if (snapshot_buffer_append_string (records, type) < 0 ||
+            snapshot_buffer_append_string (records, value) < 0)
+            ret = -1;
+        ntags++;
+    }
+    blkid_tag_iterate_end (iter);
+
+    if (ret < 0)
+        return -1;
+
+    memcpy (records->data + start, &ntags, sizeof (ntags));
+
+    return ntags;
+}
+
+static int snapshot_write (const char *filename, const SnapshotBuffer *offsets, const SnapshotBuffer *records,
+                           uint32_t ndevices) {
+    CacheSnapshotHeader header;
+    char *tmpname = NULL;
+    const struct { const void *data; size_t len; } parts[] = {
+        { &header, sizeof (header) },
+        { offsets->data, offsets->len },
+        { records->data, records->len },
+    };
+    const char *data = NULL;
+    size_t len = 0;
+    ssize_t written = 0;
+    int fd = -1;
+    int err = 0;
+
+    memcpy (header.magic, CACHE_SNAPSHOT_MAGIC, sizeof (header.magic));
+    header.version = CACHE_SNAPSHOT_VERSION;
+    header.ndevices = ndevices;
+    header.size = sizeof (header) + offsets->len + records->len;
+
+    /* written to a temporary file and renamed, readers never see a partial snapshot */
+    if (asprintf (&tmpname, "%s.XXXXXX", filename) < 0)
+        return -1;
+
+    fd = mkstemp (tmpname);
+    if (fd < 0) {
+        err = errno;
+        free (tmpname);
+        errno = err;
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof (parts) / sizeof (parts[0]) && err == 0; i++) {
+        data = parts[i].data;
+        len = parts[i].len;
+        while (len > 0) {
+            written = write (fd, data, len);
+            if (written < 0 && errno == EINTR)
+                continue;
+            if (written < 0) {
+                err = errno;
+                break;
+            }
+            data += written;
+            len -= written;
+        }
+    }
+
+    if (err == 0 && fchmod (fd, 0644) < 0)
+        err = errno;
+    if (close (fd) < 0 && err == 0)
+        err = errno;
+    if (err == 0 && rename (tmpname, filename) < 0)
+        err = errno;
+
+    if (err != 0)
+        unlink (tmpname);
+    free (tmpname);
+
+    errno = err;
+    return err == 0 ? 0 : -1;
+}
+
+PyDoc_STRVAR(Cache_save_snapshot__doc__,
+"save_snapshot (filename)\n\n"
+"Writes names and tags of all devices in the cache to 'filename' in a compact binary "
+"format that can be loaded by blkid.CacheSnapshot without parsing.\n"
+"The file is replaced atomically. The format uses the native byte order and is meant "
+"to be read on the same host.");
+static PyObject *Cache_save_snapshot (CacheObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *py_filename = NULL;
+    char *kwlist[] = { "filename", NULL };
+    SnapshotBuffer offsets = { NULL, 0, 0 };
+    SnapshotBuffer records = { NULL, 0, 0 };
+    blkid_dev_iterate iter;
+    blkid_dev device = NULL;
+    uint64_t offset = 0;
+    uint32_t ndevices = 0;
+    int ret = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O&", kwlist, PyUnicode_FSConverter, &py_filename))
+        return NULL;
+
+    if (cache_check (self) < 0) {
+        Py_DECREF (py_filename);
+        return NULL;
+    }
+
+    /* record offsets are relative here, made absolute once the number of devices is known */
+    iter = blkid_dev_iterate_begin (self->cache);
+    while (ret == 0 && blkid_dev_next (iter, &device) == 0) {
+        offset = records.len;
+        if (snapshot_buffer_append (&offsets, &offset, sizeof (offset)) < 0 ||
+            snapshot_add_device (&records, device) < 0)
+            ret = -1;
+        ndevices++;
+    }
+    blkid_dev_iterate_end (iter);
+
+    if (ret < 0) {
+        free (offsets.data);
+        free (records.data);
+        Py_DECREF (py_filename);
+        return PyErr_NoMemory ();
+    }
+
+    for (uint32_t i = 0; i < ndevices; i++)
+        ((uint64_t *) offsets.data)[i] += sizeof (CacheSnapshotHeader) + offsets.len;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = snapshot_write (PyBytes_AS_STRING (py_filename), &offsets, &records, ndevices);
+    Py_END_ALLOW_THREADS
+
+    free (offsets.data);
+    free (records.data);
+
+    if (ret < 0) {
+        PyErr_SetFromErrnoWithFilenameObject (PyExc_OSError, py_filename);
+        Py_DECREF (py_filename);
+        return NULL;
+    }
+
+    Py_DECREF (py_filename);
+    Py_RETURN_NONE;
+}
+
+/*********************** UEVENTS ***********************/
+#define UEVENT_BUFFER_SIZE 8192
+#define UEVENT_RCVBUF_SIZE (1024 * 1024)
+
+PyDoc_STRVAR(Cache_watch__doc__,
+"watch ()\n\n"
+"Starts listening to kernel uevents on a netlink socket, events are collected by the kernel "
+"until they are applied with Cache.apply_uevents(). udev is not needed.\n"
+"Use Cache.fileno() to wait for the events with select() or an event loop.");
+static PyObject *Cache_watch (CacheObject *self, PyObject *Py_UNUSED (ignored)) {
+    struct sockaddr_nl addr;
+    int size = UEVENT_RCVBUF_SIZE;
+    int fd = -1;
+
+    if (cache_check (self) < 0)
+        return NULL;
+
+    if (self->uevent_fd >= 0)
+        Py_RETURN_NONE;
+
+    fd = socket (AF_NETLINK, SOCK_DGRAM|SOCK_NONBLOCK|SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return PyErr_SetFromErrno (PyExc_OSError);
+
+    /* not fatal, a small buffer only makes an overflow (and full rescan) more likely */
+    setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+
+    memset (&addr, 0, sizeof (addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;     /* kernel events, not the ones re-broadcast by udev */
+    if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0) {
+        PyErr_SetFromErrno (PyExc_OSError);
+        close (fd);
+        return NULL;
+    }
+
+    self->uevent_fd = fd;
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Cache_fileno__doc__,
+"fileno ()\n\n"
+"Returns the uevent socket file descriptor, readable when there are uevents to apply.");
+static PyObject *Cache_fileno (CacheObject *self, PyObject *Py_UNUSED (ignored)) {
+    if (self->uevent_fd < 0) {
+        PyErr_SetString (PyExc_ValueError, "Cache is not watching uevents, call watch() first");
+        return NULL;
+    }
+
+    return PyLong_FromLong (self->uevent_fd);
+}
+
+/* returns value of 'key' from the NUL-separated KEY=value list of the uevent */
+static const char *uevent_get (const char *buf, size_t len, const char *key) {
+    size_t keylen = strlen (key);
+
+    for (const char *p = buf; p < buf + len; p += strlen (p) + 1) {
+        if (strncmp (p, key, keylen) == 0 && p[keylen] == '=')
+            return p + keylen + 1;
+    }
+
+    return NULL;
+}
+
+/* Applies one block device uevent to the cache, returns the (action, devname)
+ * tuple, None for events that are not about block devices or NULL on error. */
+static PyObject *cache_apply_uevent (CacheObject *self, const char *buf, size_t len) {
+    const char *action = uevent_get (buf, len, "ACTION");
+    const char *subsystem = uevent_get (buf, len, "SUBSYSTEM");
+    const char *devname = uevent_get (buf, len, "DEVNAME");
+    blkid_dev device = NULL;
+    char *path = NULL;
+    PyObject *ret = NULL;
+
+    if (!action || !subsystem || !devname || strcmp (subsystem, "block") != 0)
+        Py_RETURN_NONE;
+
+    if (devname[0] == '/')
+        path = strdup (devname);
+    else if (asprintf (&path, "/dev/%s", devname) < 0)
+        path = NULL;
+    if (!path)
+        return PyErr_NoMemory ();
+
+    if (strcmp (action, "add") == 0 || strcmp (action, "change") == 0) {
+        /* the device was changed, so it must be probed again even if it was probed recently */
+        if (strcmp (action, "change") == 0)
+            cache_touch_device (path);
+
+        /* creates the device if needed and probes it, devices without any detected
+         * type are removed by libblkid */
+        blkid_get_dev (self->cache, path, BLKID_DEV_NORMAL);
+    } else if (strcmp (action, "remove") == 0) {
+        /* verification removes devices that no longer exist */
+        device = blkid_get_dev (self->cache, path, BLKID_DEV_FIND);
+        if (device)
+            blkid_verify (self->cache, device);
+    } else {
+        free (path);
+        Py_RETURN_NONE;
+    }
+
+    ret = Py_BuildValue ("(ss)", action, path);
+    free (path);
+
+    return ret;
+}
+
+PyDoc_STRVAR(Cache_apply_uevents__doc__,
+"apply_uevents (timeout=0)\n\n"
+"Updates the cache with block device uevents received since the last call: added and "
+"changed devices are probed and removed devices (and devices without any detected "
+"type) are dropped from the cache. Other devices are not touched.\n"
+"libblkid decides whether a device needs to be probed again by the modification time of "
+"its device node, so the time is updated for devices with a change event.\n"
+"Waits at most 'timeout' seconds for the first event (None means wait forever). Returns "
+"a list of applied (action, devname) tuples. If the kernel dropped events because they "
+"were not read fast enough, all devices are probed again and ('rescan', None) is added "
+"to the list.\n"
+"Cache.watch() must be called first.");
+static PyObject *Cache_apply_uevents (CacheObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *py_timeout = NULL;
+    char *kwlist[] = { "timeout", NULL };
+    double timeout = 0;
+    int timeout_ms = 0;
+    char buf[UEVENT_BUFFER_SIZE];
+    struct sockaddr_nl addr;
+    struct iovec iov = { buf, sizeof (buf) - 1 };
+    struct msghdr msg;
+    struct pollfd pfd;
+    PyObject *result = NULL;
+    PyObject *event = NULL;
+    ssize_t len = 0;
+    int ret = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "|O", kwlist, &py_timeout))
+        return NULL;
+
+    if (py_timeout && py_timeout != Py_None) {
+        timeout = PyFloat_AsDouble (py_timeout);
+        if (timeout == -1 && PyErr_Occurred ())
+            return NULL;
+        timeout_ms = timeout > 0 ? (int) (timeout * 1000) : 0;
+    } else if (py_timeout == Py_None)
+        timeout_ms = -1;
+
+    if (cache_check (self) < 0)
+        return NULL;
+
+    if (self->uevent_fd < 0) {
+        PyErr_SetString (PyExc_ValueError, "Cache is not watching uevents, call watch() first");
+        return NULL;
+    }
+
+    pfd.fd = self->uevent_fd;
+    pfd.events = POLLIN;
+    do {
+        Py_BEGIN_ALLOW_THREADS
+        ret = poll (&pfd, 1, timeout_ms);
+        Py_END_ALLOW_THREADS
+        if (ret < 0 && errno == EINTR && PyErr_CheckSignals () < 0)
+            return NULL;
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0)
+        return PyErr_SetFromErrno (PyExc_OSError);
+
+    result = PyList_New (0);
+    if (!result)
         return NULL;
-    }
 
-    dev_obj->device = device;
-    dev_obj->cache = self->cache;
+    for (;;) {
+        memset (&msg, 0, sizeof (msg));
+        msg.msg_name = &addr;
+        msg.msg_namelen = sizeof (addr);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        len = recvmsg (self->uevent_fd, &msg, MSG_DONTWAIT);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+
+        if (len < 0 && errno == ENOBUFS) {
+            /* the socket buffer overflowed, nothing to do but to look at all devices */
+            self->generation++;
+            blkid_probe_all (self->cache);
+            blkid_gc_cache (self->cache);
+            event = Py_BuildValue ("(sO)", "rescan", Py_None);
+        } else if (len < 0) {
+            PyErr_SetFromErrno (PyExc_OSError);
+            Py_DECREF (result);
+            return NULL;
+        } else {
+            /* only trust messages from the kernel */
+            if (addr.nl_pid != 0 || (msg.msg_flags & MSG_TRUNC))
+                continue;
+            buf[len] = '\0';
+
+            self->generation++;
+            event = cache_apply_uevent (self, buf, len);
+        }
+
+        if (!event || (event != Py_None && PyList_Append (result, event) < 0)) {
+            Py_XDECREF (event);
+            Py_DECREF (result);
+            return NULL;
+        }
+        Py_DECREF (event);
+    }
 
-    return (PyObject *)  dev_obj;
+    return result;
 }
 
 static PyMethodDef Cache_methods[] = {
@@ -169,15 +1692,30 @@ static PyMethodDef Cache_methods[] = {
     {"gc", (PyCFunction) Cache_gc, METH_NOARGS, Cache_gc__doc__},
     {"get_device", (PyCFunction)(void(*)(void)) Cache_get_device, METH_VARARGS|METH_KEYWORDS, Cache_get_device__doc__},
     {"find_device", (PyCFunction)(void(*)(void)) Cache_find_device, METH_VARARGS|METH_KEYWORDS, Cache_find_device__doc__},
+    {"lookup", (PyCFunction)(void(*)(void)) Cache_lookup, METH_VARARGS|METH_KEYWORDS, Cache_lookup__doc__},
+    {"iter_devices", (PyCFunction) Cache_iter_devices, METH_NOARGS, Cache_iter_devices__doc__},
+    {"resolve_many", (PyCFunction)(void(*)(void)) Cache_resolve_many, METH_VARARGS|METH_KEYWORDS, Cache_resolve_many__doc__},
+    {"verify_all", (PyCFunction)(void(*)(void)) Cache_verify_all, METH_VARARGS|METH_KEYWORDS, Cache_verify_all__doc__},
+    {"save", (PyCFunction) Cache_save, METH_NOARGS, Cache_save__doc__},
+    {"save_snapshot", (PyCFunction)(void(*)(void)) Cache_save_snapshot, METH_VARARGS|METH_KEYWORDS, Cache_save_snapshot__doc__},
+    {"watch", (PyCFunction) Cache_watch, METH_NOARGS, Cache_watch__doc__},
+    {"fileno", (PyCFunction) Cache_fileno, METH_NOARGS, Cache_fileno__doc__},
+    {"apply_uevents", (PyCFunction)(void(*)(void)) Cache_apply_uevents, METH_VARARGS|METH_KEYWORDS, Cache_apply_uevents__doc__},
+    {"close", (PyCFunction) Cache_close, METH_NOARGS, Cache_close__doc__},
+    {"__enter__", (PyCFunction) Cache_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction) Cache_exit, METH_VARARGS, NULL},
     {NULL, NULL, 0, NULL},
 };
 
 static PyObject *Cache_get_devices (CacheObject *self, PyObject *Py_UNUSED (ignored)) {
     blkid_dev_iterate iter;
     blkid_dev device = NULL;
-    DeviceObject *dev_obj = NULL;
+    PyObject *dev_obj = NULL;
     PyObject *list = NULL;
 
+    if (cache_check (self) < 0)
+        return NULL;
+
     list = PyList_New (0);
     if (!list) {
         PyErr_NoMemory ();
@@ -186,24 +1724,26 @@ static PyObject *Cache_get_devices (CacheObject *self, PyObject *Py_UNUSED (igno
 
     iter = blkid_dev_iterate_begin (self->cache);
     while (blkid_dev_next (iter, &device) == 0) {
-        dev_obj = PyObject_New (DeviceObject, &DeviceType);
-        if (!dev_obj) {
-            PyErr_NoMemory ();
-            return NULL;
+        dev_obj = cache_device_new (self, device);
+        if (!dev_obj || PyList_Append (list, dev_obj) < 0) {
+            Py_XDECREF (dev_obj);
+            Py_CLEAR (list);
+            break;
         }
-        dev_obj->device = device;
-        dev_obj->cache = self->cache;
-        PyList_Append (list, (PyObject *) dev_obj);
         Py_DECREF (dev_obj);
+    }
+    blkid_dev_iterate_end (iter);
 
-	}
-	blkid_dev_iterate_end(iter);
+    return list;
+}
 
-    return (PyObject *) list;
+static PyObject *Cache_get_closed (CacheObject *self, PyObject *Py_UNUSED (ignored)) {
+    return PyBool_FromLong (self->cache == NULL);
 }
 
 static PyGetSetDef Cache_getseters[] = {
     {"devices", (getter) Cache_get_devices, NULL, "returns all devices in the cache", NULL},
+    {"closed", (getter) Cache_get_closed, NULL, "whether the cache was closed", NULL},
     {NULL, NULL, NULL, NULL, NULL}
 };
 
@@ -227,6 +1767,10 @@ PyObject *Device_new (PyTypeObject *type,  PyObject *args UNUSED, PyObject *kwar
     if (self) {
         self->device = NULL;
         self->cache = NULL;
+        self->generation = 0;
+        self->devname = NULL;
+        self->tags = NULL;
+        self->tags_generation = 0;
     }
 
     return (PyObject *) self;
@@ -237,16 +1781,51 @@ int Device_init (DeviceObject *self UNUSED, PyObject *args UNUSED, PyObject *kwa
 }
 
 void Device_dealloc (DeviceObject *self) {
+    Py_XDECREF (self->tags);
+    free (self->devname);
+    Py_XDECREF (self->cache);
     Py_TYPE (self)->tp_free ((PyObject *) self);
 }
 
+/* makes sure self->device is still a valid libblkid device */
+static int device_check (DeviceObject *self) {
+    if (!self->cache) {
+        PyErr_SetString (PyExc_ValueError, "Device is not from a cache");
+        return -1;
+    }
+
+    if (cache_check (self->cache) < 0)
+        return -1;
+
+    if (self->generation != self->cache->generation) {
+        self->device = self->devname ? blkid_get_dev (self->cache->cache, self->devname, BLKID_DEV_FIND) : NULL;
+        self->generation = self->cache->generation;
+    }
+
+    if (!self->device) {
+        PyErr_Format (PyExc_ValueError, "Device '%s' is no longer in the cache", self->devname ? self->devname : "");
+        return -1;
+    }
+
+    return 0;
+}
+
 PyDoc_STRVAR(Device_verify__doc__,
 "verify\n\n"
 "Verify that the data in device is consistent with what is on the actual"
 "block device.  Normally this will be called when finding items in the cache, "
 "but for long running processes is also desirable to revalidate an item before use.");
 static PyObject *Device_verify (DeviceObject *self, PyObject *Py_UNUSED (ignored))  {
-    self->device = blkid_verify (self->cache, self->device);
+    if (device_check (self) < 0)
+        return NULL;
+
+    /* the device is freed if it no longer exists */
+    self->cache->generation++;
+    self->device = blkid_verify (self->cache->cache, self->device);
+    self->generation = self->cache->generation;
+
+    if (self->device)
+        cache_mark_verified (self->cache, self->devname, cache_monotonic_time ());
 
     Py_RETURN_NONE;
 }
@@ -257,22 +1836,55 @@ static PyMethodDef Device_methods[] = {
 };
 
 static PyObject *Device_get_devname (DeviceObject *self, PyObject *Py_UNUSED (ignored)) {
-    const char *name = blkid_dev_devname (self->device);
-
-    if (!name)
+    if (!self->devname)
         Py_RETURN_NONE;
 
-    return PyUnicode_FromString (name);
+    return PyUnicode_FromString (self->devname);
 }
 
-static PyObject *Device_get_tags (DeviceObject *self, PyObject *Py_UNUSED (ignored)) {
+/* compares the cached tags with the device without decoding or allocating anything */
+static bool device_tags_unchanged (DeviceObject *self) {
+    blkid_tag_iterate iter;
+    const char *type = NULL;
+    const char *value = NULL;
+    PyObject *item = NULL;
+    Py_ssize_t ntags = 0;
+    bool unchanged = true;
+
+    iter = blkid_tag_iterate_begin (self->device);
+    while (unchanged && blkid_tag_next (iter, &type, &value) == 0) {
+        item = PyDict_GetItemString (self->tags, type);
+        unchanged = item && PyUnicode_Check (item) && PyUnicode_CompareWithASCIIString (item, value) == 0;
+        ntags++;
+    }
+    blkid_tag_iterate_end (iter);
+
+    return unchanged && ntags == PyDict_Size (self->tags);
+}
+
+/* Returns the cached tags dictionary (borrowed reference), it is decoded again
+ * only if libblkid actually changed the device. */
+static PyObject *device_tags (DeviceObject *self) {
     blkid_tag_iterate iter;
-	const char *type = NULL;
+    const char *type = NULL;
     const char *value = NULL;
     PyObject *dict = NULL;
     PyObject *py_value = NULL;
 
+    if (device_check (self) < 0)
+        return NULL;
+
+    if (self->tags && self->tags_generation != self->generation) {
+        if (!device_tags_unchanged (self))
+            Py_CLEAR (self->tags);
+        self->tags_generation = self->generation;
+    }
+
+    if (self->tags)
+        return self->tags;
+
     dict = PyDict_New ();
+
     if (!dict) {
         PyErr_NoMemory ();
         return NULL;
@@ -282,6 +1894,7 @@ static PyObject *Device_get_tags (DeviceObject *self, PyObject *Py_UNUSED (ignor
     while (blkid_tag_next (iter, &type, &value) == 0) {
         py_value = PyUnicode_FromString (value);
         if (py_value == NULL) {
+            PyErr_Clear ();
             Py_INCREF (Py_None);
             py_value = Py_None;
         }
@@ -291,9 +1904,101 @@ static PyObject *Device_get_tags (DeviceObject *self, PyObject *Py_UNUSED (ignor
     }
     blkid_tag_iterate_end(iter);
 
-    return (PyObject *) dict;
+    self->tags = dict;
+    self->tags_generation = self->generation;
+
+    return self->tags;
+}
+
+static PyObject *Device_get_tags (DeviceObject *self, PyObject *Py_UNUSED (ignored)) {
+    PyObject *tags = device_tags (self);
+
+    if (!tags)
+        return NULL;
+
+    /* a copy, the cached dictionary must not be changed by the caller */
+    return PyDict_Copy (tags);
+}
+
+/* value of the tag without building the tags dictionary, NULL if not set */
+static const char *device_tag_value (DeviceObject *self, PyObject *key) {
+    blkid_tag_iterate iter;
+    const char *name = NULL;
+    const char *type = NULL;
+    const char *value = NULL;
+    const char *ret = NULL;
+
+    name = PyUnicode_AsUTF8 (key);
+    if (!name)
+        return NULL;
+
+    iter = blkid_tag_iterate_begin (self->device);
+    while (!ret && blkid_tag_next (iter, &type, &value) == 0) {
+        if (strcmp (type, name) == 0)
+            ret = value;
+    }
+    blkid_tag_iterate_end (iter);
+
+    return ret;
+}
+
+static PyObject *Device_subscript (DeviceObject *self, PyObject *key) {
+    PyObject *value = NULL;
+    const char *str = NULL;
+
+    if (!PyUnicode_Check (key)) {
+        PyErr_SetString (PyExc_TypeError, "Tag name must be a string");
+        return NULL;
+    }
+
+    if (device_check (self) < 0)
+        return NULL;
+
+    /* use the tags dictionary only if it is known to be up to date */
+    if (self->tags && self->tags_generation == self->generation) {
+        value = PyDict_GetItemWithError (self->tags, key);
+        if (value) {
+            Py_INCREF (value);
+            return value;
+        } else if (!PyErr_Occurred ())
+            PyErr_SetObject (PyExc_KeyError, key);
+        return NULL;
+    }
+
+    str = device_tag_value (self, key);
+    if (!str) {
+        if (!PyErr_Occurred ())
+            PyErr_SetObject (PyExc_KeyError, key);
+        return NULL;
+    }
+
+    return PyUnicode_FromString (str);
+}
+
+static int Device_contains (DeviceObject *self, PyObject *key) {
+    if (!PyUnicode_Check (key))
+        return 0;
+
+    if (device_check (self) < 0)
+        return -1;
+
+    if (self->tags && self->tags_generation == self->generation)
+        return PyDict_Contains (self->tags, key);
+
+    if (device_tag_value (self, key))
+        return 1;
+
+    return PyErr_Occurred () ? -1 : 0;
 }
 
+static PyMappingMethods DeviceMapping = {
+    .mp_subscript = (binaryfunc) Device_subscript,
+};
+
+static PySequenceMethods DeviceSequence = {
+    .sq_contains = (objobjproc) Device_contains,
+};
+
 static PyObject *Device_str (PyObject *self) {
     char *str = NULL;
     int ret = 0;
@@ -317,7 +2022,7 @@ static PyObject *Device_str (PyObject *self) {
 
 static PyGetSetDef Device_getseters[] = {
     {"devname", (getter) Device_get_devname, NULL, "returns the name previously used for Cache.get_device.", NULL},
-    {"tags", (getter) Device_get_tags, NULL, "returns all tags for this device.", NULL},
+    {"tags", (getter) Device_get_tags, NULL, "returns all tags for this device (use dev[tag] to get a single tag).", NULL},
     {NULL, NULL, NULL, NULL, NULL}
 };
 
@@ -332,5 +2037,349 @@ PyTypeObject DeviceType = {
     .tp_init = (initproc) Device_init,
     .tp_methods = Device_methods,
     .tp_getset = Device_getseters,
+    .tp_as_mapping = &DeviceMapping,
+    .tp_as_sequence = &DeviceSequence,
     .tp_str = Device_str,
 };
+
+/*********************** CACHE SNAPSHOT ***********************/
+PyObject *CacheSnapshot_new (PyTypeObject *type,  PyObject *args UNUSED, PyObject *kwargs UNUSED) {
+    CacheSnapshotObject *self = (CacheSnapshotObject*) type->tp_alloc (type, 0);
+
+    if (self) {
+        self->data = NULL;
+        self->size = 0;
+        self->ndevices = 0;
+        self->offsets = NULL;
+    }
+
+    return (PyObject *) self;
+}
+
+static void snapshot_unmap (CacheSnapshotObject *self) {
+    if (self->data)
+        munmap ((void *) self->data, self->size);
+
+    self->data = NULL;
+    self->size = 0;
+    self->ndevices = 0;
+    self->offsets = NULL;
+}
+
+static bool snapshot_valid (CacheSnapshotObject *self) {
+    CacheSnapshotHeader header;
+    uint64_t records = 0;
+
+    memcpy (&header, self->data, sizeof (header));
+    if (memcmp (header.magic, CACHE_SNAPSHOT_MAGIC, sizeof (header.magic)) != 0 ||
+        header.version != CACHE_SNAPSHOT_VERSION || header.size != self->size)
+        return false;
+
+    records = sizeof (header) + (uint64_t) header.ndevices * sizeof (uint64_t);
+    if (records > self->size)
+        return false;
+
+    self->ndevices = header.ndevices;
+    self->offsets = (const uint64_t *) (self->data + sizeof (header));
+
+    /* records themselves are checked when they are read */
+    for (uint32_t i = 0; i < self->ndevices; i++) {
+        /* 'records' is bigger than the subtrahend, adding to the offset could overflow */
+        if (self->offsets[i] < records || self->offsets[i] > self->size - sizeof (uint32_t))
+            return false;
+    }
+
+    return true;
+}
+
+int CacheSnapshot_init (CacheSnapshotObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *py_filename = NULL;
+    char *kwlist[] = { "filename", NULL };
+    struct stat st;
+    void *data = NULL;
+    int fd = -1;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O&", kwlist, PyUnicode_FSConverter, &py_filename))
+        return -1;
+
+    snapshot_unmap (self);
+
+    fd = open (PyBytes_AS_STRING (py_filename), O_RDONLY|O_CLOEXEC);
+    if (fd < 0 || fstat (fd, &st) < 0) {
+        PyErr_SetFromErrnoWithFilenameObject (PyExc_OSError, py_filename);
+        if (fd >= 0)
+            close (fd);
+        Py_DECREF (py_filename);
+        return -1;
+    }
+
+    if (st.st_size < (off_t) sizeof (CacheSnapshotHeader)) {
+        close (fd);
+        PyErr_Format (PyExc_ValueError, "'%s' is not a cache snapshot", PyBytes_AS_STRING (py_filename));
+        Py_DECREF (py_filename);
+        return -1;
+    }
+
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (data == MAP_FAILED) {
+        PyErr_SetFromErrnoWithFilenameObject (PyExc_OSError, py_filename);
+        Py_DECREF (py_filename);
+        return -1;
+    }
+
+    self->data = data;
+    self->size = st.st_size;
+
+    if (!snapshot_valid (self)) {
+        snapshot_unmap (self);
+        PyErr_Format (PyExc_ValueError, "'%s' is not a cache snapshot", PyBytes_AS_STRING (py_filename));
+        Py_DECREF (py_filename);
+        return -1;
+    }
+
+    Py_DECREF (py_filename);
+
+    return 0;
+}
+
+void CacheSnapshot_dealloc (CacheSnapshotObject *self) {
+    snapshot_unmap (self);
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static int snapshot_check (CacheSnapshotObject *self) {
+    if (!self->data) {
+        PyErr_SetString (PyExc_ValueError, "Snapshot is closed");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* returns the string following 'str' or NULL if 'str' is not terminated inside the snapshot */
+static const char *snapshot_next (CacheSnapshotObject *self, const char *str) {
+    const char *end = NULL;
+
+    if (!str)
+        return NULL;
+
+    end = memchr (str, '\0', self->data + self->size - str);
+
+    return end ? end + 1 : NULL;
+}
+
+/* Reads the record of device 'index', 'tags' is set to the first tag name. Returns
+ * the device name or NULL with an exception set if the record is corrupted. */
+static const char *snapshot_device (CacheSnapshotObject *self, uint32_t index, uint32_t *ntags, const char **tags) {
+    const char *devname = self->data + self->offsets[index] + sizeof (uint32_t);
+
+    memcpy (ntags, self->data + self->offsets[index], sizeof (uint32_t));
+
+    *tags = snapshot_next (self, devname);
+    if (!*tags) {
+        PyErr_SetString (PyExc_RuntimeError, "Corrupted cache snapshot");
+        return NULL;
+    }
+
+    return devname;
+}
+
+static PyObject *snapshot_device_tags (CacheSnapshotObject *self, uint32_t ntags, const char *tags) {
+    PyObject *dict = NULL;
+    PyObject *py_value = NULL;
+    const char *type = tags;
+    const char *value = NULL;
+
+    dict = PyDict_New ();
+    if (!dict)
+        return NULL;
+
+    for (uint32_t i = 0; i < ntags; i++) {
+        value = snapshot_next (self, type);
+        if (!value || !snapshot_next (self, value)) {
+            PyErr_SetString (PyExc_RuntimeError, "Corrupted cache snapshot");
+            Py_DECREF (dict);
+            return NULL;
+        }
+
+        py_value = PyUnicode_FromString (value);
+        if (py_value == NULL) {
+            PyErr_Clear ();
+            Py_INCREF (Py_None);
+            py_value = Py_None;
+        }
+
+        if (PyDict_SetItemString (dict, type, py_value) < 0) {
+            Py_DECREF (py_value);
+            Py_DECREF (dict);
+            return NULL;
+        }
+        Py_DECREF (py_value);
+
+        type = snapshot_next (self, value);
+    }
+
+    return dict;
+}
+
+PyDoc_STRVAR(CacheSnapshot_get_device__doc__,
+"get_device (name)\n\n"
+"Returns the tags of the device 'name' as a dictionary or None if the device is not in the snapshot.");
+static PyObject *CacheSnapshot_get_device (CacheSnapshotObject *self, PyObject *args, PyObject *kwargs) {
+    const char *name = NULL;
+    char *kwlist[] = { "name", NULL };
+    const char *devname = NULL;
+    const char *tags = NULL;
+    uint32_t ntags = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "s", kwlist, &name))
+        return NULL;
+
+    if (snapshot_check (self) < 0)
+        return NULL;
+
+    for (uint32_t i = 0; i < self->ndevices; i++) {
+        devname = snapshot_device (self, i, &ntags, &tags);
+        if (!devname)
+            return NULL;
+
+        if (strcmp (devname, name) == 0)
+            return snapshot_device_tags (self, ntags, tags);
+    }
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(CacheSnapshot_find_device__doc__,
+"find_device (tag, value)\n\n"
+"Returns name of the first device which matches a particular tag/value pair or None.");
+static PyObject *CacheSnapshot_find_device (CacheSnapshotObject *self, PyObject *args, PyObject *kwargs) {
+    const char *tag = NULL;
+    const char *value = NULL;
+    char *kwlist[] = { "tag", "value", NULL };
+    const char *devname = NULL;
+    const char *type = NULL;
+    const char *tag_value = NULL;
+    uint32_t ntags = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "ss", kwlist, &tag, &value))
+        return NULL;
+
+    if (snapshot_check (self) < 0)
+        return NULL;
+
+    for (uint32_t i = 0; i < self->ndevices; i++) {
+        devname = snapshot_device (self, i, &ntags, &type);
+        if (!devname)
+            return NULL;
+
+        for (uint32_t j = 0; j < ntags; j++) {
+            tag_value = snapshot_next (self, type);
+            if (!tag_value || !snapshot_next (self, tag_value)) {
+                PyErr_SetString (PyExc_RuntimeError, "Corrupted cache snapshot");
+                return NULL;
+            }
+
+            if (strcmp (type, tag) == 0 && strcmp (tag_value, value) == 0)
+                return PyUnicode_FromString (devname);
+
+            type = snapshot_next (self, tag_value);
+        }
+    }
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(CacheSnapshot_close__doc__,
+"close ()\n\n"
+"Unmaps the snapshot file. Calling close() more than once is allowed.");
+static PyObject *CacheSnapshot_close (CacheSnapshotObject *self, PyObject *Py_UNUSED (ignored)) {
+    snapshot_unmap (self);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *CacheSnapshot_enter (CacheSnapshotObject *self, PyObject *Py_UNUSED (ignored)) {
+    if (snapshot_check (self) < 0)
+        return NULL;
+
+    Py_INCREF (self);
+    return (PyObject *) self;
+}
+
+static PyObject *CacheSnapshot_exit (CacheSnapshotObject *self, PyObject *args UNUSED) {
+    return CacheSnapshot_close (self, NULL);
+}
+
+static PyMethodDef CacheSnapshot_methods[] = {
+    {"get_device", (PyCFunction)(void(*)(void)) CacheSnapshot_get_device, METH_VARARGS|METH_KEYWORDS, CacheSnapshot_get_device__doc__},
+    {"find_device", (PyCFunction)(void(*)(void)) CacheSnapshot_find_device, METH_VARARGS|METH_KEYWORDS, CacheSnapshot_find_device__doc__},
+    {"close", (PyCFunction) CacheSnapshot_close, METH_NOARGS, CacheSnapshot_close__doc__},
+    {"__enter__", (PyCFunction) CacheSnapshot_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction) CacheSnapshot_exit, METH_VARARGS, NULL},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyObject *CacheSnapshot_get_devices (CacheSnapshotObject *self, PyObject *Py_UNUSED (ignored)) {
+    PyObject *list = NULL;
+    PyObject *py_name = NULL;
+    const char *devname = NULL;
+    const char *tags = NULL;
+    uint32_t ntags = 0;
+
+    if (snapshot_check (self) < 0)
+        return NULL;
+
+    list = PyList_New (self->ndevices);
+    if (!list)
+        return NULL;
+
+    for (uint32_t i = 0; i < self->ndevices; i++) {
+        devname = snapshot_device (self, i, &ntags, &tags);
+        py_name = devname ? PyUnicode_FromString (devname) : NULL;
+        if (!py_name) {
+            Py_DECREF (list);
+            return NULL;
+        }
+        PyList_SET_ITEM (list, i, py_name);
+    }
+
+    return list;
+}
+
+static PyObject *CacheSnapshot_get_closed (CacheSnapshotObject *self, PyObject *Py_UNUSED (ignored)) {
+    return PyBool_FromLong (self->data == NULL);
+}
+
+static PyGetSetDef CacheSnapshot_getseters[] = {
+    {"devices", (getter) CacheSnapshot_get_devices, NULL, "returns names of all devices in the snapshot", NULL},
+    {"closed", (getter) CacheSnapshot_get_closed, NULL, "whether the snapshot was closed", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static Py_ssize_t CacheSnapshot_len (CacheSnapshotObject *self) {
+    return (Py_ssize_t) self->ndevices;
+}
+
+static PySequenceMethods CacheSnapshotSequence = {
+    .sq_length = (lenfunc) CacheSnapshot_len,
+};
+
+PyTypeObject CacheSnapshotType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid.CacheSnapshot",
+    .tp_basicsize = sizeof (CacheSnapshotObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "CacheSnapshot (filename)\n\n"
+              "Read-only view of a device cache written by Cache.save_snapshot(). The file is "
+              "mapped into memory and device records are only parsed when they are accessed, "
+              "nothing is copied when opening a snapshot.",
+    .tp_new = CacheSnapshot_new,
+    .tp_dealloc = (destructor) CacheSnapshot_dealloc,
+    .tp_init = (initproc) CacheSnapshot_init,
+    .tp_methods = CacheSnapshot_methods,
+    .tp_getset = CacheSnapshot_getseters,
+    .tp_as_sequence = &CacheSnapshotSequence,
+};
@@ -21,24 +21,57 @@
 #include <Python.h>
 
 #include <blkid/blkid.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hashtable.h"
 
 typedef struct {
     PyObject_HEAD
-    blkid_cache cache;
+    blkid_cache cache;      /* NULL after close() */
+    char *filename;
+    unsigned long generation;   /* changed every time libblkid could have freed devices */
+    HashTable *index;       /* tag name -> (tag value -> blkid_dev), valid for 'index_generation' */
+    unsigned long index_generation;
+    int uevent_fd;          /* kernel uevent netlink socket, -1 unless watch() was called */
+    HashTable *verified;    /* devname -> time of the last verification (double, CLOCK_MONOTONIC) */
+    bool busy;              /* probe_all() is updating the cache without the GIL */
 } CacheObject;
 
 extern PyTypeObject CacheType;
+extern PyTypeObject CacheDeviceIteratorType;
 
 PyObject *Cache_new (PyTypeObject *type,  PyObject *args, PyObject *kwargs);
 int Cache_init (CacheObject *self, PyObject *args, PyObject *kwargs);
 void Cache_dealloc (CacheObject *self);
 
+/* libblkid frees devices on verification and garbage collection, so the device is
+ * looked up again by its name when the generation of the cache changes */
 typedef struct {
     PyObject_HEAD
     blkid_dev device;
-    blkid_cache cache;
+    CacheObject *cache;
+    unsigned long generation;
+    char *devname;
+    PyObject *tags;         /* decoded tags, checked against the device for a new generation */
+    unsigned long tags_generation;
 } DeviceObject;
 
 extern PyTypeObject DeviceType;
 
+/* read-only view of a file written by Cache.save_snapshot() */
+typedef struct {
+    PyObject_HEAD
+    const char *data;
+    size_t size;
+    uint32_t ndevices;
+    const uint64_t *offsets;
+} CacheSnapshotObject;
+
+extern PyTypeObject CacheSnapshotType;
+
+PyObject *CacheSnapshot_new (PyTypeObject *type,  PyObject *args, PyObject *kwargs);
+int CacheSnapshot_init (CacheSnapshotObject *self, PyObject *args, PyObject *kwargs);
+void CacheSnapshot_dealloc (CacheSnapshotObject *self);
+
 #endif /* CACHE_H */
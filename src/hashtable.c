@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2020  Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "hashtable.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_TABLE_MIN_BUCKETS 16
+
+/* FNV-1a */
+static uint32_t hash_string (const char *str) {
+    uint32_t hash = 2166136261u;
+
+    for (const unsigned char *p = (const unsigned char *) str; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static size_t hash_table_size (size_t nentries) {
+    size_t nbuckets = HASH_TABLE_MIN_BUCKETS;
+
+    while (nbuckets < nentries)
+        nbuckets *= 2;
+
+    return nbuckets;
+}
+
+HashTable *hash_table_new (size_t size_hint) {
+    HashTable *table = NULL;
+
+    table = malloc (sizeof (HashTable));
+    if (!table)
+        return NULL;
+
+    table->nbuckets = hash_table_size (size_hint);
+    table->nentries = 0;
+    table->buckets = calloc (table->nbuckets, sizeof (HashEntry *));
+    if (!table->buckets) {
+        free (table);
+        return NULL;
+    }
+
+    return table;
+}
+
+/* 'free_value' is called for every value if not NULL */
+void hash_table_free (HashTable *table, void (*free_value) (void *value)) {
+    HashEntry *entry = NULL;
+
+    if (!table)
+        return;
+
+    for (size_t i = 0; i < table->nbuckets; i++) {
+        while (table->buckets[i]) {
+            entry = table->buckets[i];
+            table->buckets[i] = entry->next;
+            if (free_value)
+                free_value (entry->value);
+            free (entry);
+        }
+    }
+
+    free (table->buckets);
+    free (table);
+}
+
+/* keeps the load factor at most 1, a failed resize only makes the chains longer */
+static void hash_table_grow (HashTable *table) {
+    HashEntry **buckets = NULL;
+    HashEntry *entry = NULL;
+    size_t nbuckets = table->nbuckets * 2;
+
+    buckets = calloc (nbuckets, sizeof (HashEntry *));
+    if (!buckets)
+        return;
+
+    for (size_t i = 0; i < table->nbuckets; i++) {
+        while (table->buckets[i]) {
+            entry = table->buckets[i];
+            table->buckets[i] = entry->next;
+            entry->next = buckets[entry->hash & (nbuckets - 1)];
+            buckets[entry->hash & (nbuckets - 1)] = entry;
+        }
+    }
+
+    free (table->buckets);
+    table->buckets = buckets;
+    table->nbuckets = nbuckets;
+}
+
+static HashEntry *hash_table_find (const HashTable *table, const char *key, uint32_t hash) {
+    for (HashEntry *entry = table->buckets[hash & (table->nbuckets - 1)]; entry; entry = entry->next) {
+        if (entry->hash == hash && strcmp (entry->key, key) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/* Returns 0 if the key was added, 1 if it already exists (the value is not
+ * replaced) and -1 if there is not enough memory. */
+int hash_table_insert (HashTable *table, const char *key, void *value) {
+    HashEntry *entry = NULL;
+    uint32_t hash = hash_string (key);
+    size_t len = strlen (key);
+
+    if (hash_table_find (table, key, hash))
+        return 1;
+
+    entry = malloc (sizeof (HashEntry) + len + 1);
+    if (!entry)
+        return -1;
+
+    entry->hash = hash;
+    entry->value = value;
+    memcpy (entry->key, key, len + 1);
+
+    if (table->nentries >= table->nbuckets)
+        hash_table_grow (table);
+
+    entry->next = table->buckets[hash & (table->nbuckets - 1)];
+    table->buckets[hash & (table->nbuckets - 1)] = entry;
+    table->nentries++;
+
+    return 0;
+}
+
+void *hash_table_lookup (const HashTable *table, const char *key) {
+    HashEntry *entry = hash_table_find (table, key, hash_string (key));
+
+    return entry ? entry->value : NULL;
+}
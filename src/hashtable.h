@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2020  Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Chained hash table with string keys, keys are copied and values are not owned by
+ * the table. Doesn't use any Python API, so it can be used without the GIL. */
+typedef struct HashEntry HashEntry;
+
+struct HashEntry {
+    HashEntry *next;
+    uint32_t hash;
+    void *value;
+    char key[];
+};
+
+typedef struct {
+    HashEntry **buckets;
+    size_t nbuckets;
+    size_t nentries;
+} HashTable;
+
+HashTable *hash_table_new (size_t size_hint);
+void hash_table_free (HashTable *table, void (*free_value) (void *value));
+int hash_table_insert (HashTable *table, const char *key, void *value);
+void *hash_table_lookup (const HashTable *table, const char *key);
+
+#endif /* HASHTABLE_H */
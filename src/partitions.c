@@ -19,16 +19,48 @@
 #include "partitions.h"
 
 #include <blkid/blkid.h>
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 
 #define UNUSED __attribute__((unused))
 
+#define PARTITIONS_STALE_ERROR "The probe results changed, partition data is no longer available " \
+                               "(use Partlist.snapshot() to keep it)"
+
+/* fails with ValueError if libblkid could have freed the memory the object points to */
+static int partitions_check (const unsigned long *owner_generation, unsigned long generation) {
+    if (owner_generation && *owner_generation != generation) {
+        PyErr_SetString (PyExc_ValueError, PARTITIONS_STALE_ERROR);
+        return -1;
+    }
+
+    return 0;
+}
+
+#define partlist_check(self) partitions_check ((self)->owner_generation, (self)->generation)
+#define parttable_check(self) partitions_check ((self)->owner_generation, (self)->generation)
+#define partition_check(self) partitions_check ((self)->owner_generation, (self)->generation)
+
 
 /*********************** PARTLIST ***********************/
 PyObject *Partlist_new (PyTypeObject *type,  PyObject *args UNUSED, PyObject *kwargs UNUSED) {
     PartlistObject *self = (PartlistObject*) type->tp_alloc (type, 0);
 
-    if (self)
+    if (self) {
         self->Parttable_object = NULL;
+        self->owner = NULL;
+        self->owner_slot = NULL;
+        self->owner_generation = NULL;
+        self->generation = 0;
+        self->partitions = NULL;
+        self->npartitions = 0;
+        self->uuid_index = NULL;
+        self->name_index = NULL;
+        self->devno_index = NULL;
+    }
 
     return (PyObject *) self;
 }
@@ -38,24 +70,102 @@ int Partlist_init (PartlistObject *self UNUSED, PyObject *args UNUSED, PyObject
 }
 
 void Partlist_dealloc (PartlistObject *self) {
-    if (self->Parttable_object)
-        Py_DECREF (self->Parttable_object);
+    if (self->owner_slot && *(self->owner_slot) == (PyObject *) self)
+        *(self->owner_slot) = NULL;
+
+    for (int i = 0; i < self->npartitions; i++)
+        Py_XDECREF (self->partitions[i]);
+    free (self->partitions);
+
+    hash_table_free (self->uuid_index, NULL);
+    hash_table_free (self->name_index, NULL);
+    hash_table_free (self->devno_index, NULL);
+
+    Py_XDECREF (self->Parttable_object);
+    Py_XDECREF (self->owner);
 
     Py_TYPE (self)->tp_free ((PyObject *) self);
 }
 
-PyObject *_Partlist_get_partlist_object (blkid_probe probe) {
-    PartlistObject *result = NULL;
-    blkid_partlist partlist = NULL;
+static PyObject *partition_object_new (blkid_partition blkid_part, int number, PyObject *owner,
+                                       const unsigned long *owner_generation, unsigned long generation) {
+    PartitionObject *result = NULL;
 
-    if (!probe) {
-        PyErr_SetString (PyExc_RuntimeError, "internal error");
+    result = PyObject_New (PartitionObject, &PartitionType);
+    if (!result) {
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new Partition object");
         return NULL;
     }
 
-    partlist = blkid_probe_get_partitions (probe);
+    result->number = number;
+    result->partition = blkid_part;
+    result->Parttable_object = NULL;
+    Py_XINCREF (owner);
+    result->owner = owner;
+    result->owner_generation = owner_generation;
+    result->generation = generation;
+
+    return (PyObject *) result;
+}
+
+/* Returns the (cached) Partition object for the partition with the given index
+ * in the list, 'blkid_part' can be NULL if not known yet. */
+static PyObject *partlist_partition (PartlistObject *self, int index, blkid_partition blkid_part) {
+    PyObject *result = NULL;
+    int numof = 0;
+
+    if (!blkid_part) {
+        blkid_part = blkid_partlist_get_partition (self->partlist, index);
+        if (!blkid_part) {
+            PyErr_Format (PyExc_RuntimeError, "Failed to get partition %d", index);
+            return NULL;
+        }
+    }
+
+    if (!self->partitions) {
+        numof = blkid_partlist_numof_partitions (self->partlist);
+        if (numof > 0) {
+            self->partitions = calloc (numof, sizeof (PyObject *));
+            if (!self->partitions)
+                return PyErr_NoMemory ();
+            self->npartitions = numof;
+        }
+    }
+
+    if (index >= 0 && index < self->npartitions && self->partitions[index]) {
+        Py_INCREF (self->partitions[index]);
+        return self->partitions[index];
+    }
+
+    result = partition_object_new (blkid_part, index, self->owner, self->owner_generation, self->generation);
+    if (result && index >= 0 && index < self->npartitions) {
+        Py_INCREF (result);
+        self->partitions[index] = result;
+    }
+
+    return result;
+}
+
+/* index of a partition from the list, -1 if not found */
+static int partlist_partition_index (PartlistObject *self, blkid_partition blkid_part) {
+    int numof = blkid_partlist_numof_partitions (self->partlist);
+
+    for (int i = 0; i < numof; i++) {
+        if (blkid_partlist_get_partition (self->partlist, i) == blkid_part)
+            return i;
+    }
+
+    return -1;
+}
+
+/* Returns a new reference, the Probe ('owner') is kept alive by the Partlist
+ * and '*owner_slot' is cleared when the Partlist is freed. */
+PyObject *_Partlist_get_partlist_object (blkid_partlist partlist, PyObject *owner, PyObject **owner_slot,
+                                         const unsigned long *owner_generation) {
+    PartlistObject *result = NULL;
+
     if (!partlist) {
-        PyErr_SetString (PyExc_RuntimeError, "Failed to get partitions");
+        PyErr_SetString (PyExc_RuntimeError, "internal error");
         return NULL;
     }
 
@@ -64,30 +174,40 @@ PyObject *_Partlist_get_partlist_object (blkid_probe probe) {
         PyErr_SetString (PyExc_MemoryError, "Failed to create a new Partlist object");
         return NULL;
     }
-    Py_INCREF (result);
 
     result->partlist = partlist;
     result->Parttable_object = NULL;
+    Py_XINCREF (owner);
+    result->owner = owner;
+    result->owner_slot = owner_slot;
+    result->owner_generation = owner_generation;
+    result->generation = *owner_generation;
+    result->partitions = NULL;
+    result->npartitions = 0;
+    result->uuid_index = NULL;
+    result->name_index = NULL;
+    result->devno_index = NULL;
 
     return (PyObject *) result;
 }
 
 PyDoc_STRVAR(Partlist_get_partition__doc__,
 "get_partition (number)\n\n"
-"Get partition by number.\n\n"
+"Get partition by number, the same Partition object is returned for the same number.\n\n"
 "It's possible that the list of partitions is *empty*, but there is a valid partition table on the disk.\n"
 "This happen when on-disk details about partitions are unknown or the partition table is empty.");
 static PyObject *Partlist_get_partition (PartlistObject *self, PyObject *args, PyObject *kwargs) {
     char *kwlist[] = { "number", NULL };
     int partnum = 0;
     int numof = 0;
-    blkid_partition blkid_part = NULL;
-    PartitionObject *result = NULL;
 
     if (!PyArg_ParseTupleAndKeywords (args, kwargs, "i", kwlist, &partnum)) {
         return NULL;
     }
 
+    if (partlist_check (self) < 0)
+        return NULL;
+
     numof = blkid_partlist_numof_partitions (self->partlist);
     if (numof < 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to get number of partitions");
@@ -99,23 +219,7 @@ static PyObject *Partlist_get_partition (PartlistObject *self, PyObject *args, P
         return NULL;
     }
 
-    blkid_part = blkid_partlist_get_partition (self->partlist, partnum);
-    if (!blkid_part) {
-        PyErr_Format (PyExc_RuntimeError, "Failed to get partition %d", partnum);
-        return NULL;
-    }
-
-    result = PyObject_New (PartitionObject, &PartitionType);
-    if (!result) {
-        PyErr_SetString (PyExc_MemoryError, "Failed to create a new Partition object");
-        return NULL;
-    }
-
-    result->number = partnum;
-    result->partition = blkid_part;
-    result->Parttable_object = NULL;
-
-    return (PyObject *) result;
+    return partlist_partition (self, partnum, NULL);
 }
 
 #ifdef HAVE_BLKID_2_25
@@ -128,29 +232,21 @@ static PyObject *Partlist_get_partition_by_partno (PartlistObject *self, PyObjec
     char *kwlist[] = { "number", NULL };
     int partno = 0;
     blkid_partition blkid_part = NULL;
-    PartitionObject *result = NULL;
 
     if (!PyArg_ParseTupleAndKeywords (args, kwargs, "i", kwlist, &partno)) {
         return NULL;
     }
 
+    if (partlist_check (self) < 0)
+        return NULL;
+
     blkid_part = blkid_partlist_get_partition_by_partno (self->partlist, partno);
     if (!blkid_part) {
         PyErr_Format (PyExc_RuntimeError, "Failed to get partition %d", partno);
         return NULL;
     }
 
-    result = PyObject_New (PartitionObject, &PartitionType);
-    if (!result) {
-        PyErr_NoMemory ();
-        return NULL;
-    }
-
-    result->number = partno;
-    result->partition = blkid_part;
-    result->Parttable_object = NULL;
-
-    return (PyObject *) result;
+    return partlist_partition (self, partlist_partition_index (self, blkid_part), blkid_part);
 }
 #endif
 
@@ -178,28 +274,308 @@ static PyObject *Partlist_devno_to_partition (PartlistObject *self, PyObject *ar
     dev_t devno = 0;
     char *kwlist[] = { "devno", NULL };
     blkid_partition blkid_part = NULL;
-    PartitionObject *result = NULL;
 
     if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O&:devno_to_devname", kwlist, _Py_Dev_Converter, &devno))
         return NULL;
 
+    if (partlist_check (self) < 0)
+        return NULL;
+
     blkid_part = blkid_partlist_devno_to_partition (self->partlist, devno);
     if (!blkid_part) {
         PyErr_Format (PyExc_RuntimeError, "Failed to get partition %zu", devno);
         return NULL;
     }
 
-    result = PyObject_New (PartitionObject, &PartitionType);
-    if (!result) {
+    return partlist_partition (self, partlist_partition_index (self, blkid_part), blkid_part);
+}
+
+/* one column of Partlist.to_columns(), owns the data */
+typedef struct {
+    PyObject_HEAD
+    int64_t *data;
+    Py_ssize_t len;
+    char *format;
+} PartlistColumnObject;
+
+static void PartlistColumn_dealloc (PartlistColumnObject *self) {
+    free (self->data);
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static int PartlistColumn_getbuffer (PartlistColumnObject *self, Py_buffer *view, int flags) {
+    if (PyBuffer_FillInfo (view, (PyObject *) self, self->data, self->len * sizeof (int64_t), 1, flags) < 0)
+        return -1;
+
+    /* strides (if requested) point to the itemsize */
+    view->itemsize = sizeof (int64_t);
+    if (flags & PyBUF_FORMAT)
+        view->format = self->format;
+    if (flags & PyBUF_ND)
+        view->shape = &(self->len);
+
+    return 0;
+}
+
+static PyBufferProcs PartlistColumn_as_buffer = {
+    .bf_getbuffer = (getbufferproc) PartlistColumn_getbuffer,
+};
+
+PyTypeObject PartlistColumnType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid._PartlistColumn",
+    .tp_basicsize = sizeof (PartlistColumnObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) PartlistColumn_dealloc,
+    .tp_as_buffer = &PartlistColumn_as_buffer,
+};
+
+static PartlistColumnObject *partlist_column_new (Py_ssize_t len, char *format) {
+    PartlistColumnObject *column = NULL;
+
+    column = PyObject_New (PartlistColumnObject, &PartlistColumnType);
+    if (!column) {
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new column object");
+        return NULL;
+    }
+
+    column->len = len;
+    column->format = format;
+    column->data = calloc (len ? len : 1, sizeof (int64_t));
+    if (!column->data) {
+        Py_DECREF (column);
         PyErr_NoMemory ();
         return NULL;
     }
 
-    result->number = blkid_partition_get_partno (blkid_part);
-    result->partition = blkid_part;
-    result->Parttable_object = NULL;
+    return column;
+}
 
-    return (PyObject *) result;
+static const char *const partlist_columns[] = { "start", "size", "partno", "type", "flags" };
+#define PARTLIST_NCOLUMNS (sizeof (partlist_columns) / sizeof (partlist_columns[0]))
+
+PyDoc_STRVAR(Partlist_to_columns__doc__,
+"to_columns ()\n\n"
+"Returns a dictionary with the 'start', 'size', 'partno', 'type' and 'flags' of all "
+"partitions, each as a read-only memoryview of native 64-bit integers ('flags' unsigned) "
+"filled in one pass without creating any Partition objects. The views can be used by "
+"NumPy (numpy.frombuffer) and other consumers of the buffer protocol without copying.");
+static PyObject *Partlist_to_columns (PartlistObject *self, PyObject *Py_UNUSED (ignored)) {
+    PartlistColumnObject *columns[PARTLIST_NCOLUMNS] = { NULL };
+    blkid_partition part = NULL;
+    PyObject *result = NULL;
+    PyObject *view = NULL;
+    int numof = 0;
+
+    if (partlist_check (self) < 0)
+        return NULL;
+
+    numof = blkid_partlist_numof_partitions (self->partlist);
+    if (numof < 0) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to get number of partitions");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < PARTLIST_NCOLUMNS; i++) {
+        columns[i] = partlist_column_new (numof, strcmp (partlist_columns[i], "flags") == 0 ? "Q" : "q");
+        if (!columns[i])
+            goto out;
+    }
+
+    for (int i = 0; i < numof; i++) {
+        part = blkid_partlist_get_partition (self->partlist, i);
+        if (!part) {
+            PyErr_Format (PyExc_RuntimeError, "Failed to get partition %d", i);
+            goto out;
+        }
+
+        columns[0]->data[i] = blkid_partition_get_start (part);
+        columns[1]->data[i] = blkid_partition_get_size (part);
+        columns[2]->data[i] = blkid_partition_get_partno (part);
+        columns[3]->data[i] = blkid_partition_get_type (part);
+        columns[4]->data[i] = (int64_t) blkid_partition_get_flags (part);
+    }
+
+    result = PyDict_New ();
+    if (!result)
+        goto out;
+
+    for (size_t i = 0; i < PARTLIST_NCOLUMNS; i++) {
+        view = PyMemoryView_FromObject ((PyObject *) columns[i]);
+        if (!view || PyDict_SetItemString (result, partlist_columns[i], view) < 0) {
+            Py_XDECREF (view);
+            Py_CLEAR (result);
+            goto out;
+        }
+        Py_DECREF (view);
+    }
+
+out:
+    for (size_t i = 0; i < PARTLIST_NCOLUMNS; i++)
+        Py_XDECREF (columns[i]);
+
+    return result;
+}
+
+/* UUIDs are compared case-insensitively */
+static const char *partlist_uuid_key (const char *uuid, char *buf, size_t size) {
+    size_t i = 0;
+
+    for (i = 0; uuid[i] && i < size - 1; i++)
+        buf[i] = tolower ((unsigned char) uuid[i]);
+    buf[i] = '\0';
+
+    return buf;
+}
+
+/* Builds the index of partition UUIDs (or names) in one pass over the list, the
+ * first partition wins for duplicates. Values are indices + 1, NULL is "not found". */
+static HashTable *partlist_index_new (PartlistObject *self, bool uuid) {
+    HashTable *index = NULL;
+    blkid_partition part = NULL;
+    const char *key = NULL;
+    char buf[64];
+    int numof = 0;
+
+    numof = blkid_partlist_numof_partitions (self->partlist);
+    if (numof < 0) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to get number of partitions");
+        return NULL;
+    }
+
+    index = hash_table_new (numof);
+    if (!index) {
+        PyErr_NoMemory ();
+        return NULL;
+    }
+
+    for (int i = 0; i < numof; i++) {
+        part = blkid_partlist_get_partition (self->partlist, i);
+        if (!part)
+            continue;
+
+        key = uuid ? blkid_partition_get_uuid (part) : blkid_partition_get_name (part);
+        if (!key || !*key)
+            continue;
+        if (uuid)
+            key = partlist_uuid_key (key, buf, sizeof (buf));
+
+        if (hash_table_insert (index, key, (void *) (intptr_t) (i + 1)) < 0) {
+            hash_table_free (index, NULL);
+            PyErr_NoMemory ();
+            return NULL;
+        }
+    }
+
+    return index;
+}
+
+static PyObject *partlist_find (PartlistObject *self, HashTable **index, bool uuid, const char *key) {
+    intptr_t found = 0;
+    char buf[64];
+
+    if (partlist_check (self) < 0)
+        return NULL;
+
+    if (!*index) {
+        *index = partlist_index_new (self, uuid);
+        if (!*index)
+            return NULL;
+    }
+
+    found = (intptr_t) hash_table_lookup (*index, uuid ? partlist_uuid_key (key, buf, sizeof (buf)) : key);
+    if (!found)
+        Py_RETURN_NONE;
+
+    return partlist_partition (self, found - 1, NULL);
+}
+
+PyDoc_STRVAR(Partlist_find_by_uuid__doc__,
+"find_by_uuid (uuid)\n\n"
+"Returns the partition with the given UUID (compared case-insensitively) or None. "
+"An index of all partition UUIDs is built on the first call, so following lookups "
+"don't scan the list.");
+static PyObject *Partlist_find_by_uuid (PartlistObject *self, PyObject *args, PyObject *kwargs) {
+    char *kwlist[] = { "uuid", NULL };
+    char *uuid = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "s", kwlist, &uuid))
+        return NULL;
+
+    return partlist_find (self, &(self->uuid_index), true, uuid);
+}
+
+PyDoc_STRVAR(Partlist_find_by_name__doc__,
+"find_by_name (name)\n\n"
+"Returns the partition with the given name (e.g. GPT partition label) or None. "
+"An index of all partition names is built on the first call, so following lookups "
+"don't scan the list.");
+static PyObject *Partlist_find_by_name (PartlistObject *self, PyObject *args, PyObject *kwargs) {
+    char *kwlist[] = { "name", NULL };
+    char *name = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "s", kwlist, &name))
+        return NULL;
+
+    return partlist_find (self, &(self->name_index), false, name);
+}
+
+PyDoc_STRVAR(Partlist_find_by_devno__doc__,
+"find_by_devno (devno)\n\n"
+"Returns the partition for the given device number or None. Unlike devno_to_partition "
+"the result is remembered, so repeated lookups of the same devno don't read sysfs "
+"and scan the list again.");
+static PyObject *Partlist_find_by_devno (PartlistObject *self, PyObject *args, PyObject *kwargs) {
+    dev_t devno = 0;
+    char *kwlist[] = { "devno", NULL };
+    blkid_partition blkid_part = NULL;
+    intptr_t found = 0;
+    char key[32];
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O&:find_by_devno", kwlist, _Py_Dev_Converter, &devno))
+        return NULL;
+
+    if (partlist_check (self) < 0)
+        return NULL;
+
+    if (!self->devno_index) {
+        self->devno_index = hash_table_new (0);
+        if (!self->devno_index)
+            return PyErr_NoMemory ();
+    }
+
+    /* the kernel knows which partition the devno is, libblkid matches it by its
+     * start and size from sysfs, that's done only once for every devno */
+    snprintf (key, sizeof (key), "%llu", (unsigned long long) devno);
+    found = (intptr_t) hash_table_lookup (self->devno_index, key);
+    if (!found) {
+        blkid_part = blkid_partlist_devno_to_partition (self->partlist, devno);
+        if (!blkid_part)
+            Py_RETURN_NONE;
+
+        found = partlist_partition_index (self, blkid_part) + 1;
+        if (found > 0 && hash_table_insert (self->devno_index, key, (void *) found) < 0)
+            return PyErr_NoMemory ();
+        if (found == 0)
+            return partlist_partition (self, -1, blkid_part);
+    }
+
+    return partlist_partition (self, found - 1, NULL);
+}
+
+PyDoc_STRVAR(Partlist_snapshot__doc__,
+"snapshot ()\n\n"
+"Returns a PartlistSnapshot, a copy of the partition table type, id and offset and the fields "
+"of all partitions in a single allocation. Unlike Partlist, Parttable and Partition it doesn't "
+"refer to the probe at all, so it stays valid after the probe is used for another device or freed "
+"(the other objects raise ValueError once the probe results change). "
+"Snapshots are immutable, hashable and compared by their content.");
+static PyObject *Partlist_snapshot (PartlistObject *self, PyObject *Py_UNUSED (ignored)) {
+    if (partlist_check (self) < 0)
+        return NULL;
+
+    return _PartlistSnapshot_new (self->partlist);
 }
 
 static PyMethodDef Partlist_methods[] = {
@@ -208,16 +584,25 @@ static PyMethodDef Partlist_methods[] = {
     {"get_partition_by_partno", (PyCFunction)(void(*)(void)) Partlist_get_partition_by_partno, METH_VARARGS|METH_KEYWORDS, Partlist_get_partition_by_partno__doc__},
 #endif
     {"devno_to_partition", (PyCFunction)(void(*)(void)) Partlist_devno_to_partition, METH_VARARGS|METH_KEYWORDS, Partlist_devno_to_partition__doc__},
+    {"find_by_uuid", (PyCFunction)(void(*)(void)) Partlist_find_by_uuid, METH_VARARGS|METH_KEYWORDS, Partlist_find_by_uuid__doc__},
+    {"find_by_name", (PyCFunction)(void(*)(void)) Partlist_find_by_name, METH_VARARGS|METH_KEYWORDS, Partlist_find_by_name__doc__},
+    {"find_by_devno", (PyCFunction)(void(*)(void)) Partlist_find_by_devno, METH_VARARGS|METH_KEYWORDS, Partlist_find_by_devno__doc__},
+    {"to_columns", (PyCFunction) Partlist_to_columns, METH_NOARGS, Partlist_to_columns__doc__},
+    {"snapshot", (PyCFunction) Partlist_snapshot, METH_NOARGS, Partlist_snapshot__doc__},
     {NULL, NULL, 0, NULL},
 };
 
 static PyObject *Partlist_get_table (PartlistObject *self, PyObject *Py_UNUSED (ignored)) {
+    if (partlist_check (self) < 0)
+        return NULL;
+
     if (self->Parttable_object) {
         Py_INCREF (self->Parttable_object);
         return self->Parttable_object;
     }
 
-    self->Parttable_object = _Parttable_get_parttable_object (self->partlist);
+    self->Parttable_object = _Parttable_get_parttable_object (self->partlist, self->owner, self->owner_generation);
+    Py_XINCREF (self->Parttable_object);
 
     return self->Parttable_object;
 }
@@ -225,6 +610,9 @@ static PyObject *Partlist_get_table (PartlistObject *self, PyObject *Py_UNUSED (
 static PyObject *Partlist_get_numof_partitions (PartlistObject *self, PyObject *Py_UNUSED (ignored)) {
     int ret = 0;
 
+    if (partlist_check (self) < 0)
+        return NULL;
+
     ret = blkid_partlist_numof_partitions (self->partlist);
     if (ret < 0) {
         PyErr_SetString (PyExc_MemoryError, "Failed to get number of partitions");
@@ -241,6 +629,41 @@ static PyGetSetDef Partlist_getseters[] = {
     {NULL, NULL, NULL, NULL, NULL}
 };
 
+static Py_ssize_t Partlist_len (PartlistObject *self) {
+    int numof = 0;
+
+    if (partlist_check (self) < 0)
+        return -1;
+
+    numof = blkid_partlist_numof_partitions (self->partlist);
+    if (numof < 0) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to get number of partitions");
+        return -1;
+    }
+
+    return numof;
+}
+
+/* negative indices are already adjusted using Partlist_len */
+static PyObject *Partlist_item (PartlistObject *self, Py_ssize_t index) {
+    Py_ssize_t numof = Partlist_len (self);
+
+    if (numof < 0)
+        return NULL;
+
+    if (index < 0 || index >= numof) {
+        PyErr_SetString (PyExc_IndexError, "partition index out of range");
+        return NULL;
+    }
+
+    return partlist_partition (self, (int) index, NULL);
+}
+
+static PySequenceMethods PartlistSequence = {
+    .sq_length = (lenfunc) Partlist_len,
+    .sq_item = (ssizeargfunc) Partlist_item,
+};
+
 PyTypeObject PartlistType = {
     PyVarObject_HEAD_INIT (NULL, 0)
     .tp_name = "blkid.Partlist",
@@ -252,6 +675,7 @@ PyTypeObject PartlistType = {
     .tp_init = (initproc) Partlist_init,
     .tp_methods = Partlist_methods,
     .tp_getset = Partlist_getseters,
+    .tp_as_sequence = &PartlistSequence,
 };
 
 
@@ -259,6 +683,12 @@ PyTypeObject PartlistType = {
 PyObject *Parttable_new (PyTypeObject *type,  PyObject *args UNUSED, PyObject *kwargs UNUSED) {
     ParttableObject *self = (ParttableObject*) type->tp_alloc (type, 0);
 
+    if (self) {
+        self->owner = NULL;
+        self->owner_generation = NULL;
+        self->generation = 0;
+    }
+
     return (PyObject *) self;
 }
 
@@ -267,10 +697,13 @@ int Parttable_init (ParttableObject *self UNUSED, PyObject *args UNUSED, PyObjec
 }
 
 void Parttable_dealloc (ParttableObject *self) {
+    Py_XDECREF (self->owner);
     Py_TYPE (self)->tp_free ((PyObject *) self);
 }
 
-PyObject *_Parttable_get_parttable_object (blkid_partlist partlist) {
+/* returns a new reference */
+PyObject *_Parttable_get_parttable_object (blkid_partlist partlist, PyObject *owner,
+                                           const unsigned long *owner_generation) {
     ParttableObject *result = NULL;
     blkid_parttable table = NULL;
 
@@ -290,9 +723,12 @@ PyObject *_Parttable_get_parttable_object (blkid_partlist partlist) {
         PyErr_SetString (PyExc_MemoryError, "Failed to create a new Parttable object");
         return NULL;
     }
-    Py_INCREF (result);
 
     result->table = table;
+    Py_XINCREF (owner);
+    result->owner = owner;
+    result->owner_generation = owner_generation;
+    result->generation = owner_generation ? *owner_generation : 0;
 
     return (PyObject *) result;
 }
@@ -302,22 +738,15 @@ PyDoc_STRVAR(Parttable_get_parent__doc__,
 "Parent for nested partition tables.");
 static PyObject *Parttable_get_parent (ParttableObject *self, PyObject *Py_UNUSED (ignored)) {
     blkid_partition blkid_part = NULL;
-    PartitionObject *result = NULL;
+
+    if (parttable_check (self) < 0)
+        return NULL;
 
     blkid_part = blkid_parttable_get_parent (self->table);
     if (!blkid_part)
         Py_RETURN_NONE;
 
-    result = PyObject_New (PartitionObject, &PartitionType);
-    if (!result) {
-        PyErr_SetString (PyExc_MemoryError, "Failed to create a new Partition object");
-        return NULL;
-    }
-
-    result->number = 0;
-    result->partition = blkid_part;
-
-    return (PyObject *) result;
+    return partition_object_new (blkid_part, 0, self->owner, self->owner_generation, self->generation);
 }
 
 static PyMethodDef Parttable_methods[] = {
@@ -326,19 +755,34 @@ static PyMethodDef Parttable_methods[] = {
 };
 
 static PyObject *Parrtable_get_type (ParttableObject *self, PyObject *Py_UNUSED (ignored)) {
-    const char *pttype = blkid_parttable_get_type (self->table);
+    const char *pttype = NULL;
+
+    if (parttable_check (self) < 0)
+        return NULL;
+
+    pttype = blkid_parttable_get_type (self->table);
 
     return PyUnicode_FromString (pttype);
 }
 
 static PyObject *Parrtable_get_id (ParttableObject *self, PyObject *Py_UNUSED (ignored)) {
-    const char *ptid = blkid_parttable_get_id (self->table);
+    const char *ptid = NULL;
+
+    if (parttable_check (self) < 0)
+        return NULL;
+
+    ptid = blkid_parttable_get_id (self->table);
 
     return PyUnicode_FromString (ptid);
 }
 
 static PyObject *Parrtable_get_offset (ParttableObject *self, PyObject *Py_UNUSED (ignored)) {
-    blkid_loff_t offset = blkid_parttable_get_offset (self->table);
+    blkid_loff_t offset = 0;
+
+    if (parttable_check (self) < 0)
+        return NULL;
+
+    offset = blkid_parttable_get_offset (self->table);
 
     return PyLong_FromLongLong (offset);
 }
@@ -367,8 +811,12 @@ PyTypeObject ParttableType = {
 PyObject *Partition_new (PyTypeObject *type,  PyObject *args UNUSED, PyObject *kwargs UNUSED) {
     PartitionObject *self = (PartitionObject*) type->tp_alloc (type, 0);
 
-    if (self)
+    if (self) {
         self->Parttable_object = NULL;
+        self->owner = NULL;
+        self->owner_generation = NULL;
+        self->generation = 0;
+    }
 
     return (PyObject *) self;
 }
@@ -386,32 +834,52 @@ int Partition_init (PartitionObject *self, PyObject *args, PyObject *kwargs) {
 }
 
 void Partition_dealloc (PartitionObject *self) {
-    if (self->Parttable_object)
-        Py_DECREF (self->Parttable_object);
+    Py_XDECREF (self->Parttable_object);
+    Py_XDECREF (self->owner);
 
     Py_TYPE (self)->tp_free ((PyObject *) self);
 }
 
 static PyObject *Partition_get_type (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    int type = blkid_partition_get_type (self->partition);
+    int type = 0;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    type = blkid_partition_get_type (self->partition);
 
     return PyLong_FromLong (type);
 }
 
 static PyObject *Partition_get_type_string (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    const char *type = blkid_partition_get_type_string (self->partition);
+    const char *type = NULL;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    type = blkid_partition_get_type_string (self->partition);
 
     return PyUnicode_FromString (type);
 }
 
 static PyObject *Partition_get_uuid (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    const char *uuid = blkid_partition_get_uuid (self->partition);
+    const char *uuid = NULL;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    uuid = blkid_partition_get_uuid (self->partition);
 
     return PyUnicode_FromString (uuid);
 }
 
 static PyObject *Partition_get_is_extended (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    int extended = blkid_partition_is_extended (self->partition);
+    int extended = 0;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    extended = blkid_partition_is_extended (self->partition);
 
     if (extended == 1)
         Py_RETURN_TRUE;
@@ -420,7 +888,12 @@ static PyObject *Partition_get_is_extended (PartitionObject *self, PyObject *Py_
 }
 
 static PyObject *Partition_get_is_logical (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    int logical = blkid_partition_is_logical (self->partition);
+    int logical = 0;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    logical = blkid_partition_is_logical (self->partition);
 
     if (logical == 1)
         Py_RETURN_TRUE;
@@ -429,7 +902,12 @@ static PyObject *Partition_get_is_logical (PartitionObject *self, PyObject *Py_U
 }
 
 static PyObject *Partition_get_is_primary (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    int primary = blkid_partition_is_primary (self->partition);
+    int primary = 0;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    primary = blkid_partition_is_primary (self->partition);
 
     if (primary == 1)
         Py_RETURN_TRUE;
@@ -438,36 +916,63 @@ static PyObject *Partition_get_is_primary (PartitionObject *self, PyObject *Py_U
 }
 
 static PyObject *Partition_get_name (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    const char *name = blkid_partition_get_name (self->partition);
+    const char *name = NULL;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    name = blkid_partition_get_name (self->partition);
 
     return PyUnicode_FromString (name);
 }
 
 static PyObject *Partition_get_flags (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    unsigned long long flags = blkid_partition_get_flags (self->partition);
+    unsigned long long flags = 0;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    flags = blkid_partition_get_flags (self->partition);
 
     return PyLong_FromUnsignedLongLong (flags);
 }
 
 static PyObject *Partition_get_partno (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    int partno = blkid_partition_get_partno (self->partition);
+    int partno = 0;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    partno = blkid_partition_get_partno (self->partition);
 
     return PyLong_FromLong (partno);
 }
 
 static PyObject *Partition_get_size (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    blkid_loff_t size = blkid_partition_get_size (self->partition);
+    blkid_loff_t size = 0;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    size = blkid_partition_get_size (self->partition);
 
     return PyLong_FromLongLong (size);
 }
 
 static PyObject *Partition_get_start (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
-    blkid_loff_t start = blkid_partition_get_start (self->partition);
+    blkid_loff_t start = 0;
+
+    if (partition_check (self) < 0)
+        return NULL;
+
+    start = blkid_partition_get_start (self->partition);
 
     return PyLong_FromLongLong (start);
 }
 
-PyObject *_Partition_get_parttable_object (blkid_partition partition) {
+/* returns a new reference */
+PyObject *_Partition_get_parttable_object (blkid_partition partition, PyObject *owner,
+                                           const unsigned long *owner_generation) {
     ParttableObject *result = NULL;
     blkid_parttable table = NULL;
 
@@ -487,20 +992,27 @@ PyObject *_Partition_get_parttable_object (blkid_partition partition) {
         PyErr_SetString (PyExc_MemoryError, "Failed to create a new Parttable object");
         return NULL;
     }
-    Py_INCREF (result);
 
     result->table = table;
+    Py_XINCREF (owner);
+    result->owner = owner;
+    result->owner_generation = owner_generation;
+    result->generation = owner_generation ? *owner_generation : 0;
 
     return (PyObject *) result;
 }
 
 static PyObject *Partition_get_table (PartitionObject *self, PyObject *Py_UNUSED (ignored)) {
+    if (partition_check (self) < 0)
+        return NULL;
+
     if (self->Parttable_object) {
         Py_INCREF (self->Parttable_object);
         return self->Parttable_object;
     }
 
-    self->Parttable_object = _Partition_get_parttable_object (self->partition);
+    self->Parttable_object = _Partition_get_parttable_object (self->partition, self->owner, self->owner_generation);
+    Py_XINCREF (self->Parttable_object);
 
     return self->Parttable_object;
 }
@@ -532,3 +1044,265 @@ PyTypeObject PartitionType = {
     .tp_init = (initproc) Partition_init,
     .tp_getset = Partition_getseters,
 };
+
+
+/*********************** PARTLIST SNAPSHOT ***********************/
+#define SNAPSHOT_NO_STRING UINT32_MAX
+
+#define SNAPSHOT_EXTENDED   (1 << 0)
+#define SNAPSHOT_LOGICAL    (1 << 1)
+#define SNAPSHOT_PRIMARY    (1 << 2)
+
+/* Strings are stored after the entries, referred to by their offset. The whole
+ * allocation is zeroed first, so snapshots can be compared and hashed as bytes. */
+typedef struct {
+    int64_t start;
+    int64_t size;
+    uint64_t flags;
+    int32_t partno;
+    int32_t type;
+    uint32_t type_string;
+    uint32_t uuid;
+    uint32_t name;
+    uint32_t kind;
+} PartlistSnapshotEntry;
+
+struct PartlistSnapshotData {
+    int64_t offset;
+    uint32_t pttype;
+    uint32_t ptid;
+    uint32_t nparts;
+    uint32_t strings_len;
+    PartlistSnapshotEntry entries[];
+};
+
+static const char *partlist_snapshot_strings (const PartlistSnapshotData *data) {
+    return (const char *) &(data->entries[data->nparts]);
+}
+
+static PyObject *partlist_snapshot_string (const PartlistSnapshotData *data, uint32_t offset) {
+    if (offset == SNAPSHOT_NO_STRING)
+        Py_RETURN_NONE;
+
+    return PyUnicode_FromString (partlist_snapshot_strings (data) + offset);
+}
+
+static size_t snapshot_string_len (const char *str) {
+    return str ? strlen (str) + 1 : 0;
+}
+
+/* length of all strings stored in the snapshot */
+static size_t partlist_snapshot_strings_len (blkid_partlist partlist, blkid_parttable table, int numof) {
+    blkid_partition part = NULL;
+    size_t len = 0;
+
+    if (table)
+        len += snapshot_string_len (blkid_parttable_get_type (table)) + snapshot_string_len (blkid_parttable_get_id (table));
+
+    for (int i = 0; i < numof; i++) {
+        part = blkid_partlist_get_partition (partlist, i);
+        if (!part)
+            continue;
+
+        len += snapshot_string_len (blkid_partition_get_type_string (part));
+        len += snapshot_string_len (blkid_partition_get_uuid (part));
+        len += snapshot_string_len (blkid_partition_get_name (part));
+    }
+
+    return len;
+}
+
+static uint32_t partlist_snapshot_add_string (PartlistSnapshotData *data, const char *str) {
+    char *strings = (char *) partlist_snapshot_strings (data);
+    uint32_t offset = data->strings_len;
+
+    if (!str)
+        return SNAPSHOT_NO_STRING;
+
+    memcpy (strings + offset, str, strlen (str) + 1);
+    data->strings_len += strlen (str) + 1;
+
+    return offset;
+}
+
+static void partlist_snapshot_fill (PartlistSnapshotData *data, blkid_partlist partlist, blkid_parttable table) {
+    PartlistSnapshotEntry *entry = NULL;
+    blkid_partition part = NULL;
+
+    data->offset = table ? blkid_parttable_get_offset (table) : -1;
+    data->pttype = partlist_snapshot_add_string (data, table ? blkid_parttable_get_type (table) : NULL);
+    data->ptid = partlist_snapshot_add_string (data, table ? blkid_parttable_get_id (table) : NULL);
+
+    for (uint32_t i = 0; i < data->nparts; i++) {
+        entry = &(data->entries[i]);
+        entry->type_string = entry->uuid = entry->name = SNAPSHOT_NO_STRING;
+
+        part = blkid_partlist_get_partition (partlist, i);
+        if (!part)
+            continue;
+
+        entry->start = blkid_partition_get_start (part);
+        entry->size = blkid_partition_get_size (part);
+        entry->flags = blkid_partition_get_flags (part);
+        entry->partno = blkid_partition_get_partno (part);
+        entry->type = blkid_partition_get_type (part);
+        entry->type_string = partlist_snapshot_add_string (data, blkid_partition_get_type_string (part));
+        entry->uuid = partlist_snapshot_add_string (data, blkid_partition_get_uuid (part));
+        entry->name = partlist_snapshot_add_string (data, blkid_partition_get_name (part));
+        entry->kind = (blkid_partition_is_extended (part) == 1 ? SNAPSHOT_EXTENDED : 0) |
+                      (blkid_partition_is_logical (part) == 1 ? SNAPSHOT_LOGICAL : 0) |
+                      (blkid_partition_is_primary (part) == 1 ? SNAPSHOT_PRIMARY : 0);
+    }
+}
+
+/* FNV-1a over the whole allocation */
+static Py_hash_t partlist_snapshot_hash (const PartlistSnapshotData *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    /* -1 is an error for Python */
+    return (Py_hash_t) hash == -1 ? -2 : (Py_hash_t) hash;
+}
+
+PyObject *_PartlistSnapshot_new (blkid_partlist partlist) {
+    PartlistSnapshotObject *result = NULL;
+    blkid_parttable table = NULL;
+    int numof = 0;
+
+    numof = blkid_partlist_numof_partitions (partlist);
+    if (numof < 0) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to get number of partitions");
+        return NULL;
+    }
+    table = blkid_partlist_get_table (partlist);
+
+    result = PyObject_New (PartlistSnapshotObject, &PartlistSnapshotType);
+    if (!result) {
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new PartlistSnapshot object");
+        return NULL;
+    }
+
+    result->size = sizeof (PartlistSnapshotData) + numof * sizeof (PartlistSnapshotEntry) +
+                   partlist_snapshot_strings_len (partlist, table, numof);
+    result->data = calloc (1, result->size);
+    if (!result->data) {
+        Py_DECREF (result);
+        return PyErr_NoMemory ();
+    }
+
+    result->data->nparts = numof;
+    partlist_snapshot_fill (result->data, partlist, table);
+    result->hash = partlist_snapshot_hash (result->data, result->size);
+
+    return (PyObject *) result;
+}
+
+static void PartlistSnapshot_dealloc (PartlistSnapshotObject *self) {
+    free (self->data);
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static Py_ssize_t PartlistSnapshot_len (PartlistSnapshotObject *self) {
+    return self->data->nparts;
+}
+
+/* partitions are returned as dictionaries with the same keys as the Partition attributes */
+static PyObject *PartlistSnapshot_item (PartlistSnapshotObject *self, Py_ssize_t index) {
+    const PartlistSnapshotEntry *entry = NULL;
+    PyObject *type_string = NULL;
+    PyObject *uuid = NULL;
+    PyObject *name = NULL;
+    PyObject *result = NULL;
+
+    if (index < 0 || index >= (Py_ssize_t) self->data->nparts) {
+        PyErr_SetString (PyExc_IndexError, "partition index out of range");
+        return NULL;
+    }
+    entry = &(self->data->entries[index]);
+
+    type_string = partlist_snapshot_string (self->data, entry->type_string);
+    uuid = partlist_snapshot_string (self->data, entry->uuid);
+    name = partlist_snapshot_string (self->data, entry->name);
+
+    if (type_string && uuid && name)
+        result = Py_BuildValue ("{s:L,s:L,s:K,s:i,s:i,s:O,s:O,s:O,s:O,s:O,s:O}",
+                                "start", (long long) entry->start,
+                                "size", (long long) entry->size,
+                                "flags", (unsigned long long) entry->flags,
+                                "partno", entry->partno,
+                                "type", entry->type,
+                                "type_string", type_string,
+                                "uuid", uuid,
+                                "name", name,
+                                "is_extended", entry->kind & SNAPSHOT_EXTENDED ? Py_True : Py_False,
+                                "is_logical", entry->kind & SNAPSHOT_LOGICAL ? Py_True : Py_False,
+                                "is_primary", entry->kind & SNAPSHOT_PRIMARY ? Py_True : Py_False);
+
+    Py_XDECREF (type_string);
+    Py_XDECREF (uuid);
+    Py_XDECREF (name);
+
+    return result;
+}
+
+static PySequenceMethods PartlistSnapshotSequence = {
+    .sq_length = (lenfunc) PartlistSnapshot_len,
+    .sq_item = (ssizeargfunc) PartlistSnapshot_item,
+};
+
+static PyObject *PartlistSnapshot_richcompare (PartlistSnapshotObject *self, PyObject *other, int op) {
+    PartlistSnapshotObject *snapshot = (PartlistSnapshotObject *) other;
+    bool equal = false;
+
+    if (!PyObject_TypeCheck (other, &PartlistSnapshotType) || (op != Py_EQ && op != Py_NE))
+        Py_RETURN_NOTIMPLEMENTED;
+
+    equal = self->hash == snapshot->hash && self->size == snapshot->size &&
+            memcmp (self->data, snapshot->data, self->size) == 0;
+
+    if (equal == (op == Py_EQ))
+        Py_RETURN_TRUE;
+    else
+        Py_RETURN_FALSE;
+}
+
+static Py_hash_t PartlistSnapshot_hash (PartlistSnapshotObject *self) {
+    return self->hash;
+}
+
+static PyObject *PartlistSnapshot_get_type (PartlistSnapshotObject *self, PyObject *Py_UNUSED (ignored)) {
+    return partlist_snapshot_string (self->data, self->data->pttype);
+}
+
+static PyObject *PartlistSnapshot_get_id (PartlistSnapshotObject *self, PyObject *Py_UNUSED (ignored)) {
+    return partlist_snapshot_string (self->data, self->data->ptid);
+}
+
+static PyObject *PartlistSnapshot_get_offset (PartlistSnapshotObject *self, PyObject *Py_UNUSED (ignored)) {
+    return PyLong_FromLongLong (self->data->offset);
+}
+
+static PyGetSetDef PartlistSnapshot_getseters[] = {
+    {"type", (getter) PartlistSnapshot_get_type, NULL, "partition table type (type name, e.g. 'dos', 'gpt', ...) or None", NULL},
+    {"id", (getter) PartlistSnapshot_get_id, NULL, "GPT disk UUID or DOS disk ID (in hex format) or None", NULL},
+    {"offset", (getter) PartlistSnapshot_get_offset, NULL, "position (in bytes) of the partition table, -1 without table", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+PyTypeObject PartlistSnapshotType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid.PartlistSnapshot",
+    .tp_basicsize = sizeof (PartlistSnapshotObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) PartlistSnapshot_dealloc,
+    .tp_as_sequence = &PartlistSnapshotSequence,
+    .tp_richcompare = (richcmpfunc) PartlistSnapshot_richcompare,
+    .tp_hash = (hashfunc) PartlistSnapshot_hash,
+    .tp_getset = PartlistSnapshot_getseters,
+};
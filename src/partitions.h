@@ -22,24 +22,47 @@
 
 #include <blkid/blkid.h>
 
+#include "hashtable.h"
+
+/* Partitions and tables point to libblkid memory owned by the probe, so all the
+ * objects keep the Probe ('owner') alive. The Probe only has a borrowed pointer
+ * to its current Partlist ('owner_slot') which is cleared when the Partlist is
+ * freed, Partition objects are cached per index in their Partlist.
+ * libblkid frees the memory when the partitions are read again after a new probing,
+ * so every object remembers the generation of the probe results it was created from
+ * ('generation') and fails when the Probe's one ('owner_generation') changed. */
 typedef struct {
     PyObject_HEAD
     blkid_partlist partlist;
     PyObject *Parttable_object;
+    PyObject *owner;
+    PyObject **owner_slot;
+    const unsigned long *owner_generation;
+    unsigned long generation;
+    PyObject **partitions;
+    int npartitions;
+    HashTable *uuid_index;  /* lowercase UUID -> index + 1, built on first use */
+    HashTable *name_index;  /* name -> index + 1, built on first use */
+    HashTable *devno_index; /* devno -> index + 1, filled by find_by_devno() */
 } PartlistObject;
 
 extern PyTypeObject PartlistType;
+extern PyTypeObject PartlistColumnType;
 
 PyObject *Partlist_new (PyTypeObject *type,  PyObject *args, PyObject *kwargs);
 int Partlist_init (PartlistObject *self, PyObject *args, PyObject *kwargs);
 void Partlist_dealloc (PartlistObject *self);
 
-PyObject *_Partlist_get_partlist_object (blkid_probe probe);
+PyObject *_Partlist_get_partlist_object (blkid_partlist partlist, PyObject *owner, PyObject **owner_slot,
+                                         const unsigned long *owner_generation);
 
 
 typedef struct {
     PyObject_HEAD
     blkid_parttable table;
+    PyObject *owner;
+    const unsigned long *owner_generation;
+    unsigned long generation;
 } ParttableObject;
 
 extern PyTypeObject ParttableType;
@@ -48,13 +71,17 @@ PyObject *Parttable_new (PyTypeObject *type,  PyObject *args, PyObject *kwargs);
 int Parttable_init (ParttableObject *self, PyObject *args, PyObject *kwargs);
 void Parttable_dealloc (ParttableObject *self);
 
-PyObject *_Parttable_get_parttable_object (blkid_partlist partlist);
+PyObject *_Parttable_get_parttable_object (blkid_partlist partlist, PyObject *owner,
+                                           const unsigned long *owner_generation);
 
 typedef struct {
     PyObject_HEAD
     int number;
     blkid_partition partition;
     PyObject *Parttable_object;
+    PyObject *owner;
+    const unsigned long *owner_generation;
+    unsigned long generation;
 } PartitionObject;
 
 extern PyTypeObject PartitionType;
@@ -63,6 +90,21 @@ PyObject *Partition_new (PyTypeObject *type,  PyObject *args, PyObject *kwargs);
 int Partition_init (PartitionObject *self, PyObject *args, PyObject *kwargs);
 void Partition_dealloc (PartitionObject *self);
 
-PyObject *_Partition_get_parttable_object (blkid_partition partition);
+PyObject *_Partition_get_parttable_object (blkid_partition partition, PyObject *owner,
+                                           const unsigned long *owner_generation);
+
+/* copy of a partition list that doesn't depend on the probe, see Partlist.snapshot() */
+typedef struct PartlistSnapshotData PartlistSnapshotData;
+
+typedef struct {
+    PyObject_HEAD
+    PartlistSnapshotData *data;
+    size_t size;
+    Py_hash_t hash;
+} PartlistSnapshotObject;
+
+extern PyTypeObject PartlistSnapshotType;
+
+PyObject *_PartlistSnapshot_new (blkid_partlist partlist);
 
 #endif /* PARTITIONS_H */
@@ -19,14 +19,456 @@
 #include "probe.h"
 #include "topology.h"
 #include "partitions.h"
+#include "async.h"
 
 #include <blkid/blkid.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #define UNUSED __attribute__((unused))
 
+/* All access to the libblkid probe goes through the per-object lock so a single
+ * Probe can be shared between threads. Blocking calls release the GIL while
+ * holding the lock, so the lock must never be waited for with the GIL held. */
+static void probe_lock (ProbeObject *self) {
+    if (PyThread_acquire_lock (self->lock, NOWAIT_LOCK))
+        return;
+
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock (self->lock, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+}
+
+static void probe_unlock (ProbeObject *self) {
+    PyThread_release_lock (self->lock);
+}
+
+/* drops the topology and partitions objects and the memoized results, they are no
+ * longer valid after re-probing */
+static void probe_invalidate (ProbeObject *self) {
+    Py_CLEAR (self->topology);
+    self->partlist = NULL;
+    /* libblkid frees the partitions when they are read again, old Partlist, Partition
+     * and Parttable objects refuse to use them with a different generation */
+    self->parts = NULL;
+    self->generation++;
+    Py_CLEAR (self->memo);
+}
+
+/* The values live in libblkid memory which is freed on re-probe, so it can't be
+ * changed while there are memoryviews from lookup_raw() (like resizing a bytearray).
+ * Views are only created with the probe lock held, so the check is final only when
+ * done with the lock held, without it the check just fails early. */
+#define PROBE_EXPORTS_ERROR "Existing exports of probe values, release memoryviews returned by lookup_raw() first"
+
+static int probe_check_exports (ProbeObject *self) {
+    if (__atomic_load_n (&(self->exports), __ATOMIC_ACQUIRE) > 0) {
+        PyErr_SetString (PyExc_BufferError, PROBE_EXPORTS_ERROR);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* takes the probe lock for changing the probing results, fails with BufferError
+ * (and without the lock) if there are views of the current values */
+static int probe_lock_results (ProbeObject *self) {
+    probe_lock (self);
+
+    if (probe_check_exports (self) < 0) {
+        probe_unlock (self);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*********************** STATS ***********************/
+typedef struct {
+    struct timespec wall;
+    struct timespec cpu;
+    bool io;
+    long long rchar;
+    long long syscr;
+    long long read_bytes;
+    long long self_rchar;
+} ProbeStatsSample;
+
+static long long proc_io_field (const char *buf, const char *name) {
+    const char *field = strstr (buf, name);
+
+    if (!field)
+        return -1;
+
+    return strtoll (field + strlen (name), NULL, 10);
+}
+
+/* Reads the I/O counters of the current thread, the read() of the counters itself
+ * shows in the next sample and is subtracted in probe_stats_update(). */
+static bool proc_thread_io (ProbeStatsSample *sample) {
+    char buf[512];
+    ssize_t len = 0;
+    int fd = -1;
+
+    fd = open ("/proc/thread-self/io", O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    len = read (fd, buf, sizeof (buf) - 1);
+    close (fd);
+    if (len <= 0)
+        return false;
+    buf[len] = '\0';
+
+    sample->rchar = proc_io_field (buf, "rchar:");
+    sample->syscr = proc_io_field (buf, "syscr:");
+    sample->read_bytes = proc_io_field (buf, "read_bytes:");
+    sample->self_rchar = len;
+
+    return sample->rchar >= 0 && sample->syscr >= 0 && sample->read_bytes >= 0;
+}
+
+static void probe_stats_sample (ProbeStatsSample *sample) {
+    sample->io = proc_thread_io (sample);
+    clock_gettime (CLOCK_MONOTONIC, &(sample->wall));
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &(sample->cpu));
+}
+
+static double timespec_diff (const struct timespec *begin, const struct timespec *end) {
+    return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+static void probe_stats_update (ProbeObject *self, const char *call, const ProbeStatsSample *begin) {
+    ProbeStats *stats = self->stats;
+    ProbeStatsSample end;
+
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &(end.cpu));
+    clock_gettime (CLOCK_MONOTONIC, &(end.wall));
+    end.io = proc_thread_io (&end);
+
+    stats->call = call;
+    stats->wall_time = timespec_diff (&(begin->wall), &(end.wall));
+    stats->cpu_time = timespec_diff (&(begin->cpu), &(end.cpu));
+    stats->chains = self->chains;
+
+    if (begin->io && end.io) {
+        stats->bytes_read = end.rchar - begin->rchar - begin->self_rchar;
+        stats->read_syscalls = end.syscr - begin->syscr - 1;
+        stats->storage_bytes_read = end.read_bytes - begin->read_bytes;
+        stats->total_bytes_read += stats->bytes_read;
+        stats->total_read_syscalls += stats->read_syscalls;
+    } else {
+        stats->bytes_read = -1;
+        stats->read_syscalls = -1;
+        stats->storage_bytes_read = -1;
+    }
+
+    stats->calls++;
+    stats->total_wall_time += stats->wall_time;
+    stats->total_cpu_time += stats->cpu_time;
+}
+
+/* Runs one of the blkid_do_*probe() functions, must be called with the probe lock
+ * held and without the GIL. The stats are only sampled when enabled. */
+static int probe_run (ProbeObject *self, int (*func) (blkid_probe), const char *call) {
+    ProbeStatsSample begin;
+    int ret = 0;
+
+    if (self->stats)
+        probe_stats_sample (&begin);
+
+    ret = func (self->probe);
+
+    if (self->stats)
+        probe_stats_update (self, call, &begin);
+
+    return ret;
+}
+
+/*********************** MEMO ***********************/
+/* BLKGETDISKSEQ from linux/fs.h, Linux 5.15 */
+#ifndef BLKGETDISKSEQ
+#define BLKGETDISKSEQ _IOR(0x12, 128, uint64_t)
+#endif
+
+#define PROBE_FILTER_SUPERBLOCKS    (1 << 0)
+#define PROBE_FILTER_PARTITIONS     (1 << 1)
+
+/* Results of do_safeprobe() shared by all probes in the process, NULL when disabled.
+ * Maps (devno, offset, sector size, chains) to (diskseq, size, ret, ProbeResult),
+ * a different disk sequence number or size replaces the entry. Only used with the GIL. */
+static PyObject *probe_memo = NULL;
+
+int _Probe_memo_enable (bool enable) {
+    if (enable && !probe_memo) {
+        probe_memo = PyDict_New ();
+        if (!probe_memo)
+            return -1;
+    } else if (!enable)
+        Py_CLEAR (probe_memo);
+
+    return 0;
+}
+
+void _Probe_memo_clear (void) {
+    if (probe_memo)
+        PyDict_Clear (probe_memo);
+}
+
+/* disk sequence number of the block device open as 'fd', 0 if unknown, doesn't need the GIL */
+static uint64_t probe_diskseq (int fd) {
+    uint64_t diskseq = 0;
+
+    if (ioctl (fd, BLKGETDISKSEQ, &diskseq) != 0)
+        return 0;
+
+    return diskseq;
+}
+
+/* Drops the memoized results of the disk with the 'diskseq' disk sequence number (its
+ * partitions share it) after its signatures were erased, 0 doesn't drop anything.
+ * Returns 0 on success and -1 with an exception set on failure. */
+int _Probe_memo_forget (uint64_t diskseq) {
+    PyObject *keys = NULL;
+    PyObject *key = NULL;
+    PyObject *entry = NULL;
+    Py_ssize_t pos = 0;
+    int ret = 0;
+
+    if (!probe_memo || diskseq == 0)
+        return 0;
+
+    keys = PyList_New (0);
+    if (!keys)
+        return -1;
+
+    while (PyDict_Next (probe_memo, &pos, &key, &entry)) {
+        if (PyLong_AsUnsignedLongLong (PyTuple_GET_ITEM (PyTuple_GET_ITEM (entry, 0), 0)) != diskseq)
+            continue;
+        if (PyList_Append (keys, key) < 0) {
+            Py_DECREF (keys);
+            return -1;
+        }
+    }
+
+    for (Py_ssize_t i = 0; ret == 0 && i < PyList_GET_SIZE (keys); i++)
+        ret = PyDict_DelItem (probe_memo, PyList_GET_ITEM (keys, i));
+    Py_DECREF (keys);
+
+    return ret;
+}
+
+/* Builds the memo key and the generation of the current device. Returns 1 on success,
+ * 0 if the results can't be memoized (not a block device, no disk sequence number or
+ * filters are set) and -1 with an exception set on failure. */
+static int probe_memo_key (ProbeObject *self, PyObject **key, PyObject **generation) {
+    dev_t devno = 0;
+    uint64_t diskseq = 0;
+    blkid_loff_t offset = 0;
+    blkid_loff_t size = 0;
+    unsigned int sector_size = 0;
+    ProbeChains chains = self->chains;
+
+    if (self->filters)
+        return 0;
+
+    probe_lock (self);
+    devno = blkid_probe_get_devno (self->probe);
+    offset = blkid_probe_get_offset (self->probe);
+    size = blkid_probe_get_size (self->probe);
+    sector_size = blkid_probe_get_sectorsize (self->probe);
+    if (devno != 0)
+        diskseq = probe_diskseq (self->fd);
+    probe_unlock (self);
+
+    /* the disk sequence number is the only way to tell the media didn't change */
+    if (devno == 0 || diskseq == 0)
+        return 0;
+
+    *key = Py_BuildValue ("(KLIiiiii)", (unsigned long long) devno, (long long) offset, sector_size,
+                          chains.superblocks, chains.superblocks_flags,
+                          chains.partitions, chains.partitions_flags, chains.topology);
+    if (!*key)
+        return -1;
+
+    *generation = Py_BuildValue ("(KL)", (unsigned long long) diskseq, (long long) size);
+    if (!*generation) {
+        Py_CLEAR (*key);
+        return -1;
+    }
+
+    return 1;
+}
+
+/* Returns the memoized return value of do_safeprobe() and sets self->memo to the results,
+ * -2 if the results are not memoized (or out of date) and -1 with an exception set on failure. */
+static int probe_memo_lookup (ProbeObject *self, PyObject *key, PyObject *generation) {
+    PyObject *entry = NULL;
+    int cmp = 0;
+
+    entry = PyDict_GetItemWithError (probe_memo, key);
+    if (!entry)
+        return PyErr_Occurred () ? -1 : -2;
+
+    cmp = PyObject_RichCompareBool (PyTuple_GET_ITEM (entry, 0), generation, Py_EQ);
+    if (cmp <= 0)
+        return cmp < 0 ? -1 : -2;
+
+    Py_INCREF (PyTuple_GET_ITEM (entry, 2));
+    self->memo = PyTuple_GET_ITEM (entry, 2);
+
+    return (int) PyLong_AsLong (PyTuple_GET_ITEM (entry, 1));
+}
+
+/* 'values' are the results of the probing collected with the probe lock still held */
+static int probe_memo_store (PyObject *key, PyObject *generation, int ret, ProbeValues *values) {
+    PyObject *result = NULL;
+    PyObject *entry = NULL;
+
+    if (!values) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to get probe results");
+        return -1;
+    }
+
+    result = _ProbeResult_new (values);
+    if (!result)
+        return -1;
+
+    entry = Py_BuildValue ("(OiN)", generation, ret, result);
+    if (!entry)
+        return -1;
+
+    ret = PyDict_SetItem (probe_memo, key, entry);
+    Py_DECREF (entry);
+
+    return ret;
+}
+
+/* lookups of the results served from the memo, libblkid doesn't have any values then */
+static int probe_lookup_value (ProbeObject *self, const char *name, const char **data, size_t *len) {
+    const ProbeValues *values = NULL;
+
+    if (!self->memo)
+        return blkid_probe_lookup_value (self->probe, name, data, len);
+
+    values = ((ProbeResultObject *) self->memo)->values;
+    for (int i = 0; i < values->nvalues; i++) {
+        if (strcmp (values->values[i].name, name) == 0) {
+            *data = values->values[i].data;
+            if (len)
+                *len = values->values[i].len;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int probe_numof_values (ProbeObject *self) {
+    if (self->memo)
+        return ((ProbeResultObject *) self->memo)->values->nvalues;
+
+    return blkid_probe_numof_values (self->probe);
+}
+
+/* Well-known tags, names are interned on module init so lookups with string
+ * literals (which are interned by Python too) can be matched by identity. */
+static const char *probe_tags[] = { "TYPE", "UUID", "LABEL", "PTTYPE", "PTUUID", "PARTUUID", "USAGE", "VERSION" };
+#define PROBE_NTAGS ((int) (sizeof (probe_tags) / sizeof (probe_tags[0])))
+
+static PyObject *probe_tag_names[PROBE_NTAGS];
+
+static PyStructSequence_Field ProbeTags_fields[] = {
+    {"type", "filesystem, RAID or partition table type"},
+    {"uuid", "filesystem UUID"},
+    {"label", "filesystem label"},
+    {"pttype", "partition table type"},
+    {"ptuuid", "partition table UUID"},
+    {"partuuid", "partition UUID"},
+    {"usage", "usage (filesystem, raid, crypto, other)"},
+    {"version", "filesystem version"},
+    {NULL, NULL},
+};
+
+static PyStructSequence_Desc ProbeTags_desc = {
+    .name = "blkid.ProbeTags",
+    .doc = "Well-known probing tags, None for tags that were not detected",
+    .fields = ProbeTags_fields,
+    .n_in_sequence = PROBE_NTAGS,
+};
+
+PyTypeObject ProbeTagsType;
+
+int _Probe_init_tags (void) {
+    for (int i = 0; i < PROBE_NTAGS; i++) {
+        probe_tag_names[i] = PyUnicode_InternFromString (probe_tags[i]);
+        if (!probe_tag_names[i])
+            return -1;
+    }
+
+    return PyStructSequence_InitType2 (&ProbeTagsType, &ProbeTags_desc);
+}
+
+/* returns index of the well-known tag for an interned 'key', -1 for everything else */
+static int probe_tag_index (PyObject *key) {
+    for (int i = 0; i < PROBE_NTAGS; i++)
+        if (probe_tag_names[i] == key)
+            return i;
+
+    return -1;
+}
+
+static int probe_tag_index_name (const char *name) {
+    for (int i = 0; i < PROBE_NTAGS; i++)
+        if (strcmp (probe_tags[i], name) == 0)
+            return i;
+
+    return -1;
+}
+
+/* Assigns 'fd' to the probe and closes the previously assigned fd if it is owned by
+ * the probe. With 'owned' the ownership of 'fd' is taken over even on failure.
+ * When libblkid fails to use the new fd the probe is left without a device.
+ * Must be called with the GIL, returns 0 on success and -2 with BufferError set
+ * if there are views of the current values. */
+static int probe_assign_fd (ProbeObject *self, int fd, bool owned, blkid_loff_t offset, blkid_loff_t size) {
+    int ret = 0;
+    int old_fd = -1;
+    bool old_owned = false;
+
+    if (probe_lock_results (self) < 0) {
+        if (owned && fd >= 0)
+            close (fd);
+        return -2;
+    }
+
+    probe_invalidate (self);
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = blkid_probe_set_device (self->probe, fd, offset, size);
+
+    old_fd = self->fd;
+    old_owned = self->fd_owned;
+    if (ret == 0) {
+        self->fd = fd;
+        self->fd_owned = owned;
+    } else {
+        self->fd = -1;
+        self->fd_owned = false;
+    }
+    PyThread_release_lock (self->lock);
+
+    if (old_fd >= 0 && old_owned && old_fd != fd)
+        close (old_fd);
+    if (ret != 0 && owned)
+        close (fd);
+    Py_END_ALLOW_THREADS
+
+    return ret;
+}
 
 PyObject *Probe_new (PyTypeObject *type,  PyObject *args UNUSED, PyObject *kwargs UNUSED) {
     ProbeObject *self = (ProbeObject*) type->tp_alloc (type, 0);
@@ -34,8 +476,23 @@ PyObject *Probe_new (PyTypeObject *type,  PyObject *args UNUSED, PyObject *kwarg
     if (self) {
         self->probe = NULL;
         self->fd = -1;
+        self->fd_owned = false;
+        self->exports = 0;
+        self->pending = 0;
+        self->stats = NULL;
+        self->memo = NULL;
+        self->filters = 0;
         self->topology = NULL;
         self->partlist = NULL;
+        self->parts = NULL;
+        self->generation = 0;
+
+        self->lock = PyThread_allocate_lock ();
+        if (!self->lock) {
+            Py_DECREF (self);
+            PyErr_SetString (PyExc_MemoryError, "Failed to create a new Probe lock");
+            return NULL;
+        }
     }
 
     return (PyObject *) self;
@@ -51,22 +508,30 @@ int Probe_init (ProbeObject *self, PyObject *args UNUSED, PyObject *kwargs UNUSE
         return -1;
     }
 
+    /* libblkid defaults */
+    self->chains = (ProbeChains) { true, BLKID_SUBLKS_DEFAULT, false, 0, false };
+
     return 0;
 }
 
 void Probe_dealloc (ProbeObject *self) {
+    if (self->lock) {
+        PyThread_free_lock (self->lock);
+        self->lock = NULL;
+    }
+
     if (!self->probe)
         /* if init fails */
         return;
 
-    if (self->fd > 0)
+    if (self->fd >= 0 && self->fd_owned)
         close (self->fd);
 
     if (self->topology)
         Py_DECREF (self->topology);
 
-    if (self->partlist)
-        Py_DECREF (self->partlist);
+    free (self->stats);
+    Py_XDECREF (self->memo);
 
     blkid_free_probe (self->probe);
     Py_TYPE (self)->tp_free ((PyObject *) self);
@@ -74,7 +539,8 @@ void Probe_dealloc (ProbeObject *self) {
 
 PyDoc_STRVAR(Probe_set_device__doc__,
 "set_device (device, flags=os.O_RDONLY|os.O_CLOEXEC, offset=0, size=0)\n\n"
-"Assigns the device to probe control struct, resets internal buffers and resets the current probing.\n\n"
+"Assigns the device to probe control struct, resets internal buffers and resets the current probing.\n"
+"The previously assigned device is closed if it was opened by the probe.\n\n"
 "'flags' define flags for the 'open' system call. By default the device will be opened as read-only.\n"
 "'offset' and 'size' specify begin and size of probing area (zero means whole device/file)");
 static PyObject *Probe_set_device (ProbeObject *self, PyObject *args, PyObject *kwargs) {
@@ -84,18 +550,142 @@ static PyObject *Probe_set_device (ProbeObject *self, PyObject *args, PyObject *
     blkid_loff_t offset = 0;
     blkid_loff_t size = 0;
     int flags = O_RDONLY|O_CLOEXEC;
+    int fd = -1;
 
     if (!PyArg_ParseTupleAndKeywords (args, kwargs, "s|iKK", kwlist, &device, &flags, &offset, &size)) {
         return NULL;
     }
 
-    self->fd = open (device, flags);
-    if (self->fd == -1) {
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = open (device, flags);
+    Py_END_ALLOW_THREADS
+
+    if (fd == -1) {
         PyErr_Format (PyExc_OSError, "Failed to open device '%s': %s", device, strerror (errno));
         return NULL;
     }
 
-    ret = blkid_probe_set_device (self->probe, self->fd, offset, size);
+    ret = probe_assign_fd (self, fd, true, offset, size);
+    if (ret == -2)
+        return NULL;
+    if (ret != 0) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to set device");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* copies the buffer to an anonymous memory file, libblkid can only read from a file descriptor */
+static int buffer_to_memfd (const Py_buffer *view) {
+    int fd = -1;
+    const char *data = view->buf;
+    Py_ssize_t left = view->len;
+    ssize_t written = 0;
+
+    fd = memfd_create ("pyblkid", MFD_CLOEXEC|MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+
+    while (left > 0) {
+        written = write (fd, data, left);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0) {
+            close (fd);
+            return -1;
+        }
+        data += written;
+        left -= written;
+    }
+
+    /* the content must not change under the probe */
+    if (fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL) < 0) {
+        close (fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+PyDoc_STRVAR(Probe_set_buffer__doc__,
+"set_buffer (buffer, offset=0, size=0)\n\n"
+"Assigns an in-memory buffer to probe control struct, resets internal buffers and resets the current probing.\n\n"
+"'buffer' can be any object supporting the buffer protocol (bytes, bytearray, memoryview, mmap...). "
+"The data is copied once into an anonymous memory file (no file is created on disk), so the buffer "
+"can be modified or released afterwards.\n"
+"'offset' and 'size' specify begin and size of probing area (zero means whole buffer)");
+static PyObject *Probe_set_buffer (ProbeObject *self, PyObject *args, PyObject *kwargs) {
+    int ret = 0;
+    char *kwlist[] = { "buffer", "offset", "size", NULL };
+    Py_buffer view;
+    blkid_loff_t offset = 0;
+    blkid_loff_t size = 0;
+    int fd = -1;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "y*|KK", kwlist, &view, &offset, &size)) {
+        return NULL;
+    }
+
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    fd = buffer_to_memfd (&view);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release (&view);
+
+    if (fd < 0) {
+        PyErr_Format (PyExc_OSError, "Failed to create memory file for the buffer: %s", strerror (errno));
+        return NULL;
+    }
+
+    /* the memory file is owned by the probe */
+    ret = probe_assign_fd (self, fd, true, offset, size);
+    if (ret == -2)
+        return NULL;
+    if (ret != 0) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to set buffer");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Probe_set_fd__doc__,
+"set_fd (fd, offset=0, size=0, owned=False)\n\n"
+"Assigns an already opened file descriptor to probe control struct, resets internal buffers and "
+"resets the current probing.\n\n"
+"With 'owned' the probe takes over the file descriptor and closes it when another device is "
+"assigned, on close() or when the probe is freed, otherwise the caller is responsible for closing it.\n"
+"'offset' and 'size' specify begin and size of probing area (zero means whole device/file)");
+static PyObject *Probe_set_fd (ProbeObject *self, PyObject *args, PyObject *kwargs) {
+    int ret = 0;
+    char *kwlist[] = { "fd", "offset", "size", "owned", NULL };
+    int fd = -1;
+    blkid_loff_t offset = 0;
+    blkid_loff_t size = 0;
+    int owned = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "i|KKp", kwlist, &fd, &offset, &size, &owned)) {
+        return NULL;
+    }
+
+    if (fd < 0) {
+        PyErr_SetString (PyExc_ValueError, "Invalid file descriptor");
+        return NULL;
+    }
+
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    ret = probe_assign_fd (self, fd, owned, offset, size);
+    if (ret == -2)
+        return NULL;
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to set device");
         return NULL;
@@ -104,6 +694,33 @@ static PyObject *Probe_set_device (ProbeObject *self, PyObject *args, PyObject *
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(Probe_close__doc__,
+"close ()\n\n"
+"Removes the assigned device from the probe and closes its file descriptor if it is owned by the probe.\n"
+"Calling close() on a probe without a device does nothing.");
+static PyObject *Probe_close (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    if (self->fd < 0)
+        Py_RETURN_NONE;
+
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    /* libblkid resets the probe and forgets the fd, the failure to use -1 is expected */
+    if (probe_assign_fd (self, -1, false, 0, 0) == -2)
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *Probe_enter (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    Py_INCREF (self);
+    return (PyObject *) self;
+}
+
+static PyObject *Probe_exit (ProbeObject *self, PyObject *Py_UNUSED (args)) {
+    return Probe_close (self, NULL);
+}
+
 PyDoc_STRVAR(Probe_enable_superblocks__doc__,
 "enable_superblocks (enable)\n\n" \
 "Enables/disables the superblocks probing for non-binary interface.");
@@ -116,12 +733,44 @@ static PyObject *Probe_enable_superblocks (ProbeObject *self, PyObject *args, Py
         return NULL;
     }
 
+    probe_lock (self);
     ret = blkid_probe_enable_superblocks (self->probe, enable);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_Format (PyExc_RuntimeError, "Failed to %s superblocks probing", enable ? "enable" : "disable");
         return NULL;
     }
 
+    self->chains.superblocks = enable;
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Probe_enable_stats__doc__,
+"enable_stats (enable)\n\n"
+"Enables/disables collecting statistics of the do_safeprobe(), do_fullprobe() and do_probe() "
+"calls (including the asynchronous variants) and of every iter_probe() step, see the 'stats' attribute. Enabling the statistics "
+"again resets them. When disabled, no statistics are collected.");
+static PyObject *Probe_enable_stats (ProbeObject *self, PyObject *args, PyObject *kwargs) {
+    int enable = 0;
+    char *kwlist[] = { "enable", NULL };
+    ProbeStats *stats = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "p", kwlist, &enable)) {
+        return NULL;
+    }
+
+    if (enable) {
+        stats = calloc (1, sizeof (ProbeStats));
+        if (!stats)
+            return PyErr_NoMemory ();
+    }
+
+    probe_lock (self);
+    free (self->stats);
+    self->stats = stats;
+    probe_unlock (self);
+
     Py_RETURN_NONE;
 }
 
@@ -138,12 +787,16 @@ static PyObject *Probe_set_superblocks_flags (ProbeObject *self, PyObject *args,
         return NULL;
     }
 
+    probe_lock (self);
     ret = blkid_probe_set_superblocks_flags (self->probe, flags);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to set partition flags");
         return NULL;
     }
 
+    self->chains.superblocks_flags = flags;
+
     Py_RETURN_NONE;
 }
 
@@ -166,6 +819,9 @@ static PyObject *Probe_filter_superblocks_type (ProbeObject *self, PyObject *arg
         return NULL;
     }
 
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
     if (!PySequence_Check (pynames)) {
         PyErr_SetString (PyExc_AttributeError, "Failed to parse list of names for filter");
         return NULL;
@@ -190,7 +846,14 @@ static PyObject *Probe_filter_superblocks_type (ProbeObject *self, PyObject *arg
     }
     names[len] = NULL;
 
+    if (probe_lock_results (self) < 0) {
+        for (Py_ssize_t i = 0; i < len; i++)
+            free (names[i]);
+        free (names);
+        return NULL;
+    }
     ret = blkid_probe_filter_superblocks_type (self->probe, flag, names);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to set probe filter");
         for (Py_ssize_t i = 0; i < len; i++)
@@ -203,6 +866,8 @@ static PyObject *Probe_filter_superblocks_type (ProbeObject *self, PyObject *arg
             free(names[i]);
     free (names);
 
+    self->filters |= PROBE_FILTER_SUPERBLOCKS;
+
     Py_RETURN_NONE;
 }
 
@@ -222,12 +887,20 @@ static PyObject *Probe_filter_superblocks_usage (ProbeObject *self, PyObject *ar
         return NULL;
     }
 
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    if (probe_lock_results (self) < 0)
+        return NULL;
     ret = blkid_probe_filter_superblocks_usage (self->probe, flag, usage);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to set probe filter");
         return NULL;
     }
 
+    self->filters |= PROBE_FILTER_SUPERBLOCKS;
+
     Py_RETURN_NONE;
 }
 
@@ -237,12 +910,20 @@ PyDoc_STRVAR(Probe_invert_superblocks_filter__doc__,
 static PyObject *Probe_invert_superblocks_filter (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
     int ret = 0;
 
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    if (probe_lock_results (self) < 0)
+        return NULL;
     ret = blkid_probe_invert_superblocks_filter (self->probe);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to invert superblock probing filter");
         return NULL;
     }
 
+    self->filters |= PROBE_FILTER_SUPERBLOCKS;
+
     Py_RETURN_NONE;
 }
 
@@ -252,12 +933,20 @@ PyDoc_STRVAR(Probe_reset_superblocks_filter__doc__,
 static PyObject *Probe_reset_superblocks_filter (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
     int ret = 0;
 
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    if (probe_lock_results (self) < 0)
+        return NULL;
     ret = blkid_probe_reset_superblocks_filter (self->probe);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to reset superblock probing filter");
         return NULL;
     }
 
+    self->filters &= ~PROBE_FILTER_SUPERBLOCKS;
+
     Py_RETURN_NONE;
 }
 
@@ -273,12 +962,16 @@ static PyObject *Probe_enable_partitions (ProbeObject *self, PyObject *args, PyO
         return NULL;
     }
 
+    probe_lock (self);
     ret = blkid_probe_enable_partitions (self->probe, enable);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_Format (PyExc_RuntimeError, "Failed to %s partitions probing", enable ? "enable" : "disable");
         return NULL;
     }
 
+    self->chains.partitions = enable;
+
     Py_RETURN_NONE;
 }
 
@@ -295,12 +988,16 @@ static PyObject *Probe_set_partitions_flags (ProbeObject *self, PyObject *args,
         return NULL;
     }
 
+    probe_lock (self);
     ret = blkid_probe_set_partitions_flags (self->probe, flags);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to set superblock flags");
         return NULL;
     }
 
+    self->chains.partitions_flags = flags;
+
     Py_RETURN_NONE;
 }
 
@@ -323,6 +1020,9 @@ static PyObject *Probe_filter_partitions_type (ProbeObject *self, PyObject *args
         return NULL;
     }
 
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
     if (!PySequence_Check (pynames)) {
         PyErr_SetString (PyExc_AttributeError, "Failed to parse list of names for filter");
         return NULL;
@@ -347,7 +1047,14 @@ static PyObject *Probe_filter_partitions_type (ProbeObject *self, PyObject *args
     }
     names[len] = NULL;
 
-    ret = blkid_probe_filter_partitions_type (self->probe, flag, names);
+    if (probe_lock_results (self) < 0) {
+        for (Py_ssize_t i = 0; i < len; i++)
+            free (names[i]);
+        free (names);
+        return NULL;
+    }
+    ret = blkid_probe_filter_partitions_type (self->probe, flag, names);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to set probe filter");
         for (Py_ssize_t i = 0; i < len; i++)
@@ -360,6 +1067,8 @@ static PyObject *Probe_filter_partitions_type (ProbeObject *self, PyObject *args
             free(names[i]);
     free (names);
 
+    self->filters |= PROBE_FILTER_PARTITIONS;
+
     Py_RETURN_NONE;
 }
 
@@ -369,12 +1078,20 @@ PyDoc_STRVAR(Probe_invert_partitions_filter__doc__,
 static PyObject *Probe_invert_partitions_filter (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
     int ret = 0;
 
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    if (probe_lock_results (self) < 0)
+        return NULL;
     ret = blkid_probe_invert_partitions_filter (self->probe);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to invert superblock probing filter");
         return NULL;
     }
 
+    self->filters |= PROBE_FILTER_PARTITIONS;
+
     Py_RETURN_NONE;
 }
 
@@ -384,12 +1101,20 @@ PyDoc_STRVAR(Probe_reset_partitions_filter__doc__,
 static PyObject *Probe_reset_partitions_filter (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
     int ret = 0;
 
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    if (probe_lock_results (self) < 0)
+        return NULL;
     ret = blkid_probe_reset_partitions_filter (self->probe);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to reset superblock probing filter");
         return NULL;
     }
 
+    self->filters &= ~PROBE_FILTER_PARTITIONS;
+
     Py_RETURN_NONE;
 }
 
@@ -405,12 +1130,16 @@ static PyObject *Probe_enable_topology (ProbeObject *self, PyObject *args, PyObj
         return NULL;
     }
 
+    probe_lock (self);
     ret = blkid_probe_enable_topology (self->probe, enable);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_Format (PyExc_RuntimeError, "Failed to %s topology probing", enable ? "enable" : "disable");
         return NULL;
     }
 
+    self->chains.topology = enable;
+
     Py_RETURN_NONE;
 }
 
@@ -422,18 +1151,129 @@ static PyObject *Probe_lookup_value (ProbeObject *self, PyObject *args, PyObject
     char *kwlist[] = { "name", NULL };
     char *name = NULL;
     const char *value = NULL;
+    PyObject *py_value = NULL;
 
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &name)) {
         return NULL;
     }
 
-    ret = blkid_probe_lookup_value (self->probe, name, &value, NULL);
+    probe_lock (self);
+
+    ret = probe_lookup_value (self, name, &value, NULL);
     if (ret != 0) {
+        probe_unlock (self);
         PyErr_Format (PyExc_RuntimeError, "Failed to lookup '%s'", name);
         return NULL;
     }
 
-    return PyBytes_FromString (value);
+    py_value = PyBytes_FromString (value);
+    probe_unlock (self);
+
+    return py_value;
+}
+
+/* Exporter of a single value buffer, keeps the probe alive and counts the exports.
+ * The only export is the memoryview created by lookup_raw() with the probe lock held,
+ * so re-probing (which checks the exports with the lock held) can't miss it. */
+typedef struct {
+    PyObject_HEAD
+    ProbeObject *probe;
+    const char *data;
+    size_t len;
+    bool exported;
+} ProbeValueBufferObject;
+
+static void ProbeValueBuffer_dealloc (ProbeValueBufferObject *self) {
+    Py_XDECREF (self->probe);
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static int ProbeValueBuffer_getbuffer (ProbeValueBufferObject *self, Py_buffer *view, int flags) {
+    if (self->exported) {
+        PyErr_SetString (PyExc_BufferError, "Probe value can be exported only once, use lookup_raw()");
+        return -1;
+    }
+
+    if (PyBuffer_FillInfo (view, (PyObject *) self, (void *) self->data, self->len, 1, flags) < 0)
+        return -1;
+
+    self->exported = true;
+    __atomic_add_fetch (&(self->probe->exports), 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* can be called without the probe lock, fewer exports never hurt a check in progress */
+static void ProbeValueBuffer_releasebuffer (ProbeValueBufferObject *self, Py_buffer *view UNUSED) {
+    __atomic_sub_fetch (&(self->probe->exports), 1, __ATOMIC_RELEASE);
+}
+
+static PyBufferProcs ProbeValueBuffer_as_buffer = {
+    .bf_getbuffer = (getbufferproc) ProbeValueBuffer_getbuffer,
+    .bf_releasebuffer = (releasebufferproc) ProbeValueBuffer_releasebuffer,
+};
+
+PyTypeObject ProbeValueBufferType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid._ProbeValueBuffer",
+    .tp_basicsize = sizeof (ProbeValueBufferObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) ProbeValueBuffer_dealloc,
+    .tp_as_buffer = &ProbeValueBuffer_as_buffer,
+};
+
+PyDoc_STRVAR(Probe_lookup_raw__doc__,
+"lookup_raw (name)\n\n"
+"Returns a read-only memoryview of the raw value 'name' without copying it. The length is the "
+"length reported by libblkid, so binary values (e.g. UUID_RAW or SBMAGIC) are not truncated "
+"at the first NUL byte and string values include the terminating NUL byte.\n"
+"The view points to libblkid memory: while any view exists, calls that would change the "
+"probing results (probing, filters, changing the device...) raise BufferError.");
+static PyObject *Probe_lookup_raw (ProbeObject *self, PyObject *args, PyObject *kwargs) {
+    int ret = 0;
+    char *kwlist[] = { "name", NULL };
+    char *name = NULL;
+    const char *value = NULL;
+    size_t len = 0;
+    ProbeValueBufferObject *buffer = NULL;
+    PyObject *view = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &name)) {
+        return NULL;
+    }
+
+    if (self->pending > 0) {
+        PyErr_SetString (PyExc_BufferError, "Asynchronous probing in progress");
+        return NULL;
+    }
+
+    /* the view is created before the lock is released, so no other thread can
+     * re-probe between the lookup and the export */
+    probe_lock (self);
+    ret = probe_lookup_value (self, name, &value, &len);
+    if (ret != 0) {
+        probe_unlock (self);
+        PyErr_Format (PyExc_RuntimeError, "Failed to lookup '%s'", name);
+        return NULL;
+    }
+
+    buffer = PyObject_New (ProbeValueBufferObject, &ProbeValueBufferType);
+    if (!buffer) {
+        probe_unlock (self);
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new value buffer object");
+        return NULL;
+    }
+    Py_INCREF (self);
+    buffer->probe = self;
+    buffer->data = value;
+    buffer->len = len;
+    buffer->exported = false;
+
+    view = PyMemoryView_FromObject ((PyObject *) buffer);
+    probe_unlock (self);
+    Py_DECREF (buffer);
+
+    return view;
 }
 
 PyDoc_STRVAR(Probe_do_safeprobe__doc__,
@@ -444,28 +1284,68 @@ PyDoc_STRVAR(Probe_do_safeprobe__doc__,
 "Note about superblocks chain -- the function does not check for filesystems when a RAID signature is detected.\n"
 "The function also does not check for collision between RAIDs. The first detected RAID is returned.\n"
 "The function checks for collision between partition table and RAID signature -- it's recommended to "
-"enable partitions chain together with superblocks chain.\n");
+"enable partitions chain together with superblocks chain.\n"
+"With blkid.enable_probe_memo() the results for an unchanged block device are returned from "
+"memory without any I/O, see its documentation for details.\n");
 static PyObject *Probe_do_safeprobe (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
     int ret = 0;
+    int memoize = 0;
+    PyObject *key = NULL;
+    PyObject *generation = NULL;
+    ProbeValues *values = NULL;
 
     if (self->fd < 0) {
         PyErr_SetString (PyExc_ValueError, "No device set");
         return NULL;
     }
 
-    if (self->topology) {
-        Py_DECREF (self->topology);
-        self->topology = NULL;
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    if (probe_memo) {
+        memoize = probe_memo_key (self, &key, &generation);
+        if (memoize < 0)
+            return NULL;
     }
 
-    if (self->partlist) {
-        Py_DECREF (self->partlist);
-        self->partlist = NULL;
+    if (probe_lock_results (self) < 0) {
+        Py_XDECREF (key);
+        Py_XDECREF (generation);
+        return NULL;
+    }
+
+    probe_invalidate (self);
+
+    if (memoize > 0) {
+        ret = probe_memo_lookup (self, key, generation);
+        if (ret != -2) {
+            probe_unlock (self);
+            Py_DECREF (key);
+            Py_DECREF (generation);
+            if (ret < 0)
+                return NULL;
+            return PyBool_FromLong (ret == 0);
+        }
+    }
+
+    /* the values for the memo are collected before other threads can change them */
+    Py_BEGIN_ALLOW_THREADS
+    ret = probe_run (self, blkid_do_safeprobe, "do_safeprobe");
+    if (memoize > 0 && ret >= 0)
+        values = _Probe_values_collect (self->probe);
+    PyThread_release_lock (self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (memoize > 0) {
+        if (ret >= 0 && probe_memo_store (key, generation, ret, values) < 0)
+            ret = -1;
+        Py_DECREF (key);
+        Py_DECREF (generation);
     }
 
-    ret = blkid_do_safeprobe (self->probe);
     if (ret < 0) {
-        PyErr_SetString (PyExc_RuntimeError, "Failed to safeprobe the device");
+        if (!PyErr_Occurred ())
+            PyErr_SetString (PyExc_RuntimeError, "Failed to safeprobe the device");
         return NULL;
     }
 
@@ -488,17 +1368,15 @@ static PyObject *Probe_do_fullprobe (ProbeObject *self, PyObject *Py_UNUSED (ign
         return NULL;
     }
 
-    if (self->topology) {
-        Py_DECREF (self->topology);
-        self->topology = NULL;
-    }
+    if (probe_lock_results (self) < 0)
+        return NULL;
 
-    if (self->partlist) {
-        Py_DECREF (self->partlist);
-        self->partlist = NULL;
-    }
+    probe_invalidate (self);
 
-    ret = blkid_do_fullprobe (self->probe);
+    Py_BEGIN_ALLOW_THREADS
+    ret = probe_run (self, blkid_do_fullprobe, "do_fullprobe");
+    PyThread_release_lock (self->lock);
+    Py_END_ALLOW_THREADS
     if (ret < 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to fullprobe the device");
         return NULL;
@@ -525,17 +1403,15 @@ static PyObject *Probe_do_probe (ProbeObject *self, PyObject *Py_UNUSED (ignored
         return NULL;
     }
 
-    if (self->topology) {
-        Py_DECREF (self->topology);
-        self->topology = NULL;
-    }
+    if (probe_lock_results (self) < 0)
+        return NULL;
 
-    if (self->partlist) {
-        Py_DECREF (self->partlist);
-        self->partlist = NULL;
-    }
+    probe_invalidate (self);
 
-    ret = blkid_do_probe (self->probe);
+    Py_BEGIN_ALLOW_THREADS
+    ret = probe_run (self, blkid_do_probe, "do_probe");
+    PyThread_release_lock (self->lock);
+    Py_END_ALLOW_THREADS
     if (ret < 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to probe the device");
         return NULL;
@@ -547,6 +1423,530 @@ static PyObject *Probe_do_probe (ProbeObject *self, PyObject *Py_UNUSED (ignored
         Py_RETURN_FALSE;
 }
 
+typedef struct {
+    PyObject_HEAD
+    ProbeObject *probe;
+    bool started;
+    bool finished;
+} ProbeIteratorObject;
+
+static void ProbeIterator_dealloc (ProbeIteratorObject *self) {
+    Py_XDECREF (self->probe);
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static PyObject *ProbeIterator_next (ProbeIteratorObject *self) {
+    ProbeObject *probe = self->probe;
+    ProbeValues *values = NULL;
+    bool reset = !self->started;
+    int ret = 0;
+
+    if (self->finished)
+        return NULL;
+
+    if (probe->fd < 0) {
+        PyErr_SetString (PyExc_ValueError, "No device set");
+        return NULL;
+    }
+
+    if (probe_lock_results (probe) < 0)
+        return NULL;
+
+    probe_invalidate (probe);
+    self->started = true;
+
+    /* probe and copy the values in one go, other threads can't change the results in between */
+    Py_BEGIN_ALLOW_THREADS
+    if (reset)
+        blkid_reset_probe (probe->probe);
+    ret = probe_run (probe, blkid_do_probe, "iter_probe");
+    if (ret == 0)
+        values = _Probe_values_collect (probe->probe);
+    PyThread_release_lock (probe->lock);
+    Py_END_ALLOW_THREADS
+
+    if (ret < 0) {
+        self->finished = true;
+        PyErr_SetString (PyExc_RuntimeError, "Failed to probe the device");
+        return NULL;
+    } else if (ret == 1) {
+        self->finished = true;
+        return NULL;
+    }
+
+    if (!values) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to get probe results");
+        return NULL;
+    }
+
+    return _ProbeResult_new (values);
+}
+
+PyTypeObject ProbeIteratorType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid._ProbeIterator",
+    .tp_basicsize = sizeof (ProbeIteratorObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) ProbeIterator_dealloc,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) ProbeIterator_next,
+};
+
+PyDoc_STRVAR(Probe_iter_probe__doc__,
+"iter_probe ()\n\n"
+"Returns an iterator calling do_probe() in a loop and yielding a blkid.ProbeResult snapshot "
+"for every detected signature from all enabled chains.\n"
+"The probing is reset before the first step, so all signatures on the device are returned. "
+"Note that the probe itself is changed by the iteration the same way as with do_probe().");
+static PyObject *Probe_iter_probe (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    ProbeIteratorObject *iter = NULL;
+
+    if (self->fd < 0) {
+        PyErr_SetString (PyExc_ValueError, "No device set");
+        return NULL;
+    }
+
+    iter = PyObject_New (ProbeIteratorObject, &ProbeIteratorType);
+    if (!iter) {
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new probe iterator");
+        return NULL;
+    }
+
+    Py_INCREF (self);
+    iter->probe = self;
+    iter->started = false;
+    iter->finished = false;
+
+    return (PyObject *) iter;
+}
+
+/* Offsets are handed out to the workers from a shared counter, every worker
+ * probes with its own libblkid probe and its own open file description of the
+ * device (libblkid seeks before reading, so the file offset can't be shared). */
+typedef struct {
+    long long start;
+    long long step;
+    long long count;
+    long long next;
+} ScanOffsetsRange;
+
+typedef struct {
+    long long offset;
+    char type[32];
+    char uuid[64];
+    bool has_uuid;
+} ScanOffsetsHit;
+
+typedef struct {
+    Job job;
+    ScanOffsetsRange *range;
+    int fd;
+    const char *error;
+    size_t nhits;
+    size_t allocated;
+    ScanOffsetsHit *hits;
+} ScanOffsetsJob;
+
+static int scan_offsets_add_hit (ScanOffsetsJob *sjob, blkid_probe probe, long long offset) {
+    ScanOffsetsHit *hits = NULL;
+    ScanOffsetsHit *hit = NULL;
+    const char *value = NULL;
+
+    if (blkid_probe_lookup_value (probe, "TYPE", &value, NULL) != 0)
+        return 0;
+
+    if (sjob->nhits == sjob->allocated) {
+        sjob->allocated = sjob->allocated ? sjob->allocated * 2 : 16;
+        hits = realloc (sjob->hits, sjob->allocated * sizeof (ScanOffsetsHit));
+        if (!hits)
+            return -1;
+        sjob->hits = hits;
+    }
+
+    hit = &(sjob->hits[sjob->nhits++]);
+    hit->offset = offset;
+    snprintf (hit->type, sizeof (hit->type), "%s", value);
+    hit->has_uuid = blkid_probe_lookup_value (probe, "UUID", &value, NULL) == 0;
+    if (hit->has_uuid)
+        snprintf (hit->uuid, sizeof (hit->uuid), "%s", value);
+
+    return 0;
+}
+
+static void scan_offsets_job_run (Job *job) {
+    ScanOffsetsJob *sjob = (ScanOffsetsJob *) job;
+    ScanOffsetsRange *range = sjob->range;
+    blkid_probe probe = NULL;
+    long long i = 0;
+    long long offset = 0;
+
+    probe = blkid_new_probe ();
+    if (!probe) {
+        sjob->error = "Failed to create a new probe";
+        return;
+    }
+
+    blkid_probe_enable_superblocks (probe, 1);
+    blkid_probe_set_superblocks_flags (probe, BLKID_SUBLKS_TYPE | BLKID_SUBLKS_UUID);
+
+    while ((i = __atomic_fetch_add (&(range->next), 1, __ATOMIC_RELAXED)) < range->count) {
+        offset = range->start + i * range->step;
+
+        /* a fresh probing area starting at the offset, so nothing read for the
+         * previous offset is visible to the superblock probers */
+        if (blkid_probe_set_device (probe, sjob->fd, offset, 0) != 0)
+            continue;
+
+        if (blkid_do_safeprobe (probe) != 0)
+            continue;
+
+        if (scan_offsets_add_hit (sjob, probe, offset) < 0) {
+            sjob->error = "Failed to allocate memory for the scan results";
+            break;
+        }
+    }
+
+    blkid_free_probe (probe);
+}
+
+static void scan_offsets_job_free (Job *job) {
+    ScanOffsetsJob *sjob = (ScanOffsetsJob *) job;
+
+    if (sjob->fd >= 0)
+        close (sjob->fd);
+    free (sjob->hits);
+    free (sjob);
+}
+
+static int scan_offsets_hit_cmp (const void *a, const void *b) {
+    const ScanOffsetsHit *hit_a = (const ScanOffsetsHit *) a;
+    const ScanOffsetsHit *hit_b = (const ScanOffsetsHit *) b;
+
+    return (hit_a->offset > hit_b->offset) - (hit_a->offset < hit_b->offset);
+}
+
+/* merges hits from all finished jobs */
+static PyObject *scan_offsets_result (ScanOffsetsJob **jobs, int njobs) {
+    ScanOffsetsHit *hits = NULL;
+    PyObject *result = NULL;
+    PyObject *item = NULL;
+    size_t nhits = 0;
+    size_t n = 0;
+
+    for (int i = 0; i < njobs; i++) {
+        if (jobs[i]->error) {
+            PyErr_SetString (PyExc_RuntimeError, jobs[i]->error);
+            return NULL;
+        }
+        nhits += jobs[i]->nhits;
+    }
+
+    hits = malloc ((nhits ? nhits : 1) * sizeof (ScanOffsetsHit));
+    if (!hits)
+        return PyErr_NoMemory ();
+
+    for (int i = 0; i < njobs; i++) {
+        if (jobs[i]->nhits > 0)
+            memcpy (hits + n, jobs[i]->hits, jobs[i]->nhits * sizeof (ScanOffsetsHit));
+        n += jobs[i]->nhits;
+    }
+    qsort (hits, nhits, sizeof (ScanOffsetsHit), scan_offsets_hit_cmp);
+
+    result = PyList_New (nhits);
+    if (!result) {
+        free (hits);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < nhits; i++) {
+        item = Py_BuildValue ("(Lsz)", hits[i].offset, hits[i].type, hits[i].has_uuid ? hits[i].uuid : NULL);
+        if (!item) {
+            free (hits);
+            Py_DECREF (result);
+            return NULL;
+        }
+        PyList_SET_ITEM (result, i, item);
+    }
+
+    free (hits);
+
+    return result;
+}
+
+PyDoc_STRVAR(Probe_scan_offsets__doc__,
+"scan_offsets (start, end, step, workers=0)\n\n"
+"Searches the device for filesystems and other superblocks starting at unknown offsets. "
+"Every offset from 'start' to 'end' (exclusive, 0 means the end of the device) with 'step' "
+"is probed as if it was the beginning of the device, in parallel using native worker threads "
+"running without the GIL.\n"
+"Every worker opens the device from the probe once and the offsets are probed with "
+"separate probing areas, so filters and results of this probe are neither used nor changed.\n\n"
+"Returns a list of (offset, type, uuid) tuples sorted by offset, 'uuid' is None for "
+"superblocks without UUID.\n"
+"'workers' is the number of worker threads, by default one thread per online CPU is used.");
+static PyObject *Probe_scan_offsets (ProbeObject *self, PyObject *args, PyObject *kwargs) {
+    long long start = 0;
+    long long end = 0;
+    long long step = 0;
+    int workers = 0;
+    char *kwlist[] = { "start", "end", "step", "workers", NULL };
+    ScanOffsetsRange range = { 0 };
+    ScanOffsetsJob **jobs = NULL;
+    ScanOffsetsJob *job = NULL;
+    WorkerPool *pool = NULL;
+    JobQueue done;
+    PyObject *result = NULL;
+    char path[32];
+    int finished = 0;
+    int err = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "LLL|i", kwlist, &start, &end, &step, &workers))
+        return NULL;
+
+    if (start < 0 || end < 0) {
+        PyErr_SetString (PyExc_ValueError, "Offsets must not be negative");
+        return NULL;
+    }
+
+    if (step <= 0) {
+        PyErr_SetString (PyExc_ValueError, "Step must be positive");
+        return NULL;
+    }
+
+    probe_lock (self);
+
+    if (self->fd < 0) {
+        probe_unlock (self);
+        PyErr_SetString (PyExc_ValueError, "No device set");
+        return NULL;
+    }
+
+    if (end == 0) {
+        end = blkid_get_dev_size (self->fd);
+        if (end < 0) {
+            probe_unlock (self);
+            PyErr_SetString (PyExc_RuntimeError, "Failed to get size of the device");
+            return NULL;
+        }
+    }
+
+    range.start = start;
+    range.step = step;
+    range.count = end > start ? (end - start - 1) / step + 1 : 0;
+    range.next = 0;
+
+    if (range.count == 0) {
+        probe_unlock (self);
+        return PyList_New (0);
+    }
+
+    if (workers < 1)
+        workers = worker_pool_default_size ();
+    if (workers > range.count)
+        workers = (int) range.count;
+
+    jobs = calloc (workers, sizeof (ScanOffsetsJob *));
+    if (!jobs) {
+        probe_unlock (self);
+        return PyErr_NoMemory ();
+    }
+
+    /* opened while holding the lock, the workers never touch the probe itself */
+    snprintf (path, sizeof (path), "/proc/self/fd/%d", self->fd);
+    for (int i = 0; i < workers; i++) {
+        jobs[i] = calloc (1, sizeof (ScanOffsetsJob));
+        if (!jobs[i]) {
+            err = ENOMEM;
+            break;
+        }
+
+        jobs[i]->job.run = scan_offsets_job_run;
+        jobs[i]->job.free = scan_offsets_job_free;
+        jobs[i]->range = &range;
+        jobs[i]->fd = open (path, O_RDONLY|O_CLOEXEC);
+        if (jobs[i]->fd < 0) {
+            err = errno;
+            break;
+        }
+    }
+
+    probe_unlock (self);
+
+    if (err) {
+        errno = err;
+        PyErr_SetFromErrno (PyExc_OSError);
+        goto error;
+    }
+
+    pool = worker_pool_new (workers);
+    if (!pool) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to start worker threads");
+        goto error;
+    }
+
+    job_queue_init (&done);
+    for (int i = 0; i < workers; i++)
+        worker_pool_submit (pool, (Job *) jobs[i], &done);
+
+    /* jobs are owned by the pool and the done queue now, 'jobs' is refilled
+     * with the finished ones */
+    while (finished < workers) {
+        Py_BEGIN_ALLOW_THREADS
+        job = (ScanOffsetsJob *) job_queue_pop (&done, 100);
+        Py_END_ALLOW_THREADS
+
+        if (job) {
+            jobs[finished++] = job;
+            continue;
+        }
+
+        if (PyErr_CheckSignals () < 0) {
+            /* no more offsets for the running workers, jobs that didn't start are
+             * dropped and the ones that did are freed with the done queue */
+            __atomic_store_n (&(range.next), range.count, __ATOMIC_RELAXED);
+            Py_BEGIN_ALLOW_THREADS
+            worker_pool_free (pool);
+            Py_END_ALLOW_THREADS
+            job_queue_destroy (&done);
+            workers = finished;
+            goto error;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    worker_pool_free (pool);
+    Py_END_ALLOW_THREADS
+    job_queue_destroy (&done);
+
+    result = scan_offsets_result (jobs, workers);
+
+    for (int i = 0; i < workers; i++)
+        scan_offsets_job_free ((Job *) jobs[i]);
+    free (jobs);
+
+    return result;
+
+error:
+    for (int i = 0; i < workers; i++) {
+        if (jobs[i])
+            scan_offsets_job_free ((Job *) jobs[i]);
+    }
+    free (jobs);
+
+    return NULL;
+}
+
+typedef struct {
+    AsyncJob async;
+    ProbeObject *probe;
+    int (*func) (blkid_probe);
+    const char *call;
+    const char *error;
+    int ret;
+    bool exported;
+} ProbeAsyncJob;
+
+static void probe_async_job_run (Job *job) {
+    ProbeAsyncJob *pjob = (ProbeAsyncJob *) job;
+    ProbeObject *probe = pjob->probe;
+
+    /* lookup_raw() refuses to create views while the probing is pending, but one
+     * could have been created just before it was submitted */
+    PyThread_acquire_lock (probe->lock, WAIT_LOCK);
+    pjob->exported = __atomic_load_n (&(probe->exports), __ATOMIC_ACQUIRE) > 0;
+    if (!pjob->exported)
+        pjob->ret = probe_run (probe, pjob->func, pjob->call);
+    PyThread_release_lock (probe->lock);
+}
+
+static PyObject *probe_async_job_complete (AsyncJob *job) {
+    ProbeAsyncJob *pjob = (ProbeAsyncJob *) job;
+
+    /* topology or partitions could have been read while the probing was queued */
+    probe_invalidate (pjob->probe);
+    pjob->probe->pending--;
+
+    if (pjob->exported) {
+        PyErr_SetString (PyExc_BufferError, PROBE_EXPORTS_ERROR);
+        return NULL;
+    }
+
+    if (pjob->ret < 0) {
+        PyErr_SetString (PyExc_RuntimeError, pjob->error);
+        return NULL;
+    }
+
+    return PyBool_FromLong (pjob->ret == 0);
+}
+
+static void probe_async_job_free (Job *job) {
+    ProbeAsyncJob *pjob = (ProbeAsyncJob *) job;
+
+    _Async_job_clear ((AsyncJob *) job);
+    Py_XDECREF (pjob->probe);
+    free (pjob);
+}
+
+static PyObject *probe_submit_async (ProbeObject *self, int (*func) (blkid_probe), const char *call, const char *error) {
+    ProbeAsyncJob *job = NULL;
+    PyObject *future = NULL;
+
+    if (self->fd < 0) {
+        PyErr_SetString (PyExc_ValueError, "No device set");
+        return NULL;
+    }
+
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    probe_invalidate (self);
+
+    job = calloc (1, sizeof (ProbeAsyncJob));
+    if (!job)
+        return PyErr_NoMemory ();
+
+    job->async.job.run = probe_async_job_run;
+    job->async.job.free = probe_async_job_free;
+    job->async.complete = probe_async_job_complete;
+    Py_INCREF (self);
+    job->probe = self;
+    job->func = func;
+    job->call = call;
+    job->error = error;
+
+    future = _Async_submit ((AsyncJob *) job, true);
+    if (future)
+        self->pending++;
+
+    return future;
+}
+
+PyDoc_STRVAR(Probe_do_safeprobe_async__doc__,
+"do_safeprobe_async ()\n\n"
+"Asynchronous variant of do_safeprobe(), must be called from a running asyncio event loop.\n"
+"Returns a future resolved with True on success, False if nothing is detected. The probing "
+"runs on a shared native worker pool which notifies the event loop when it is done.");
+static PyObject *Probe_do_safeprobe_async (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    return probe_submit_async (self, blkid_do_safeprobe, "do_safeprobe_async", "Failed to safeprobe the device");
+}
+
+PyDoc_STRVAR(Probe_do_fullprobe_async__doc__,
+"do_fullprobe_async ()\n\n"
+"Asynchronous variant of do_fullprobe(), must be called from a running asyncio event loop.\n"
+"Returns a future resolved with True on success, False if nothing is detected.");
+static PyObject *Probe_do_fullprobe_async (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    return probe_submit_async (self, blkid_do_fullprobe, "do_fullprobe_async", "Failed to fullprobe the device");
+}
+
+PyDoc_STRVAR(Probe_do_probe_async__doc__,
+"do_probe_async ()\n\n"
+"Asynchronous variant of do_probe(), must be called from a running asyncio event loop.\n"
+"Returns a future resolved with True on success, False if nothing is detected.");
+static PyObject *Probe_do_probe_async (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    return probe_submit_async (self, blkid_do_probe, "do_probe_async", "Failed to probe the device");
+}
+
 PyDoc_STRVAR(Probe_step_back__doc__,
 "step_back ()\n\n"
 "This function move pointer to the probing chain one step back -- it means that the previously "
@@ -558,7 +1958,15 @@ PyDoc_STRVAR(Probe_step_back__doc__,
 static PyObject *Probe_step_back (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
     int ret = 0;
 
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    Py_CLEAR (self->memo);
+
+    if (probe_lock_results (self) < 0)
+        return NULL;
     ret = blkid_probe_step_back (self->probe);
+    probe_unlock (self);
     if (ret < 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to step back the probe");
         return NULL;
@@ -575,7 +1983,9 @@ PyDoc_STRVAR(Probe_reset_buffers__doc__,
 static PyObject *Probe_reset_buffers (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
     int ret = 0;
 
+    probe_lock (self);
     ret = blkid_probe_reset_buffers (self->probe);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to reset buffers");
         return NULL;
@@ -590,17 +2000,14 @@ PyDoc_STRVAR(Probe_reset_probe__doc__,
 "Zeroize probing results and resets the current probing (this has impact to do_probe() only).\n"
 "This function does not touch probing filters and keeps assigned device.");
 static PyObject *Probe_reset_probe (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-    blkid_reset_probe (self->probe);
-
-    if (self->topology) {
-        Py_DECREF (self->topology);
-        self->topology = NULL;
-    }
+    if (probe_check_exports (self) < 0)
+        return NULL;
 
-    if (self->partlist) {
-        Py_DECREF (self->partlist);
-        self->partlist = NULL;
-    }
+    if (probe_lock_results (self) < 0)
+        return NULL;
+    blkid_reset_probe (self->probe);
+    probe_invalidate (self);
+    probe_unlock (self);
 
     Py_RETURN_NONE;
 }
@@ -623,7 +2030,9 @@ static PyObject *Probe_hide_range (ProbeObject *self, PyObject *args, PyObject *
         return NULL;
     }
 
+    probe_lock (self);
     ret = blkid_probe_hide_range (self->probe, offset, length);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to hide range");
         return NULL;
@@ -640,8 +2049,24 @@ PyDoc_STRVAR(Probe_wipe_all__doc__,
 "All other necessary configurations will be enabled automatically.");
 static PyObject *Probe_wipe_all (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
     int ret = 0;
+    uint64_t diskseq = 0;
 
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    if (probe_lock_results (self) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
     ret = blkid_wipe_all (self->probe);
+    diskseq = probe_diskseq (self->fd);
+    PyThread_release_lock (self->lock);
+    Py_END_ALLOW_THREADS
+
+    /* even a failed wipe might have erased some of the memoized signatures */
+    if (_Probe_memo_forget (diskseq) < 0)
+        return NULL;
+
     if (ret < 0) {
         PyErr_SetString (PyExc_RuntimeError, "Failed to probe the device");
         return NULL;
@@ -663,71 +2088,496 @@ static PyObject *Probe_do_wipe (ProbeObject *self, PyObject *args, PyObject *kwa
     int ret = 0;
     char *kwlist[] = { "dryrun", NULL };
     bool dryrun = false;
+    uint64_t diskseq = 0;
 
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|p", kwlist, &dryrun)) {
         return NULL;
     }
 
-    ret = blkid_do_wipe (self->probe, dryrun);
-    if (ret != 0) {
-        PyErr_Format (PyExc_RuntimeError, "Failed to wipe the device: %s", strerror (errno));
-        return NULL;
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    if (probe_lock_results (self) < 0)
+        return NULL;
+
+    Py_BEGIN_ALLOW_THREADS
+    ret = blkid_do_wipe (self->probe, dryrun);
+    if (!dryrun)
+        diskseq = probe_diskseq (self->fd);
+    PyThread_release_lock (self->lock);
+    Py_END_ALLOW_THREADS
+
+    if (_Probe_memo_forget (diskseq) < 0)
+        return NULL;
+    if (ret != 0) {
+        PyErr_Format (PyExc_RuntimeError, "Failed to wipe the device: %s", strerror (errno));
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* Copies all values from the probe into one allocation, doesn't need the GIL */
+ProbeValues *_Probe_values_collect (blkid_probe probe) {
+    ProbeValues *values = NULL;
+    int nvalues = 0;
+    size_t size = 0;
+    const char *name = NULL;
+    const char *data = NULL;
+    size_t len = 0;
+    char *strings = NULL;
+
+    nvalues = blkid_probe_numof_values (probe);
+    if (nvalues < 0)
+        return NULL;
+
+    size = sizeof (ProbeValues) + sizeof (ProbeValue) * nvalues;
+    for (int i = 0; i < nvalues; i++) {
+        if (blkid_probe_get_value (probe, i, &name, &data, &len) < 0)
+            return NULL;
+        /* data is NUL-terminated even for binary values */
+        size += strlen (name) + 1 + len + 1;
+    }
+
+    values = malloc (size);
+    if (!values)
+        return NULL;
+
+    values->nvalues = nvalues;
+    strings = (char *) &(values->values[nvalues]);
+
+    for (int i = 0; i < nvalues; i++) {
+        blkid_probe_get_value (probe, i, &name, &data, &len);
+
+        values->values[i].name = strings;
+        strcpy (strings, name);
+        strings += strlen (name) + 1;
+
+        values->values[i].data = strings;
+        values->values[i].len = len;
+        memcpy (strings, data, len);
+        strings[len] = '\0';
+        strings += len + 1;
+    }
+
+    return values;
+}
+
+PyObject *_Probe_values_to_dict (const ProbeValues *values) {
+    PyObject *dict = NULL;
+    PyObject *py_value = NULL;
+
+    dict = PyDict_New ();
+    if (!dict) {
+        PyErr_NoMemory ();
+        return NULL;
+    }
+
+    for (int i = 0; i < values->nvalues; i++) {
+        py_value = PyUnicode_FromString (values->values[i].data);
+        if (py_value == NULL) {
+            PyErr_Clear ();
+            Py_INCREF (Py_None);
+            py_value = Py_None;
+        }
+
+        PyDict_SetItemString (dict, values->values[i].name, py_value);
+        Py_DECREF (py_value);
+    }
+
+    return dict;
+}
+
+/* Runs the do_safeprobe() pipeline for the 'path' with a private probe without
+ * touching any Python objects, so it can run without the GIL.
+ * Returns 0 on success, 1 if nothing was detected and -1 on error with 'error'
+ * describing the failed step and errno set if it was caused by a system call. */
+int _Probe_probe_path (const char *path, const ProbeChains *chains, ProbeValues **values, const char **error) {
+    blkid_probe probe = NULL;
+    int fd = -1;
+    int ret = 0;
+    int saved_errno = 0;
+
+    *values = NULL;
+    *error = NULL;
+
+    fd = open (path, O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+        *error = "Failed to open device";
+        return -1;
+    }
+
+    probe = blkid_new_probe ();
+    if (!probe) {
+        close (fd);
+        *error = "Failed to create new Probe";
+        errno = ENOMEM;
+        return -1;
+    }
+
+    errno = 0;
+    if (blkid_probe_set_device (probe, fd, 0, 0) != 0) {
+        *error = "Failed to set device";
+        ret = -1;
+        goto out;
+    }
+
+    if (blkid_probe_enable_superblocks (probe, chains->superblocks) != 0 ||
+        blkid_probe_enable_partitions (probe, chains->partitions) != 0 ||
+        blkid_probe_enable_topology (probe, chains->topology) != 0) {
+        *error = "Failed to enable probing chains";
+        ret = -1;
+        goto out;
+    }
+
+    if ((chains->superblocks && blkid_probe_set_superblocks_flags (probe, chains->superblocks_flags) != 0) ||
+        (chains->partitions && blkid_probe_set_partitions_flags (probe, chains->partitions_flags) != 0)) {
+        *error = "Failed to set probing flags";
+        ret = -1;
+        goto out;
+    }
+
+    errno = 0;
+    ret = blkid_do_safeprobe (probe);
+    if (ret < 0) {
+        *error = "Failed to safeprobe the device";
+        ret = -1;
+        goto out;
+    }
+
+    *values = _Probe_values_collect (probe);
+    if (!*values) {
+        *error = "Failed to get probe results";
+        ret = -1;
+    }
+
+out:
+    saved_errno = errno;
+    blkid_free_probe (probe);
+    close (fd);
+    errno = saved_errno;
+
+    return ret;
+}
+
+/* adds the current signature from 'probe' to 'signatures', returns -1 on allocation failure */
+static int probe_signature_collect (blkid_probe probe, ProbeSignatures **signatures) {
+    ProbeSignatures *sigs = *signatures;
+    ProbeSignature *sig = NULL;
+    const char *offset = NULL;
+    const char *magic = NULL;
+    const char *type = NULL;
+    const char *usage = NULL;
+    size_t len = 0;
+
+    if (blkid_probe_lookup_value (probe, "SBMAGIC_OFFSET", &offset, NULL) == 0 &&
+        blkid_probe_lookup_value (probe, "SBMAGIC", &magic, &len) == 0) {
+        blkid_probe_lookup_value (probe, "TYPE", &type, NULL);
+        blkid_probe_lookup_value (probe, "USAGE", &usage, NULL);
+    } else if (blkid_probe_lookup_value (probe, "PTMAGIC_OFFSET", &offset, NULL) == 0 &&
+               blkid_probe_lookup_value (probe, "PTMAGIC", &magic, &len) == 0) {
+        blkid_probe_lookup_value (probe, "PTTYPE", &type, NULL);
+        usage = "partition table";
+    } else
+        /* nothing to wipe */
+        return 0;
+
+    if (!sigs || sigs->nsignatures == sigs->allocated) {
+        int allocated = sigs ? sigs->allocated * 2 : 8;
+
+        sigs = realloc (sigs, sizeof (ProbeSignatures) + sizeof (ProbeSignature) * allocated);
+        if (!sigs)
+            return -1;
+        if (!*signatures)
+            sigs->nsignatures = 0;
+        sigs->allocated = allocated;
+        *signatures = sigs;
+    }
+
+    sig = &(sigs->signatures[sigs->nsignatures++]);
+    memset (sig, 0, sizeof (ProbeSignature));
+    sig->offset = strtoll (offset, NULL, 10);
+    sig->len = len;
+    memcpy (sig->magic, magic, len < sizeof (sig->magic) ? len : sizeof (sig->magic));
+    if (type)
+        snprintf (sig->type, sizeof (sig->type), "%s", type);
+    if (usage)
+        snprintf (sig->usage, sizeof (sig->usage), "%s", usage);
+
+    return 0;
+}
+
+typedef struct {
+    long long start;
+    long long end;
+} WipeRange;
+
+static int wipe_range_cmp (const void *a, const void *b) {
+    const WipeRange *ra = a;
+    const WipeRange *rb = b;
+
+    return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+/* zeroes the signatures from index 'first' on, overlapping and adjacent areas are merged
+ * into a single write */
+static int wipe_signatures (int fd, const ProbeSignatures *sigs, int first) {
+    WipeRange *ranges = NULL;
+    int nsignatures = 0;
+    int nranges = 0;
+    char *zeroes = NULL;
+    size_t zeroes_len = 0;
+    size_t len = 0;
+    ssize_t written = 0;
+    int ret = 0;
+
+    nsignatures = sigs->nsignatures - first;
+    ranges = malloc (sizeof (WipeRange) * nsignatures);
+    if (!ranges)
+        return -1;
+
+    for (int i = 0; i < nsignatures; i++) {
+        ranges[i].start = sigs->signatures[first + i].offset;
+        ranges[i].end = sigs->signatures[first + i].offset + sigs->signatures[first + i].len;
+    }
+    qsort (ranges, nsignatures, sizeof (WipeRange), wipe_range_cmp);
+
+    for (int i = 1; i < nsignatures; i++) {
+        if (ranges[i].start <= ranges[nranges].end) {
+            if (ranges[i].end > ranges[nranges].end)
+                ranges[nranges].end = ranges[i].end;
+        } else
+            ranges[++nranges] = ranges[i];
+    }
+    nranges++;
+
+    for (int i = 0; i < nranges && ret == 0; i++) {
+        len = ranges[i].end - ranges[i].start;
+        if (len > zeroes_len) {
+            free (zeroes);
+            zeroes = calloc (1, len);
+            if (!zeroes) {
+                ret = -1;
+                break;
+            }
+            zeroes_len = len;
+        }
+
+        for (size_t done = 0; done < len; done += written) {
+            written = pwrite (fd, zeroes, len - done, ranges[i].start + done);
+            if (written < 0 && errno == EINTR) {
+                written = 0;
+                continue;
+            }
+            if (written <= 0) {
+                ret = -1;
+                break;
+            }
+        }
     }
 
-    Py_RETURN_NONE;
+    free (zeroes);
+    free (ranges);
+
+    return ret;
 }
 
-static PyObject * probe_to_dict (ProbeObject *self) {
-    PyObject *dict = NULL;
+/* Collects all superblock and partition table signatures on 'path' and erases them
+ * (unless 'dryrun') until no signature is left, doesn't touch any Python objects so it can run without the GIL.
+ * 'diskseq' is set to the disk sequence number of the device if anything was written to it.
+ * Returns 0 on success and -1 on error with 'error' describing the failed step and
+ * errno set if it was caused by a system call. */
+int _Probe_wipe_path (const char *path, bool dryrun, ProbeSignatures **signatures, uint64_t *diskseq,
+                      const char **error) {
+    blkid_probe probe = NULL;
+    int fd = -1;
     int ret = 0;
-    int nvalues = 0;
-    const char *name = NULL;
-    const char *value = NULL;
-    PyObject *py_value = NULL;
-
-    ret = blkid_probe_numof_values (self->probe);
-    if (ret < 0) {
-        PyErr_SetString (PyExc_RuntimeError, "Failed to get probe results");
-        return NULL;
+    int saved_errno = 0;
+    int first = 0;
+    int flags = BLKID_SUBLKS_MAGIC|BLKID_SUBLKS_TYPE|BLKID_SUBLKS_USAGE;
+
+    *signatures = NULL;
+    *diskseq = 0;
+    *error = NULL;
+
+    /* O_EXCL makes opening a mounted or otherwise used block device fail */
+    fd = open (path, dryrun ? O_RDONLY|O_CLOEXEC : O_RDWR|O_EXCL|O_CLOEXEC);
+    if (fd == -1) {
+        *error = "Failed to open device";
+        return -1;
     }
-    nvalues = ret;
 
-    dict = PyDict_New ();
-    if (!dict) {
-        PyErr_NoMemory ();
-        return NULL;
+    probe = blkid_new_probe ();
+    if (!probe) {
+        close (fd);
+        *error = "Failed to create new Probe";
+        errno = ENOMEM;
+        return -1;
     }
 
-    for (int i = 0; i < nvalues; i++) {
-        ret = blkid_probe_get_value (self->probe, i, &name, &value, NULL);
+#ifdef HAVE_BLKID_2_24
+    flags |= BLKID_SUBLKS_BADCSUM;
+#endif
+
+    errno = 0;
+    if (blkid_probe_set_device (probe, fd, 0, 0) != 0 ||
+        blkid_probe_enable_superblocks (probe, true) != 0 ||
+        blkid_probe_set_superblocks_flags (probe, flags) != 0 ||
+        blkid_probe_enable_partitions (probe, true) != 0 ||
+        blkid_probe_set_partitions_flags (probe, BLKID_PARTS_MAGIC) != 0) {
+        *error = "Failed to set up the probe";
+        ret = -1;
+        goto out;
+    }
+
+    /* erasing a signature can uncover another one (e.g. the backup GPT header or the
+     * protective MBR), so the device is probed again until nothing new is found */
+    for (;;) {
+        first = *signatures ? (*signatures)->nsignatures : 0;
+
+        /* find everything first, the device is not modified while probing */
+        errno = 0;
+        while ((ret = blkid_do_probe (probe)) == 0) {
+            if (probe_signature_collect (probe, signatures) < 0) {
+                *error = "Failed to get probe results";
+                errno = ENOMEM;
+                ret = -1;
+                goto out;
+            }
+        }
+
         if (ret < 0) {
-            PyErr_SetString (PyExc_RuntimeError, "Failed to get probe results");
-            return NULL;
+            *error = "Failed to probe the device";
+            ret = -1;
+            goto out;
+        }
+        ret = 0;
+
+        /* a dry run can only report what is visible now */
+        if (dryrun || !*signatures || (*signatures)->nsignatures == first)
+            goto out;
+
+        /* a signature found again means the previous wipe didn't erase it */
+        for (int i = first; i < (*signatures)->nsignatures; i++) {
+            for (int j = 0; j < first; j++) {
+                if ((*signatures)->signatures[i].offset == (*signatures)->signatures[j].offset) {
+                    *error = "Failed to wipe the device";
+                    errno = EIO;
+                    ret = -1;
+                    goto out;
+                }
+            }
         }
 
-        py_value = PyUnicode_FromString (value);
-        if (py_value == NULL) {
+        if (*diskseq == 0)
+            *diskseq = probe_diskseq (fd);
+
+        if (wipe_signatures (fd, *signatures, first) < 0) {
+            *error = "Failed to wipe the device";
+            ret = -1;
+            goto out;
+        }
+
+        if (fsync (fd) != 0) {
+            *error = "Failed to flush the device";
+            ret = -1;
+            goto out;
+        }
+
+        /* setting the device again drops the data libblkid read before the wipe */
+        errno = 0;
+        if (blkid_probe_set_device (probe, fd, 0, 0) != 0) {
+            *error = "Failed to set up the probe";
+            ret = -1;
+            goto out;
+        }
+    }
+
+out:
+    saved_errno = errno;
+    blkid_free_probe (probe);
+    close (fd);
+    errno = saved_errno;
+
+    return ret;
+}
+
+PyDoc_STRVAR(Probe_tags__doc__,
+"tags ()\n\n"
+"Returns the well-known tags (TYPE, UUID, LABEL, PTTYPE, PTUUID, PARTUUID, USAGE and VERSION) "
+"from the current probing results as a blkid.ProbeTags struct sequence.\n"
+"Tags that were not detected or are not valid UTF-8 are None.");
+static PyObject *Probe_tags (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    PyObject *tags = NULL;
+    PyObject *value = NULL;
+    const char *data[PROBE_NTAGS];
+
+    tags = PyStructSequence_New (&ProbeTagsType);
+    if (!tags)
+        return NULL;
+
+    probe_lock (self);
+    for (int i = 0; i < PROBE_NTAGS; i++)
+        if (probe_lookup_value (self, probe_tags[i], &(data[i]), NULL) != 0)
+            data[i] = NULL;
+
+    for (int i = 0; i < PROBE_NTAGS; i++) {
+        value = data[i] ? PyUnicode_FromString (data[i]) : NULL;
+        if (!value) {
+            PyErr_Clear ();
             Py_INCREF (Py_None);
-            py_value = Py_None;
+            value = Py_None;
         }
+        PyStructSequence_SET_ITEM (tags, i, value);
+    }
+    probe_unlock (self);
 
-        PyDict_SetItemString (dict, name, py_value);
-        Py_DECREF (py_value);
+    return tags;
+}
+
+static PyObject *probe_result (ProbeObject *self) {
+    ProbeValues *values = NULL;
+
+    if (self->memo) {
+        Py_INCREF (self->memo);
+        return self->memo;
     }
 
-    return dict;
+    probe_lock (self);
+    values = _Probe_values_collect (self->probe);
+    probe_unlock (self);
+
+    if (!values) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to get probe results");
+        return NULL;
+    }
+
+    return _ProbeResult_new (values);
+}
+
+PyDoc_STRVAR(Probe_result__doc__,
+"result ()\n\n"
+"Returns a read-only snapshot of the current probing results as a blkid.ProbeResult mapping.\n"
+"The snapshot is not affected by further probing or by reusing the Probe for another device.");
+static PyObject *Probe_result (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    return probe_result (self);
 }
 
+static PyObject *ProbeResult_items (ProbeResultObject *self, PyObject *Py_UNUSED (ignored));
+static PyObject *ProbeResult_values (ProbeResultObject *self, PyObject *Py_UNUSED (ignored));
+static PyObject *ProbeResult_keys (ProbeResultObject *self, PyObject *Py_UNUSED (ignored));
+
 PyDoc_STRVAR(Probe_items__doc__,
 "items ()\n");
 static PyObject *Probe_items (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-    PyObject *dict = probe_to_dict (self);
+    PyObject *result = probe_result (self);
+    PyObject *ret = NULL;
 
-    if (PyErr_Occurred ())
+    if (!result)
         return NULL;
 
-    PyObject *ret = PyDict_Items (dict);
-    PyDict_Clear (dict);
+    ret = ProbeResult_items ((ProbeResultObject *) result, NULL);
+    Py_DECREF (result);
 
     return ret;
 }
@@ -735,13 +2585,14 @@ static PyObject *Probe_items (ProbeObject *self, PyObject *Py_UNUSED (ignored))
 PyDoc_STRVAR(Probe_values__doc__,
 "values ()\n");
 static PyObject *Probe_values (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-    PyObject *dict = probe_to_dict (self);
+    PyObject *result = probe_result (self);
+    PyObject *ret = NULL;
 
-    if (PyErr_Occurred ())
+    if (!result)
         return NULL;
 
-    PyObject *ret = PyDict_Values (dict);
-    PyDict_Clear (dict);
+    ret = ProbeResult_values ((ProbeResultObject *) result, NULL);
+    Py_DECREF (result);
 
     return ret;
 }
@@ -749,22 +2600,33 @@ static PyObject *Probe_values (ProbeObject *self, PyObject *Py_UNUSED (ignored))
 PyDoc_STRVAR(Probe_keys__doc__,
 "keys ()\n");
 static PyObject *Probe_keys (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-    PyObject *dict = probe_to_dict (self);
+    PyObject *result = probe_result (self);
+    PyObject *ret = NULL;
 
-    if (PyErr_Occurred ())
+    if (!result)
         return NULL;
 
-    PyObject *ret = PyDict_Keys (dict);
-    PyDict_Clear (dict);
+    ret = ProbeResult_keys ((ProbeResultObject *) result, NULL);
+    Py_DECREF (result);
 
     return ret;
 }
 
 static PyMethodDef Probe_methods[] = {
     {"set_device", (PyCFunction)(void(*)(void)) Probe_set_device, METH_VARARGS|METH_KEYWORDS, Probe_set_device__doc__},
+    {"set_buffer", (PyCFunction)(void(*)(void)) Probe_set_buffer, METH_VARARGS|METH_KEYWORDS, Probe_set_buffer__doc__},
+    {"set_fd", (PyCFunction)(void(*)(void)) Probe_set_fd, METH_VARARGS|METH_KEYWORDS, Probe_set_fd__doc__},
+    {"close", (PyCFunction) Probe_close, METH_NOARGS, Probe_close__doc__},
+    {"__enter__", (PyCFunction) Probe_enter, METH_NOARGS, NULL},
+    {"__exit__", (PyCFunction) Probe_exit, METH_VARARGS, NULL},
     {"do_safeprobe", (PyCFunction) Probe_do_safeprobe, METH_NOARGS, Probe_do_safeprobe__doc__},
     {"do_fullprobe", (PyCFunction) Probe_do_fullprobe, METH_NOARGS, Probe_do_fullprobe__doc__},
     {"do_probe", (PyCFunction) Probe_do_probe, METH_NOARGS, Probe_do_probe__doc__},
+    {"iter_probe", (PyCFunction) Probe_iter_probe, METH_NOARGS, Probe_iter_probe__doc__},
+    {"scan_offsets", (PyCFunction)(void(*)(void)) Probe_scan_offsets, METH_VARARGS|METH_KEYWORDS, Probe_scan_offsets__doc__},
+    {"do_safeprobe_async", (PyCFunction) Probe_do_safeprobe_async, METH_NOARGS, Probe_do_safeprobe_async__doc__},
+    {"do_fullprobe_async", (PyCFunction) Probe_do_fullprobe_async, METH_NOARGS, Probe_do_fullprobe_async__doc__},
+    {"do_probe_async", (PyCFunction) Probe_do_probe_async, METH_NOARGS, Probe_do_probe_async__doc__},
     {"step_back", (PyCFunction) Probe_step_back, METH_NOARGS, Probe_step_back__doc__},
 #ifdef HAVE_BLKID_2_31
     {"reset_buffers", (PyCFunction) Probe_reset_buffers, METH_NOARGS, Probe_reset_buffers__doc__},
@@ -784,12 +2646,16 @@ static PyMethodDef Probe_methods[] = {
     {"reset_partitions_filter", (PyCFunction) Probe_reset_partitions_filter, METH_NOARGS, Probe_reset_partitions_filter__doc__},
     {"enable_topology", (PyCFunction)(void(*)(void)) Probe_enable_topology, METH_VARARGS|METH_KEYWORDS, Probe_enable_topology__doc__},
     {"enable_superblocks", (PyCFunction)(void(*)(void)) Probe_enable_superblocks, METH_VARARGS|METH_KEYWORDS, Probe_enable_superblocks__doc__},
+    {"enable_stats", (PyCFunction)(void(*)(void)) Probe_enable_stats, METH_VARARGS|METH_KEYWORDS, Probe_enable_stats__doc__},
     {"filter_superblocks_type", (PyCFunction)(void(*)(void)) Probe_filter_superblocks_type, METH_VARARGS|METH_KEYWORDS, Probe_filter_superblocks_type__doc__},
     {"filter_superblocks_usage", (PyCFunction)(void(*)(void)) Probe_filter_superblocks_usage, METH_VARARGS|METH_KEYWORDS, Probe_filter_superblocks_usage__doc__},
     {"set_superblocks_flags", (PyCFunction)(void(*)(void)) Probe_set_superblocks_flags, METH_VARARGS|METH_KEYWORDS, Probe_set_superblocks_flags__doc__},
     {"invert_superblocks_filter", (PyCFunction) Probe_invert_superblocks_filter, METH_NOARGS, Probe_invert_superblocks_filter__doc__},
     {"reset_superblocks_filter", (PyCFunction) Probe_reset_superblocks_filter, METH_NOARGS, Probe_reset_superblocks_filter__doc__},
     {"lookup_value", (PyCFunction)(void(*)(void)) Probe_lookup_value, METH_VARARGS|METH_KEYWORDS, Probe_lookup_value__doc__},
+    {"lookup_raw", (PyCFunction)(void(*)(void)) Probe_lookup_raw, METH_VARARGS|METH_KEYWORDS, Probe_lookup_raw__doc__},
+    {"result", (PyCFunction) Probe_result, METH_NOARGS, Probe_result__doc__},
+    {"tags", (PyCFunction) Probe_tags, METH_NOARGS, Probe_tags__doc__},
     {"items", (PyCFunction) Probe_items, METH_NOARGS, Probe_items__doc__},
     {"values", (PyCFunction) Probe_values, METH_NOARGS, Probe_values__doc__},
     {"keys", (PyCFunction) Probe_keys, METH_NOARGS, Probe_keys__doc__},
@@ -797,7 +2663,11 @@ static PyMethodDef Probe_methods[] = {
 };
 
 static PyObject *Probe_get_devno (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-    dev_t devno = blkid_probe_get_devno (self->probe);
+    dev_t devno = 0;
+
+    probe_lock (self);
+    devno = blkid_probe_get_devno (self->probe);
+    probe_unlock (self);
 
     return PyLong_FromUnsignedLong (devno);
 }
@@ -807,25 +2677,41 @@ static PyObject *Probe_get_fd (ProbeObject *self, PyObject *Py_UNUSED (ignored))
 }
 
 static PyObject *Probe_get_offset (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-	blkid_loff_t offset = blkid_probe_get_offset (self->probe);
+	blkid_loff_t offset = 0;
+
+    probe_lock (self);
+    offset = blkid_probe_get_offset (self->probe);
+    probe_unlock (self);
 
     return PyLong_FromLongLong (offset);
 }
 
 static PyObject *Probe_get_sectors (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-	blkid_loff_t sectors = blkid_probe_get_sectors (self->probe);
+	blkid_loff_t sectors = 0;
+
+    probe_lock (self);
+    sectors = blkid_probe_get_sectors (self->probe);
+    probe_unlock (self);
 
     return PyLong_FromLongLong (sectors);
 }
 
 static PyObject *Probe_get_size (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-	blkid_loff_t size = blkid_probe_get_size (self->probe);
+	blkid_loff_t size = 0;
+
+    probe_lock (self);
+    size = blkid_probe_get_size (self->probe);
+    probe_unlock (self);
 
     return PyLong_FromLongLong (size);
 }
 
 static PyObject *Probe_get_sector_size (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-	unsigned int sector_size = blkid_probe_get_sectorsize (self->probe);
+	unsigned int sector_size = 0;
+
+    probe_lock (self);
+    sector_size = blkid_probe_get_sectorsize (self->probe);
+    probe_unlock (self);
 
     return PyLong_FromUnsignedLong (sector_size);
 }
@@ -843,7 +2729,9 @@ static int Probe_set_sector_size (ProbeObject *self, PyObject *value, void *clos
 
     sector_size = PyLong_AsLong (value);
 
+    probe_lock (self);
     ret = blkid_probe_set_sectorsize (self->probe, sector_size);
+    probe_unlock (self);
     if (ret != 0) {
         PyErr_Format (PyExc_RuntimeError, "Failed to set sector size");
         return -1;
@@ -854,13 +2742,21 @@ static int Probe_set_sector_size (ProbeObject *self, PyObject *value, void *clos
 #endif
 
 static PyObject *Probe_get_wholedisk_devno (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
-    dev_t devno = blkid_probe_get_wholedisk_devno (self->probe);
+    dev_t devno = 0;
+
+    probe_lock (self);
+    devno = blkid_probe_get_wholedisk_devno (self->probe);
+    probe_unlock (self);
 
     return PyLong_FromUnsignedLong (devno);
 }
 
 static PyObject *Probe_get_is_wholedisk (ProbeObject *self __attribute__((unused)), PyObject *Py_UNUSED (ignored)) {
-    int wholedisk = blkid_probe_is_wholedisk (self->probe);
+    int wholedisk = 0;
+
+    probe_lock (self);
+    wholedisk = blkid_probe_is_wholedisk (self->probe);
+    probe_unlock (self);
 
     return PyBool_FromLong (wholedisk);
 }
@@ -871,24 +2767,239 @@ static PyObject *Probe_get_topology (ProbeObject *self, PyObject *Py_UNUSED (ign
         return self->topology;
     }
 
+    probe_lock (self);
     self->topology = _Topology_get_topology_object (self->probe);
+    probe_unlock (self);
 
     return self->topology;
 }
 
+/* Every blkid_probe_get_partitions() call probes the partitions again and frees
+ * the previous partition tables, which may still be used by Partition and
+ * Parttable objects, so the list is fetched only once for the current results.
+ * Must be called with the probe lock held, doesn't need the GIL. */
+static blkid_partlist probe_read_partlist (ProbeObject *self) {
+    if (!self->parts)
+        self->parts = blkid_probe_get_partitions (self->probe);
+
+    return self->parts;
+}
+
+/* same as probe_read_partlist but needs the GIL, sets the Python error on failure */
+static blkid_partlist probe_get_partlist (ProbeObject *self) {
+    if (self->parts)
+        return self->parts;
+
+    if (probe_check_exports (self) < 0)
+        return NULL;
+
+    if (!probe_read_partlist (self))
+        PyErr_SetString (PyExc_RuntimeError, "Failed to get partitions");
+
+    return self->parts;
+}
+
 static PyObject *Probe_get_partitions (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    blkid_partlist partlist = NULL;
+
     if (self->partlist) {
         Py_INCREF (self->partlist);
         return self->partlist;
     }
 
-    self->partlist = _Partlist_get_partlist_object (self->probe);
+    probe_lock (self);
+    partlist = probe_get_partlist (self);
+    if (partlist)
+        self->partlist = _Partlist_get_partlist_object (partlist, (PyObject *) self, &(self->partlist),
+                                                        &(self->generation));
+    probe_unlock (self);
 
     return self->partlist;
 }
 
+/* Offsets (in bytes) of partition starts and ends from the closest aligned
+ * position, computed like fdisk does: a position is aligned if it is
+ * 'alignment_offset' bytes past a multiple of the I/O granularity (the bigger of
+ * the physical sector size and the minimum I/O size). */
+static unsigned long long alignment_misalignment (unsigned long long pos, unsigned long alignment_offset, unsigned long granularity) {
+    return (pos + granularity - (alignment_offset % granularity)) % granularity;
+}
+
+PyObject *_Probe_check_alignment (ProbeObject *self, unsigned long user_optimal_io_size) {
+    blkid_topology topology = NULL;
+    blkid_partlist partlist = NULL;
+    blkid_partition part = NULL;
+    unsigned long alignment_offset = 0;
+    unsigned long minimum_io_size = 0;
+    unsigned long optimal_io_size = 0;
+    unsigned long physical_sector_size = 0;
+    unsigned long granularity = 0;
+    unsigned long long start = 0;
+    unsigned long long end = 0;
+    unsigned long long start_off = 0;
+    unsigned long long end_off = 0;
+    unsigned long long optimal_off = 0;
+    int numof = 0;
+    PyObject *misaligned = NULL;
+    PyObject *py_optimal_off = NULL;
+    PyObject *item = NULL;
+    PyObject *result = NULL;
+
+    if (self->fd < 0) {
+        PyErr_SetString (PyExc_ValueError, "No device set");
+        return NULL;
+    }
+
+    misaligned = PyList_New (0);
+    if (!misaligned)
+        return NULL;
+
+    probe_lock (self);
+
+    /* getting the topology runs the topology probing again */
+    if (probe_check_exports (self) < 0) {
+        probe_unlock (self);
+        Py_DECREF (misaligned);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    partlist = probe_read_partlist (self);
+    topology = partlist ? blkid_probe_get_topology (self->probe) : NULL;
+    Py_END_ALLOW_THREADS
+
+    if (!topology) {
+        probe_unlock (self);
+        Py_DECREF (misaligned);
+        PyErr_SetString (PyExc_RuntimeError, partlist ? "Failed to get topology" : "Failed to get partitions");
+        return NULL;
+    }
+
+    alignment_offset = blkid_topology_get_alignment_offset (topology);
+    minimum_io_size = blkid_topology_get_minimum_io_size (topology);
+    optimal_io_size = user_optimal_io_size ? user_optimal_io_size : blkid_topology_get_optimal_io_size (topology);
+    physical_sector_size = blkid_topology_get_physical_sector_size (topology);
+
+    granularity = physical_sector_size > minimum_io_size ? physical_sector_size : minimum_io_size;
+    if (granularity == 0)
+        granularity = blkid_probe_get_sectorsize (self->probe);
+
+    /* some devices report nonsense optimal I/O sizes, use it only if it's a multiple
+     * of the granularity like libfdisk does */
+    if (optimal_io_size % granularity != 0)
+        optimal_io_size = 0;
+
+    numof = blkid_partlist_numof_partitions (partlist);
+    for (int i = 0; i < numof; i++) {
+        part = blkid_partlist_get_partition (partlist, i);
+        if (!part)
+            continue;
+
+        /* libblkid reports partitions in 512-byte sectors */
+        start = (unsigned long long) blkid_partition_get_start (part) * 512;
+        end = start + (unsigned long long) blkid_partition_get_size (part) * 512;
+
+        start_off = alignment_misalignment (start, alignment_offset, granularity);
+        end_off = alignment_misalignment (end, alignment_offset, granularity);
+        optimal_off = optimal_io_size ? alignment_misalignment (start, alignment_offset, optimal_io_size) : 0;
+
+        if (start_off == 0 && optimal_off == 0)
+            continue;
+
+        if (optimal_io_size)
+            py_optimal_off = PyLong_FromUnsignedLongLong (optimal_off);
+        else {
+            Py_INCREF (Py_None);
+            py_optimal_off = Py_None;
+        }
+
+        item = py_optimal_off ? Py_BuildValue ("(iKKKN)", blkid_partition_get_partno (part), start,
+                                               start_off, end_off, py_optimal_off) : NULL;
+        if (!item || PyList_Append (misaligned, item) < 0) {
+            probe_unlock (self);
+            Py_XDECREF (item);
+            Py_DECREF (misaligned);
+            return NULL;
+        }
+        Py_DECREF (item);
+    }
+
+    probe_unlock (self);
+
+    result = Py_BuildValue ("{s:k,s:k,s:k,s:k,s:k,s:N}",
+                            "alignment_offset", alignment_offset,
+                            "minimum_io_size", minimum_io_size,
+                            "optimal_io_size", optimal_io_size,
+                            "physical_sector_size", physical_sector_size,
+                            "granularity", granularity,
+                            "misaligned", misaligned);
+
+    return result;
+}
+
+static PyObject *py_io_counter (long long value) {
+    if (value < 0)
+        Py_RETURN_NONE;
+
+    return PyLong_FromLongLong (value);
+}
+
+static PyObject *Probe_get_stats (ProbeObject *self, PyObject *Py_UNUSED (ignored)) {
+    ProbeStats stats;
+    bool enabled = false;
+    const char *chain_names[] = { "superblocks", "partitions", "topology" };
+    bool enabled_chains[3];
+    PyObject *chains = NULL;
+    PyObject *name = NULL;
+
+    probe_lock (self);
+    enabled = self->stats != NULL;
+    if (enabled)
+        stats = *(self->stats);
+    probe_unlock (self);
+
+    if (!enabled)
+        Py_RETURN_NONE;
+
+    enabled_chains[0] = stats.chains.superblocks;
+    enabled_chains[1] = stats.chains.partitions;
+    enabled_chains[2] = stats.chains.topology;
+
+    chains = PyList_New (0);
+    if (!chains)
+        return NULL;
+
+    for (int i = 0; i < 3; i++) {
+        if (!enabled_chains[i])
+            continue;
+
+        name = PyUnicode_FromString (chain_names[i]);
+        if (!name || PyList_Append (chains, name) < 0) {
+            Py_XDECREF (name);
+            Py_DECREF (chains);
+            return NULL;
+        }
+        Py_DECREF (name);
+    }
+
+    return Py_BuildValue ("{s:z,s:d,s:d,s:N,s:N,s:N,s:N,s:K,s:d,s:d,s:N,s:N}",
+                          "call", stats.call,
+                          "wall_time", stats.wall_time,
+                          "cpu_time", stats.cpu_time,
+                          "bytes_read", py_io_counter (stats.calls ? stats.bytes_read : 0),
+                          "read_syscalls", py_io_counter (stats.calls ? stats.read_syscalls : 0),
+                          "storage_bytes_read", py_io_counter (stats.calls ? stats.storage_bytes_read : 0),
+                          "chains", chains,
+                          "calls", stats.calls,
+                          "total_wall_time", stats.total_wall_time,
+                          "total_cpu_time", stats.total_cpu_time,
+                          "total_bytes_read", py_io_counter (stats.total_bytes_read),
+                          "total_read_syscalls", py_io_counter (stats.total_read_syscalls));
+}
+
 static PyGetSetDef Probe_getseters[] = {
     {"devno", (getter) Probe_get_devno, NULL, "block device number, or 0 for regular files", NULL},
+    {"stats", (getter) Probe_get_stats, NULL, "statistics of the last and all probing calls if enabled by Probe.enable_stats(), None otherwise", NULL},
     {"fd", (getter) Probe_get_fd, NULL, "file descriptor for assigned device/file or -1 in case of error", NULL},
     {"offset", (getter) Probe_get_offset, NULL, "offset of probing area as defined by Probe.set_device() or -1 in case of error", NULL},
     {"sectors", (getter) Probe_get_sectors, NULL, "512-byte sector count or -1 in case of error", NULL},
@@ -908,7 +3019,10 @@ static PyGetSetDef Probe_getseters[] = {
 static Py_ssize_t Probe_len (ProbeObject *self) {
     int ret = 0;
 
-    ret = blkid_probe_numof_values (self->probe);
+    probe_lock (self);
+    ret = probe_numof_values (self);
+    probe_unlock (self);
+
     if (ret < 0)
         return 0;
 
@@ -920,21 +3034,35 @@ static PyObject * Probe_getitem (ProbeObject *self, PyObject *item) {
     int ret = 0;
     const char *key = NULL;
     const char *value = NULL;
+    PyObject *py_value = NULL;
 
     if (!PyUnicode_Check (item)) {
         PyErr_SetObject(PyExc_KeyError, item);
         return NULL;
     }
 
-    key = PyUnicode_AsUTF8 (item);
+    ret = probe_tag_index (item);
+    if (ret >= 0)
+        key = probe_tags[ret];
+    else {
+        key = PyUnicode_AsUTF8 (item);
+        if (!key)
+            return NULL;
+    }
 
-    ret = blkid_probe_lookup_value (self->probe, key, &value, NULL);
+    probe_lock (self);
+
+    ret = probe_lookup_value (self, key, &value, NULL);
     if (ret != 0) {
+        probe_unlock (self);
         PyErr_SetObject (PyExc_KeyError, item);
         return NULL;
     }
 
-    return PyBytes_FromString (value);
+    py_value = PyBytes_FromString (value);
+    probe_unlock (self);
+
+    return py_value;
 }
 
 
@@ -957,3 +3085,297 @@ PyTypeObject ProbeType = {
     .tp_getset = Probe_getseters,
     .tp_as_mapping = &ProbeMapping,
 };
+
+/*********************** PROBE RESULT ***********************/
+/* takes over 'values' (freed on failure too) */
+PyObject *_ProbeResult_new (ProbeValues *values) {
+    ProbeResultObject *result = NULL;
+
+    result = PyObject_New (ProbeResultObject, &ProbeResultType);
+    if (!result) {
+        free (values);
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new ProbeResult object");
+        return NULL;
+    }
+
+    result->values = values;
+    result->tags = NULL;
+    result->entries = calloc (values->nvalues > 0 ? values->nvalues : 1, sizeof (ProbeResultEntry));
+    if (!result->entries) {
+        Py_DECREF (result);
+        return PyErr_NoMemory ();
+    }
+
+    for (int i = 0; i < values->nvalues; i++)
+        result->entries[i].tag = probe_tag_index_name (values->values[i].name);
+
+    return (PyObject *) result;
+}
+
+void ProbeResult_dealloc (ProbeResultObject *self) {
+    if (self->entries) {
+        for (int i = 0; i < self->values->nvalues; i++)
+            Py_XDECREF (self->entries[i].value);
+        free (self->entries);
+    }
+    Py_XDECREF (self->tags);
+
+    free (self->values);
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+/* returns a borrowed reference, values that are not valid UTF-8 are None */
+static PyObject *probe_result_value (ProbeResultObject *self, int i) {
+    if (!self->entries[i].value) {
+        self->entries[i].value = PyUnicode_FromString (self->values->values[i].data);
+        if (!self->entries[i].value) {
+            PyErr_Clear ();
+            Py_INCREF (Py_None);
+            self->entries[i].value = Py_None;
+        }
+    }
+
+    return self->entries[i].value;
+}
+
+/* returns a new reference to the key, well-known tags use the interned names */
+static PyObject *probe_result_key (ProbeResultObject *self, int i) {
+    if (self->entries[i].tag >= 0) {
+        Py_INCREF (probe_tag_names[self->entries[i].tag]);
+        return probe_tag_names[self->entries[i].tag];
+    }
+
+    return PyUnicode_FromString (self->values->values[i].name);
+}
+
+/* returns index of the 'key' value, -1 if not found (without an exception set) */
+static int probe_result_find (ProbeResultObject *self, PyObject *key) {
+    const char *name = NULL;
+    int tag = -1;
+
+    if (!PyUnicode_Check (key))
+        return -1;
+
+    /* fast path for well-known tags, no hashing or string comparison */
+    tag = probe_tag_index (key);
+    if (tag >= 0) {
+        for (int i = 0; i < self->values->nvalues; i++)
+            if (self->entries[i].tag == tag)
+                return i;
+        return -1;
+    }
+
+    name = PyUnicode_AsUTF8 (key);
+    if (!name) {
+        PyErr_Clear ();
+        return -1;
+    }
+
+    for (int i = 0; i < self->values->nvalues; i++)
+        if (strcmp (self->values->values[i].name, name) == 0)
+            return i;
+
+    return -1;
+}
+
+static PyObject *ProbeResult_keys (ProbeResultObject *self, PyObject *Py_UNUSED (ignored)) {
+    PyObject *list = NULL;
+    PyObject *key = NULL;
+
+    list = PyList_New (self->values->nvalues);
+    if (!list)
+        return NULL;
+
+    for (int i = 0; i < self->values->nvalues; i++) {
+        key = probe_result_key (self, i);
+        if (!key) {
+            Py_DECREF (list);
+            return NULL;
+        }
+        PyList_SET_ITEM (list, i, key);
+    }
+
+    return list;
+}
+
+static PyObject *ProbeResult_values (ProbeResultObject *self, PyObject *Py_UNUSED (ignored)) {
+    PyObject *list = NULL;
+    PyObject *value = NULL;
+
+    list = PyList_New (self->values->nvalues);
+    if (!list)
+        return NULL;
+
+    for (int i = 0; i < self->values->nvalues; i++) {
+        value = probe_result_value (self, i);
+        Py_INCREF (value);
+        PyList_SET_ITEM (list, i, value);
+    }
+
+    return list;
+}
+
+static PyObject *ProbeResult_items (ProbeResultObject *self, PyObject *Py_UNUSED (ignored)) {
+    PyObject *list = NULL;
+    PyObject *tuple = NULL;
+
+    list = PyList_New (self->values->nvalues);
+    if (!list)
+        return NULL;
+
+    for (int i = 0; i < self->values->nvalues; i++) {
+        tuple = Py_BuildValue ("(NO)", probe_result_key (self, i), probe_result_value (self, i));
+        if (!tuple) {
+            Py_DECREF (list);
+            return NULL;
+        }
+        PyList_SET_ITEM (list, i, tuple);
+    }
+
+    return list;
+}
+
+PyDoc_STRVAR(ProbeResult_get__doc__,
+"get (key, default=None)\n\n"
+"Returns value for the 'key' if present, 'default' otherwise.");
+static PyObject *ProbeResult_get (ProbeResultObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *key = NULL;
+    PyObject *def = Py_None;
+    char *kwlist[] = { "key", "default", NULL };
+    PyObject *value = NULL;
+    int i = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O|O", kwlist, &key, &def))
+        return NULL;
+
+    i = probe_result_find (self, key);
+    value = i < 0 ? def : probe_result_value (self, i);
+
+    Py_INCREF (value);
+    return value;
+}
+
+static PyObject *ProbeResult_get_tags (ProbeResultObject *self, PyObject *Py_UNUSED (ignored)) {
+    PyObject *value = NULL;
+
+    if (!self->tags) {
+        self->tags = PyStructSequence_New (&ProbeTagsType);
+        if (!self->tags)
+            return NULL;
+
+        for (int i = 0; i < PROBE_NTAGS; i++) {
+            Py_INCREF (Py_None);
+            PyStructSequence_SET_ITEM (self->tags, i, Py_None);
+        }
+
+        for (int i = 0; i < self->values->nvalues; i++) {
+            if (self->entries[i].tag < 0)
+                continue;
+
+            value = probe_result_value (self, i);
+            Py_INCREF (value);
+            Py_DECREF (PyStructSequence_GET_ITEM (self->tags, self->entries[i].tag));
+            PyStructSequence_SET_ITEM (self->tags, self->entries[i].tag, value);
+        }
+    }
+
+    Py_INCREF (self->tags);
+    return self->tags;
+}
+
+static PyGetSetDef ProbeResult_getseters[] = {
+    {"tags", (getter) ProbeResult_get_tags, NULL, "well-known tags as a blkid.ProbeTags struct sequence", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyMethodDef ProbeResult_methods[] = {
+    {"keys", (PyCFunction) ProbeResult_keys, METH_NOARGS, NULL},
+    {"values", (PyCFunction) ProbeResult_values, METH_NOARGS, NULL},
+    {"items", (PyCFunction) ProbeResult_items, METH_NOARGS, NULL},
+    {"get", (PyCFunction)(void(*)(void)) ProbeResult_get, METH_VARARGS|METH_KEYWORDS, ProbeResult_get__doc__},
+    {NULL, NULL, 0, NULL},
+};
+
+static Py_ssize_t ProbeResult_len (ProbeResultObject *self) {
+    return (Py_ssize_t) self->values->nvalues;
+}
+
+static PyObject *ProbeResult_getitem (ProbeResultObject *self, PyObject *item) {
+    PyObject *value = NULL;
+    int i = 0;
+
+    i = probe_result_find (self, item);
+    if (i < 0) {
+        PyErr_SetObject (PyExc_KeyError, item);
+        return NULL;
+    }
+
+    value = probe_result_value (self, i);
+    Py_INCREF (value);
+
+    return value;
+}
+
+static int ProbeResult_contains (ProbeResultObject *self, PyObject *item) {
+    return probe_result_find (self, item) >= 0;
+}
+
+static PyObject *ProbeResult_iter (ProbeResultObject *self) {
+    PyObject *keys = NULL;
+    PyObject *iter = NULL;
+
+    keys = ProbeResult_keys (self, NULL);
+    if (!keys)
+        return NULL;
+
+    iter = PyObject_GetIter (keys);
+    Py_DECREF (keys);
+
+    return iter;
+}
+
+static PyObject *ProbeResult_repr (ProbeResultObject *self) {
+    PyObject *dict = NULL;
+    PyObject *ret = NULL;
+
+    dict = PyDict_New ();
+    if (!dict)
+        return NULL;
+
+    for (int i = 0; i < self->values->nvalues; i++) {
+        if (PyDict_SetItemString (dict, self->values->values[i].name, probe_result_value (self, i)) < 0) {
+            Py_DECREF (dict);
+            return NULL;
+        }
+    }
+
+    ret = PyUnicode_FromFormat ("ProbeResult(%R)", dict);
+    Py_DECREF (dict);
+
+    return ret;
+}
+
+static PyMappingMethods ProbeResultMapping = {
+    .mp_length = (lenfunc) ProbeResult_len,
+    .mp_subscript = (binaryfunc) ProbeResult_getitem,
+};
+
+static PySequenceMethods ProbeResultSequence = {
+    .sq_contains = (objobjproc) ProbeResult_contains,
+};
+
+PyTypeObject ProbeResultType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid.ProbeResult",
+    .tp_doc = "Read-only snapshot of probing results returned by Probe.result()",
+    .tp_basicsize = sizeof (ProbeResultObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) ProbeResult_dealloc,
+    .tp_methods = ProbeResult_methods,
+    .tp_getset = ProbeResult_getseters,
+    .tp_as_mapping = &ProbeResultMapping,
+    .tp_as_sequence = &ProbeResultSequence,
+    .tp_iter = (getiterfunc) ProbeResult_iter,
+    .tp_repr = (reprfunc) ProbeResult_repr,
+};
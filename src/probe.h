@@ -21,19 +21,120 @@
 #include <Python.h>
 
 #include <blkid/blkid.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* enabled chains and their flags, libblkid doesn't allow to read them back */
+typedef struct {
+    bool superblocks;
+    int superblocks_flags;
+    bool partitions;
+    int partitions_flags;
+    bool topology;
+} ProbeChains;
+
+/* statistics of the last and all probing calls, see Probe.enable_stats() */
+typedef struct {
+    const char *call;
+    double wall_time;
+    double cpu_time;
+    long long bytes_read;           /* -1 if /proc/thread-self/io is not available */
+    long long read_syscalls;
+    long long storage_bytes_read;
+    ProbeChains chains;
+    unsigned long long calls;
+    double total_wall_time;
+    double total_cpu_time;
+    long long total_bytes_read;
+    long long total_read_syscalls;
+} ProbeStats;
 
 typedef struct {
     PyObject_HEAD
     blkid_probe probe;
     PyObject *topology;
-    PyObject *partlist;
+    PyObject *partlist;     /* borrowed, the Partlist keeps the probe alive and clears this */
+    blkid_partlist parts;   /* partitions of the current results, fetched only once */
+    unsigned long generation;   /* changed every time the results (and libblkid partitions) are dropped */
     int fd;
+    bool fd_owned;
+    PyThread_type_lock lock;
+    Py_ssize_t exports;     /* memoryviews of the current values returned by lookup_raw() */
+    int pending;            /* asynchronous probing calls in progress */
+    ProbeChains chains;
+    ProbeStats *stats;      /* NULL unless enabled with enable_stats() */
+    PyObject *memo;         /* ProbeResult if the last do_safeprobe() was served from the memo */
+    unsigned int filters;   /* chains with a probing filter set, never memoized */
 } ProbeObject;
 
 extern PyTypeObject ProbeType;
+extern PyTypeObject ProbeValueBufferType;
+extern PyTypeObject ProbeIteratorType;
 
 PyObject *Probe_new (PyTypeObject *type,  PyObject *args, PyObject *kwargs);
 int Probe_init (ProbeObject *self, PyObject *args, PyObject *kwargs);
 void Probe_dealloc (ProbeObject *self);
 
+/* probing results copied out of libblkid into a single allocation */
+typedef struct {
+    const char *name;
+    const char *data;
+    size_t len;
+} ProbeValue;
+
+typedef struct {
+    int nvalues;
+    ProbeValue values[];
+} ProbeValues;
+
+/* immutable snapshot of the probing results, values are decoded on first access */
+typedef struct {
+    PyObject *value;
+    int tag;        /* index to the well-known tags table or -1 */
+} ProbeResultEntry;
+
+typedef struct {
+    PyObject_HEAD
+    ProbeValues *values;
+    ProbeResultEntry *entries;
+    PyObject *tags;
+} ProbeResultObject;
+
+extern PyTypeObject ProbeResultType;
+extern PyTypeObject ProbeTagsType;
+
+int _Probe_init_tags (void);
+
+void ProbeResult_dealloc (ProbeResultObject *self);
+
+PyObject *_ProbeResult_new (ProbeValues *values);
+
+ProbeValues *_Probe_values_collect (blkid_probe probe);
+PyObject *_Probe_values_to_dict (const ProbeValues *values);
+int _Probe_probe_path (const char *path, const ProbeChains *chains, ProbeValues **values, const char **error);
+
+int _Probe_memo_enable (bool enable);
+void _Probe_memo_clear (void);
+int _Probe_memo_forget (uint64_t diskseq);
+
+PyObject *_Probe_check_alignment (ProbeObject *self, unsigned long user_optimal_io_size);
+
+/* signatures found (and erased) by _Probe_wipe_path */
+typedef struct {
+    long long offset;
+    size_t len;
+    char type[32];
+    char usage[32];
+    unsigned char magic[64];
+} ProbeSignature;
+
+typedef struct {
+    int nsignatures;
+    int allocated;
+    ProbeSignature signatures[];
+} ProbeSignatures;
+
+int _Probe_wipe_path (const char *path, bool dryrun, ProbeSignatures **signatures, uint64_t *diskseq,
+                      const char **error);
+
 #endif /* PROBE_H */
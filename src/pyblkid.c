@@ -21,10 +21,14 @@
 #include "topology.h"
 #include "partitions.h"
 #include "cache.h"
+#include "workers.h"
+#include "async.h"
 
 #include <blkid/blkid.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #define UNUSED __attribute__((unused))
 
@@ -412,22 +416,50 @@ static PyObject *Blkid_superblocks (ProbeObject *self UNUSED, PyObject *Py_UNUSE
     return ret;
 }
 
+/* libblkid may free devices from the cache while evaluating */
+static blkid_cache *evaluate_cache (PyObject *cache) {
+    CacheObject *cache_obj = (CacheObject *) cache;
+
+    if (!cache || cache == Py_None)
+        return NULL;
+
+    if (!cache_obj->cache) {
+        PyErr_SetString (PyExc_ValueError, "Cache is closed");
+        return NULL;
+    }
+
+    cache_obj->generation++;
+
+    return &(cache_obj->cache);
+}
+
 PyDoc_STRVAR(Blkid_evaluate_tag__doc__,
-"evaluate_tag (token, value)\n\n"
+"evaluate_tag (token, value, cache=None)\n\n"
 "Get device name that match the specified token (e.g \"LABEL\" or \"UUID\") and token value.\n"
-"The evaluation could be controlled by the /etc/blkid.conf config file. The default is to try \"udev\" and then \"scan\" method.\n");
+"The evaluation could be controlled by the /etc/blkid.conf config file. The default is to try \"udev\" and then \"scan\" method.\n"
+"With 'cache' (a blkid.Cache) the \"scan\" method uses the already loaded cache instead of reading the cache file again.\n");
 static PyObject *Blkid_evaluate_tag (PyObject *self UNUSED, PyObject *args, PyObject *kwargs) {
     char *token = NULL;
     char *value = NULL;
-    char *kwlist[] = { "token", "value", NULL };
+    PyObject *cache = NULL;
+    char *kwlist[] = { "token", "value", "cache", NULL };
+    blkid_cache *cachep = NULL;
     PyObject *py_ret = NULL;
     char *ret = NULL;
 
-    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "ss", kwlist, &token, &value))
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "ss|O", kwlist, &token, &value, &cache))
+        return NULL;
+
+    if (cache && cache != Py_None && !PyObject_TypeCheck (cache, &CacheType)) {
+        PyErr_SetString (PyExc_TypeError, "cache must be a blkid.Cache or None");
         return NULL;
+    }
 
+    cachep = evaluate_cache (cache);
+    if (!cachep && PyErr_Occurred ())
+        return NULL;
 
-    ret = blkid_evaluate_tag (token, value, NULL);
+    ret = blkid_evaluate_tag (token, value, cachep);
     if (ret == NULL) {
         Py_INCREF (Py_None);
         py_ret = Py_None;
@@ -440,20 +472,31 @@ static PyObject *Blkid_evaluate_tag (PyObject *self UNUSED, PyObject *args, PyOb
 }
 
 PyDoc_STRVAR(Blkid_evaluate_spec__doc__,
-"evaluate_spec (spec)\n\n"
+"evaluate_spec (spec, cache=None)\n\n"
 "Get device name that match the unparsed tag (e.g. \"LABEL=foo\") or path (e.g. /dev/dm-0)\n"
-"The evaluation could be controlled by the /etc/blkid.conf config file. The default is to try \"udev\" and then \"scan\" method.\n");
+"The evaluation could be controlled by the /etc/blkid.conf config file. The default is to try \"udev\" and then \"scan\" method.\n"
+"With 'cache' (a blkid.Cache) the \"scan\" method uses the already loaded cache instead of reading the cache file again.\n");
 static PyObject *Blkid_evaluate_spec (PyObject *self UNUSED, PyObject *args, PyObject *kwargs) {
     char *spec = NULL;
-    char *kwlist[] = { "spec", NULL };
+    PyObject *cache = NULL;
+    char *kwlist[] = { "spec", "cache", NULL };
+    blkid_cache *cachep = NULL;
     PyObject *py_ret = NULL;
     char *ret = NULL;
 
-    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "s", kwlist, &spec))
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "s|O", kwlist, &spec, &cache))
         return NULL;
 
+    if (cache && cache != Py_None && !PyObject_TypeCheck (cache, &CacheType)) {
+        PyErr_SetString (PyExc_TypeError, "cache must be a blkid.Cache or None");
+        return NULL;
+    }
 
-    ret = blkid_evaluate_spec (spec, NULL);
+    cachep = evaluate_cache (cache);
+    if (!cachep && PyErr_Occurred ())
+        return NULL;
+
+    ret = blkid_evaluate_spec (spec, cachep);
     if (ret == NULL) {
         Py_INCREF (Py_None);
         py_ret = Py_None;
@@ -465,6 +508,740 @@ static PyObject *Blkid_evaluate_spec (PyObject *self UNUSED, PyObject *args, PyO
     return py_ret;
 }
 
+PyDoc_STRVAR(Blkid_enable_probe_memo__doc__,
+"enable_probe_memo (enable=True)\n\n"
+"Enables/disables memoization of Probe.do_safeprobe() results for all probes in the process.\n"
+"Results are remembered per block device (device number, probing area offset, sector size, enabled "
+"chains and their flags) together with the disk sequence number and size of the device. Repeated "
+"do_safeprobe() calls for the same device are served from memory without any I/O until the disk "
+"sequence number (new media, re-attached loop device) or the size changes.\n"
+"Note that changes to the device content (e.g. a new filesystem) do not change the disk sequence "
+"number, use clear_probe_memo() after modifying devices. Regular files, probes with filters and "
+"kernels without disk sequence numbers (older than 5.15) are never memoized. Disabling the "
+"memoization drops all remembered results.");
+static PyObject *Blkid_enable_probe_memo (PyObject *self UNUSED, PyObject *args, PyObject *kwargs) {
+    int enable = 1;
+    char *kwlist[] = { "enable", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "|p", kwlist, &enable))
+        return NULL;
+
+    if (_Probe_memo_enable (enable) < 0)
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Blkid_clear_probe_memo__doc__,
+"clear_probe_memo ()\n\n"
+"Drops all probing results remembered since blkid.enable_probe_memo().");
+static PyObject *Blkid_clear_probe_memo (PyObject *self UNUSED, PyObject *Py_UNUSED (ignored)) {
+    _Probe_memo_clear ();
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(Blkid_check_alignment__doc__,
+"check_alignment (probe, optimal_io_size=0)\n\n"
+"Checks alignment of all partitions on the device of the probe against its topology in one pass. "
+"Partition starts must be a multiple of the I/O granularity (the bigger of physical_sector_size "
+"and minimum_io_size) shifted by alignment_offset, if the device reports optimal_io_size (e.g. "
+"RAID stripe size) the starts are checked against it too.\n\n"
+"Returns a dictionary with the topology values used ('alignment_offset', 'minimum_io_size', "
+"'optimal_io_size', 'physical_sector_size' and 'granularity') and 'misaligned', a list of "
+"(partno, start, start_offset, end_offset, optimal_offset) tuples for the misaligned partitions: "
+"'start' in bytes, the offsets are how many bytes the start (or the end) of the partition is past "
+"the closest aligned position before it, 'optimal_offset' is None without optimal_io_size.\n\n"
+"'optimal_io_size' overrides the value reported by the device (e.g. a RAID stripe size known from "
+"elsewhere). Like libfdisk, the optimal I/O size is ignored (reported as 0) if it isn't a multiple "
+"of the granularity.");
+static PyObject *Blkid_check_alignment (PyObject *self UNUSED, PyObject *args, PyObject *kwargs) {
+    ProbeObject *probe = NULL;
+    unsigned long optimal_io_size = 0;
+    char *kwlist[] = { "probe", "optimal_io_size", NULL };
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O!|k", kwlist, &ProbeType, &probe, &optimal_io_size))
+        return NULL;
+
+    return _Probe_check_alignment (probe, optimal_io_size);
+}
+
+/*********************** PROBE_MANY ***********************/
+/* probing of a single path on a worker thread, shared by probe_many and probe_many_async */
+typedef struct {
+    Py_ssize_t index;
+    ProbeChains chains;
+    int ret;
+    int err;
+    const char *error;
+    ProbeValues *values;
+    char *path;
+} ProbePathTask;
+
+/* Allocates a job of 'size' bytes with a ProbePathTask at 'task_offset', the path
+ * is stored right after the job. Returns NULL with an exception set on failure. */
+static void *probe_path_job_new (size_t size, size_t task_offset, PyObject *path, Py_ssize_t index, const ProbeChains *chains) {
+    PyObject *fspath = NULL;
+    ProbePathTask *task = NULL;
+    char *job = NULL;
+    Py_ssize_t len = 0;
+
+    if (!PyUnicode_FSConverter (path, &fspath))
+        return NULL;
+
+    len = PyBytes_GET_SIZE (fspath);
+    job = calloc (1, size + len + 1);
+    if (!job) {
+        Py_DECREF (fspath);
+        PyErr_NoMemory ();
+        return NULL;
+    }
+
+    task = (ProbePathTask *) (job + task_offset);
+    task->index = index;
+    task->chains = *chains;
+    task->path = job + size;
+    memcpy (task->path, PyBytes_AS_STRING (fspath), len + 1);
+    Py_DECREF (fspath);
+
+    return job;
+}
+
+static void probe_path_task_run (ProbePathTask *task) {
+    task->ret = _Probe_probe_path (task->path, &(task->chains), &(task->values), &(task->error));
+    task->err = task->ret < 0 ? errno : 0;
+}
+
+/* returns a new exception instance describing the failure of a task */
+static PyObject *probe_path_task_error (ProbePathTask *task, PyObject *path) {
+    if (task->err)
+        return PyObject_CallFunction (PyExc_OSError, "isO", task->err, task->error, path);
+    else
+        return PyObject_CallFunction (PyExc_RuntimeError, "s", task->error);
+}
+
+/* returns a new (path, result) tuple, result is either the dict or the exception instance */
+static PyObject *probe_path_task_result (ProbePathTask *task, PyObject *paths) {
+    PyObject *path = NULL;
+    PyObject *result = NULL;
+    PyObject *tuple = NULL;
+
+    path = PyTuple_GET_ITEM (paths, task->index);
+
+    if (task->ret < 0)
+        result = probe_path_task_error (task, path);
+    else
+        result = _Probe_values_to_dict (task->values);
+
+    if (!result)
+        return NULL;
+
+    tuple = PyTuple_Pack (2, path, result);
+    Py_DECREF (result);
+
+    return tuple;
+}
+
+typedef struct {
+    Job job;
+    ProbePathTask task;
+} ProbeManyJob;
+
+static void probe_many_job_run (Job *job) {
+    probe_path_task_run (&(((ProbeManyJob *) job)->task));
+}
+
+static void probe_many_job_free (Job *job) {
+    ProbeManyJob *pjob = (ProbeManyJob *) job;
+
+    free (pjob->task.values);
+    free (pjob);
+}
+
+typedef struct {
+    PyObject_HEAD
+    WorkerPool *pool;
+    JobQueue done;
+    PyObject *paths;
+    Py_ssize_t remaining;
+} ProbeManyObject;
+
+static void ProbeMany_dealloc (ProbeManyObject *self) {
+    if (self->pool) {
+        Py_BEGIN_ALLOW_THREADS
+        worker_pool_free (self->pool);
+        Py_END_ALLOW_THREADS
+    }
+
+    job_queue_destroy (&(self->done));
+    Py_XDECREF (self->paths);
+
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+static PyObject *ProbeMany_next (ProbeManyObject *self) {
+    ProbeManyJob *job = NULL;
+    PyObject *tuple = NULL;
+
+    if (self->remaining == 0)
+        return NULL;
+
+    while (!job) {
+        Py_BEGIN_ALLOW_THREADS
+        job = (ProbeManyJob *) job_queue_pop (&(self->done), 100);
+        Py_END_ALLOW_THREADS
+
+        if (!job && PyErr_CheckSignals () < 0)
+            return NULL;
+    }
+    self->remaining--;
+
+    tuple = probe_path_task_result (&(job->task), self->paths);
+    probe_many_job_free ((Job *) job);
+
+    return tuple;
+}
+
+static PyTypeObject ProbeManyType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid.ProbeMany",
+    .tp_basicsize = sizeof (ProbeManyObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) ProbeMany_dealloc,
+    .tp_iter = PyObject_SelfIter,
+    .tp_iternext = (iternextfunc) ProbeMany_next,
+};
+
+PyDoc_STRVAR(Blkid_probe_many__doc__,
+"probe_many (paths, superblocks=True, partitions=False, topology=False, superblocks_flags=blkid.SUBLKS_DEFAULT, partitions_flags=0, workers=0)\n\n"
+"Probes all devices from 'paths' in parallel using native worker threads running without the GIL.\n"
+"Every device is probed the same way as with Probe.set_device() and Probe.do_safeprobe() with the "
+"selected chains enabled and flags set.\n\n"
+"Returns an iterator yielding (path, result) tuples in completion order. 'result' is a dictionary "
+"with the probing results (empty if nothing was detected) or an exception instance if probing the "
+"device failed.\n"
+"'workers' is the number of worker threads, by default one thread per online CPU is used.");
+static PyObject *Blkid_probe_many (PyObject *self UNUSED, PyObject *args, PyObject *kwargs) {
+    PyObject *py_paths = NULL;
+    ProbeChains chains = { true, BLKID_SUBLKS_DEFAULT, false, 0, false };
+    int workers = 0;
+    char *kwlist[] = { "paths", "superblocks", "partitions", "topology", "superblocks_flags", "partitions_flags", "workers", NULL };
+    ProbeManyObject *result = NULL;
+    ProbeManyJob **jobs = NULL;
+    Py_ssize_t npaths = 0;
+    int superblocks = 1;
+    int partitions = 0;
+    int topology = 0;
+
+    /* "p" stores an int, the bool members of ProbeChains can't be used directly */
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O|pppiii", kwlist, &py_paths,
+                                      &superblocks, &partitions, &topology,
+                                      &(chains.superblocks_flags), &(chains.partitions_flags), &workers))
+        return NULL;
+    chains.superblocks = superblocks;
+    chains.partitions = partitions;
+    chains.topology = topology;
+
+    result = PyObject_New (ProbeManyObject, &ProbeManyType);
+    if (!result) {
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new ProbeMany object");
+        return NULL;
+    }
+    result->pool = NULL;
+    result->remaining = 0;
+    job_queue_init (&(result->done));
+
+    result->paths = PySequence_Tuple (py_paths);
+    if (!result->paths) {
+        Py_DECREF (result);
+        return NULL;
+    }
+
+    npaths = PyTuple_GET_SIZE (result->paths);
+    if (npaths == 0)
+        return (PyObject *) result;
+
+    jobs = calloc (npaths, sizeof (ProbeManyJob *));
+    if (!jobs) {
+        Py_DECREF (result);
+        return PyErr_NoMemory ();
+    }
+
+    for (Py_ssize_t i = 0; i < npaths; i++) {
+        jobs[i] = probe_path_job_new (sizeof (ProbeManyJob), offsetof (ProbeManyJob, task),
+                                      PyTuple_GET_ITEM (result->paths, i), i, &chains);
+        if (!jobs[i])
+            goto error;
+
+        jobs[i]->job.run = probe_many_job_run;
+        jobs[i]->job.free = probe_many_job_free;
+    }
+
+    if (workers < 1)
+        workers = worker_pool_default_size ();
+    if (workers > npaths)
+        workers = npaths;
+
+    result->pool = worker_pool_new (workers);
+    if (!result->pool) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to start worker threads");
+        goto error;
+    }
+
+    for (Py_ssize_t i = 0; i < npaths; i++)
+        worker_pool_submit (result->pool, (Job *) jobs[i], &(result->done));
+    result->remaining = npaths;
+
+    free (jobs);
+
+    return (PyObject *) result;
+
+error:
+    for (Py_ssize_t i = 0; i < npaths; i++)
+        free (jobs[i]);
+    free (jobs);
+    Py_DECREF (result);
+
+    return NULL;
+}
+
+/*********************** WIPE_MANY ***********************/
+/* the task only provides the path and the error reporting, its chains and values are unused */
+typedef struct {
+    Job job;
+    ProbePathTask task;
+    bool dryrun;
+    ProbeSignatures *signatures;
+    uint64_t diskseq;
+} WipeManyJob;
+
+static void wipe_many_job_run (Job *job) {
+    WipeManyJob *wjob = (WipeManyJob *) job;
+    ProbePathTask *task = &(wjob->task);
+
+    task->ret = _Probe_wipe_path (task->path, wjob->dryrun, &(wjob->signatures), &(wjob->diskseq),
+                                  &(task->error));
+    task->err = task->ret < 0 ? errno : 0;
+}
+
+static void wipe_many_job_free (Job *job) {
+    WipeManyJob *wjob = (WipeManyJob *) job;
+
+    free (wjob->signatures);
+    free (wjob);
+}
+
+static PyObject *wipe_many_job_result (WipeManyJob *job, PyObject *path) {
+    PyObject *list = NULL;
+    PyObject *sig = NULL;
+    const ProbeSignature *signature = NULL;
+
+    if (job->task.ret < 0)
+        return probe_path_task_error (&(job->task), path);
+
+    list = PyList_New (0);
+    if (!list)
+        return NULL;
+
+    for (int i = 0; job->signatures && i < job->signatures->nsignatures; i++) {
+        signature = &(job->signatures->signatures[i]);
+        sig = Py_BuildValue ("{s:s,s:s,s:L,s:N}",
+                             "type", signature->type,
+                             "usage", signature->usage,
+                             "offset", signature->offset,
+                             "magic", PyBytes_FromStringAndSize ((const char *) signature->magic,
+                                                                 Py_MIN (signature->len, sizeof (signature->magic))));
+        if (!sig || PyList_Append (list, sig) < 0) {
+            Py_XDECREF (sig);
+            Py_DECREF (list);
+            return NULL;
+        }
+        Py_DECREF (sig);
+    }
+
+    return list;
+}
+
+PyDoc_STRVAR(Blkid_wipe_many__doc__,
+"wipe_many (paths, dryrun=False, workers=0)\n\n"
+"Erases all superblock and partition table signatures from all devices from 'paths' in parallel "
+"using native worker threads running without the GIL.\n"
+"All signatures on a device are found first, then the magic strings are overwritten with zeroes "
+"using one write per contiguous area and the device is flushed. Erasing a signature can uncover "
+"another one (e.g. the backup GPT header or the protective MBR), so this is repeated until no "
+"signature is found. Devices are opened with "
+"O_EXCL, so devices that are mounted or otherwise used by the kernel are not wiped.\n\n"
+"Returns a dictionary with a report for every path: a list of dictionaries describing the "
+"erased signatures ('type', 'usage', 'offset' and 'magic') or an exception instance if wiping "
+"the device failed. With 'dryrun' nothing is written and the report lists the signatures that "
+"would be erased first.\n"
+"'workers' is the number of worker threads, by default one thread per online CPU is used.");
+static PyObject *Blkid_wipe_many (PyObject *self UNUSED, PyObject *args, PyObject *kwargs) {
+    PyObject *py_paths = NULL;
+    int dryrun = 0;
+    int workers = 0;
+    char *kwlist[] = { "paths", "dryrun", "workers", NULL };
+    PyObject *paths = NULL;
+    PyObject *path = NULL;
+    PyObject *result = NULL;
+    PyObject *report = NULL;
+    WipeManyJob **jobs = NULL;
+    WipeManyJob *job = NULL;
+    WorkerPool *pool = NULL;
+    JobQueue done;
+    ProbeChains chains = { false, 0, false, 0, false };
+    Py_ssize_t npaths = 0;
+    Py_ssize_t remaining = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O|pi", kwlist, &py_paths, &dryrun, &workers))
+        return NULL;
+
+    paths = PySequence_Tuple (py_paths);
+    if (!paths)
+        return NULL;
+
+    result = PyDict_New ();
+    if (!result) {
+        Py_DECREF (paths);
+        return NULL;
+    }
+
+    npaths = PyTuple_GET_SIZE (paths);
+    if (npaths == 0) {
+        Py_DECREF (paths);
+        return result;
+    }
+
+    jobs = calloc (npaths, sizeof (WipeManyJob *));
+    if (!jobs) {
+        Py_DECREF (paths);
+        Py_DECREF (result);
+        return PyErr_NoMemory ();
+    }
+
+    job_queue_init (&done);
+
+    for (Py_ssize_t i = 0; i < npaths; i++) {
+        jobs[i] = probe_path_job_new (sizeof (WipeManyJob), offsetof (WipeManyJob, task),
+                                      PyTuple_GET_ITEM (paths, i), i, &chains);
+        if (!jobs[i])
+            goto error;
+
+        jobs[i]->job.run = wipe_many_job_run;
+        jobs[i]->job.free = wipe_many_job_free;
+        jobs[i]->dryrun = dryrun;
+    }
+
+    if (workers < 1)
+        workers = worker_pool_default_size ();
+    if (workers > npaths)
+        workers = npaths;
+
+    pool = worker_pool_new (workers);
+    if (!pool) {
+        PyErr_SetString (PyExc_RuntimeError, "Failed to start worker threads");
+        goto error;
+    }
+
+    for (Py_ssize_t i = 0; i < npaths; i++)
+        worker_pool_submit (pool, (Job *) jobs[i], &done);
+
+    /* jobs are owned by the pool and the done queue now */
+    for (remaining = npaths; remaining > 0; ) {
+        Py_BEGIN_ALLOW_THREADS
+        job = (WipeManyJob *) job_queue_pop (&done, 100);
+        Py_END_ALLOW_THREADS
+
+        if (!job) {
+            if (PyErr_CheckSignals () < 0)
+                goto interrupted;
+            continue;
+        }
+        remaining--;
+
+        /* memoized results of the wiped device are out of date */
+        if (_Probe_memo_forget (job->diskseq) < 0) {
+            wipe_many_job_free ((Job *) job);
+            goto interrupted;
+        }
+
+        path = PyTuple_GET_ITEM (paths, job->task.index);
+        report = wipe_many_job_result (job, path);
+        wipe_many_job_free ((Job *) job);
+        if (!report || PyDict_SetItem (result, path, report) < 0) {
+            Py_XDECREF (report);
+            goto interrupted;
+        }
+        Py_DECREF (report);
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    worker_pool_free (pool);
+    Py_END_ALLOW_THREADS
+    job_queue_destroy (&done);
+    free (jobs);
+    Py_DECREF (paths);
+
+    return result;
+
+interrupted:
+    /* running wipes are finished, the ones that didn't start yet are dropped */
+    Py_BEGIN_ALLOW_THREADS
+    worker_pool_free (pool);
+    Py_END_ALLOW_THREADS
+    job_queue_destroy (&done);
+    /* the finished wipes are not reported, don't keep any of their memoized results */
+    if (!dryrun)
+        _Probe_memo_clear ();
+    free (jobs);
+    Py_DECREF (paths);
+    Py_DECREF (result);
+
+    return NULL;
+
+error:
+    for (Py_ssize_t i = 0; i < npaths; i++)
+        free (jobs[i]);
+    free (jobs);
+    job_queue_destroy (&done);
+    Py_DECREF (paths);
+    Py_DECREF (result);
+
+    return NULL;
+}
+
+/*********************** PROBE_MANY_ASYNC ***********************/
+/* Results are delivered on the event loop thread, either directly to a waiting
+ * __anext__ future or stored in 'ready' until the next __anext__ call. */
+typedef struct {
+    PyObject_HEAD
+    PyObject *paths;
+    PyObject *ready;
+    PyObject *waiters;
+    Py_ssize_t pending;
+} ProbeManyAsyncObject;
+
+typedef struct {
+    AsyncJob async;
+    ProbeManyAsyncObject *iter;
+    ProbePathTask task;
+} ProbeManyAsyncJob;
+
+static void ProbeManyAsync_dealloc (ProbeManyAsyncObject *self) {
+    Py_XDECREF (self->paths);
+    Py_XDECREF (self->ready);
+    Py_XDECREF (self->waiters);
+
+    Py_TYPE (self)->tp_free ((PyObject *) self);
+}
+
+/* sets result (or exception if 'exception' is true) of the first waiter that wasn't cancelled,
+ * returns 1 if the value was delivered, 0 if there is no waiter and -1 on error */
+static int probe_many_async_wake (ProbeManyAsyncObject *self, PyObject *value, bool exception) {
+    PyObject *future = NULL;
+    PyObject *done = NULL;
+    PyObject *ret = NULL;
+    int is_done = 0;
+
+    while (PyList_GET_SIZE (self->waiters) > 0) {
+        future = PyList_GET_ITEM (self->waiters, 0);
+        Py_INCREF (future);
+        if (PySequence_DelItem (self->waiters, 0) < 0) {
+            Py_DECREF (future);
+            return -1;
+        }
+
+        done = PyObject_CallMethod (future, "done", NULL);
+        if (!done) {
+            Py_DECREF (future);
+            return -1;
+        }
+        is_done = PyObject_IsTrue (done);
+        Py_DECREF (done);
+
+        if (!is_done) {
+            ret = PyObject_CallMethod (future, exception ? "set_exception" : "set_result", "(O)", value);
+            Py_DECREF (future);
+            if (!ret)
+                return -1;
+            Py_DECREF (ret);
+            return 1;
+        }
+        Py_DECREF (future);
+    }
+
+    return 0;
+}
+
+static PyObject *ProbeManyAsync_anext (ProbeManyAsyncObject *self) {
+    PyObject *loop = NULL;
+    PyObject *future = NULL;
+    PyObject *item = NULL;
+    PyObject *ret = NULL;
+
+    loop = _Async_get_running_loop ();
+    if (!loop)
+        return NULL;
+
+    future = PyObject_CallMethod (loop, "create_future", NULL);
+    Py_DECREF (loop);
+    if (!future)
+        return NULL;
+
+    if (PyList_GET_SIZE (self->ready) > 0) {
+        item = PyList_GET_ITEM (self->ready, 0);
+        Py_INCREF (item);
+        if (PySequence_DelItem (self->ready, 0) < 0) {
+            Py_DECREF (item);
+            Py_DECREF (future);
+            return NULL;
+        }
+        ret = PyObject_CallMethod (future, "set_result", "(O)", item);
+        Py_DECREF (item);
+    } else if (self->pending == 0)
+        ret = PyObject_CallMethod (future, "set_exception", "(O)", PyExc_StopAsyncIteration);
+    else {
+        if (PyList_Append (self->waiters, future) < 0) {
+            Py_DECREF (future);
+            return NULL;
+        }
+        return future;
+    }
+
+    if (!ret) {
+        Py_DECREF (future);
+        return NULL;
+    }
+    Py_DECREF (ret);
+
+    return future;
+}
+
+static PyAsyncMethods ProbeManyAsync_async_methods = {
+    .am_aiter = PyObject_SelfIter,
+    .am_anext = (unaryfunc) ProbeManyAsync_anext,
+};
+
+static PyTypeObject ProbeManyAsyncType = {
+    PyVarObject_HEAD_INIT (NULL, 0)
+    .tp_name = "blkid.ProbeManyAsync",
+    .tp_basicsize = sizeof (ProbeManyAsyncObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_dealloc = (destructor) ProbeManyAsync_dealloc,
+    .tp_as_async = &ProbeManyAsync_async_methods,
+};
+
+static void probe_many_async_job_run (Job *job) {
+    probe_path_task_run (&(((ProbeManyAsyncJob *) job)->task));
+}
+
+static PyObject *probe_many_async_job_complete (AsyncJob *job) {
+    ProbeManyAsyncJob *pjob = (ProbeManyAsyncJob *) job;
+    ProbeManyAsyncObject *iter = pjob->iter;
+    PyObject *tuple = NULL;
+    int ret = 0;
+
+    iter->pending--;
+
+    tuple = probe_path_task_result (&(pjob->task), iter->paths);
+    if (tuple) {
+        ret = probe_many_async_wake (iter, tuple, false);
+        if (ret == 0)
+            ret = PyList_Append (iter->ready, tuple);
+        Py_DECREF (tuple);
+    } else
+        ret = -1;
+
+    /* everything was delivered, nobody else will wake up the remaining waiters */
+    if (iter->pending == 0 && ret >= 0) {
+        while ((ret = probe_many_async_wake (iter, PyExc_StopAsyncIteration, true)) > 0)
+            ;
+    }
+
+    if (ret < 0)
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+static void probe_many_async_job_free (Job *job) {
+    ProbeManyAsyncJob *pjob = (ProbeManyAsyncJob *) job;
+
+    _Async_job_clear ((AsyncJob *) job);
+    Py_XDECREF (pjob->iter);
+    free (pjob->task.values);
+    free (pjob);
+}
+
+PyDoc_STRVAR(Blkid_probe_many_async__doc__,
+"probe_many_async (paths, superblocks=True, partitions=False, topology=False, superblocks_flags=blkid.SUBLKS_DEFAULT, partitions_flags=0)\n\n"
+"Asynchronous variant of probe_many(), must be called from a running asyncio event loop.\n"
+"Returns an asynchronous iterator yielding (path, result) tuples in completion order, see "
+"probe_many() for details. Devices are probed on a native worker pool shared with the "
+"Probe.*_async() methods, the event loop is notified using an eventfd so no executor "
+"threads are used.");
+static PyObject *Blkid_probe_many_async (PyObject *self UNUSED, PyObject *args, PyObject *kwargs) {
+    PyObject *py_paths = NULL;
+    ProbeChains chains = { true, BLKID_SUBLKS_DEFAULT, false, 0, false };
+    char *kwlist[] = { "paths", "superblocks", "partitions", "topology", "superblocks_flags", "partitions_flags", NULL };
+    ProbeManyAsyncObject *result = NULL;
+    ProbeManyAsyncJob *job = NULL;
+    PyObject *ret = NULL;
+    int superblocks = 1;
+    int partitions = 0;
+    int topology = 0;
+
+    if (!PyArg_ParseTupleAndKeywords (args, kwargs, "O|pppii", kwlist, &py_paths,
+                                      &superblocks, &partitions, &topology,
+                                      &(chains.superblocks_flags), &(chains.partitions_flags)))
+        return NULL;
+    chains.superblocks = superblocks;
+    chains.partitions = partitions;
+    chains.topology = topology;
+
+    result = PyObject_New (ProbeManyAsyncObject, &ProbeManyAsyncType);
+    if (!result) {
+        PyErr_SetString (PyExc_MemoryError, "Failed to create a new ProbeManyAsync object");
+        return NULL;
+    }
+    result->pending = 0;
+    result->ready = PyList_New (0);
+    result->waiters = PyList_New (0);
+    result->paths = PySequence_Tuple (py_paths);
+    if (!result->ready || !result->waiters || !result->paths) {
+        Py_DECREF (result);
+        return NULL;
+    }
+
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE (result->paths); i++) {
+        job = probe_path_job_new (sizeof (ProbeManyAsyncJob), offsetof (ProbeManyAsyncJob, task),
+                                  PyTuple_GET_ITEM (result->paths, i), i, &chains);
+        if (!job) {
+            Py_DECREF (result);
+            return NULL;
+        }
+
+        job->async.job.run = probe_many_async_job_run;
+        job->async.job.free = probe_many_async_job_free;
+        job->async.complete = probe_many_async_job_complete;
+        Py_INCREF (result);
+        job->iter = result;
+
+        /* jobs already submitted keep the iterator alive until they are done */
+        ret = _Async_submit ((AsyncJob *) job, false);
+        if (!ret) {
+            Py_DECREF (result);
+            return NULL;
+        }
+        Py_DECREF (ret);
+        result->pending++;
+    }
+
+    return (PyObject *) result;
+}
+
 static PyMethodDef BlkidMethods[] = {
     {"init_debug", (PyCFunction)(void(*)(void)) Blkid_init_debug, METH_VARARGS|METH_KEYWORDS, Blkid_init_debug__doc__},
     {"known_fstype", (PyCFunction)(void(*)(void)) Blkid_known_fstype, METH_VARARGS|METH_KEYWORDS, Blkid_known_fstype__doc__},
@@ -484,6 +1261,12 @@ static PyMethodDef BlkidMethods[] = {
     {"superblocks", (PyCFunction) Blkid_superblocks, METH_NOARGS, Blkid_superblocks__doc__},
     {"evaluate_tag", (PyCFunction)(void(*)(void)) Blkid_evaluate_tag, METH_VARARGS|METH_KEYWORDS, Blkid_evaluate_tag__doc__},
     {"evaluate_spec", (PyCFunction)(void(*)(void)) Blkid_evaluate_spec, METH_VARARGS|METH_KEYWORDS, Blkid_evaluate_spec__doc__},
+    {"probe_many", (PyCFunction)(void(*)(void)) Blkid_probe_many, METH_VARARGS|METH_KEYWORDS, Blkid_probe_many__doc__},
+    {"probe_many_async", (PyCFunction)(void(*)(void)) Blkid_probe_many_async, METH_VARARGS|METH_KEYWORDS, Blkid_probe_many_async__doc__},
+    {"wipe_many", (PyCFunction)(void(*)(void)) Blkid_wipe_many, METH_VARARGS|METH_KEYWORDS, Blkid_wipe_many__doc__},
+    {"enable_probe_memo", (PyCFunction)(void(*)(void)) Blkid_enable_probe_memo, METH_VARARGS|METH_KEYWORDS, Blkid_enable_probe_memo__doc__},
+    {"clear_probe_memo", (PyCFunction) Blkid_clear_probe_memo, METH_NOARGS, Blkid_clear_probe_memo__doc__},
+    {"check_alignment", (PyCFunction)(void(*)(void)) Blkid_check_alignment, METH_VARARGS|METH_KEYWORDS, Blkid_check_alignment__doc__},
     {NULL, NULL, 0, NULL}
 };
 
@@ -507,6 +1290,12 @@ PyMODINIT_FUNC PyInit_blkid (void) {
     if (PyType_Ready (&PartlistType) < 0)
         return NULL;
 
+    if (PyType_Ready (&PartlistColumnType) < 0)
+        return NULL;
+
+    if (PyType_Ready (&PartlistSnapshotType) < 0)
+        return NULL;
+
     if (PyType_Ready (&ParttableType) < 0)
         return NULL;
 
@@ -519,6 +1308,33 @@ PyMODINIT_FUNC PyInit_blkid (void) {
     if (PyType_Ready (&DeviceType) < 0)
         return NULL;
 
+    if (PyType_Ready (&CacheSnapshotType) < 0)
+        return NULL;
+
+    if (PyType_Ready (&CacheDeviceIteratorType) < 0)
+        return NULL;
+
+    if (PyType_Ready (&ProbeResultType) < 0)
+        return NULL;
+
+    if (PyType_Ready (&ProbeValueBufferType) < 0)
+        return NULL;
+
+    if (PyType_Ready (&ProbeIteratorType) < 0)
+        return NULL;
+
+    if (_Probe_init_tags () < 0)
+        return NULL;
+
+    if (PyType_Ready (&ProbeManyType) < 0)
+        return NULL;
+
+    if (PyType_Ready (&ProbeManyAsyncType) < 0)
+        return NULL;
+
+    if (PyType_Ready (&AsyncContextType) < 0)
+        return NULL;
+
     module = PyModule_Create (&blkidmodule);
     if (!module)
         return NULL;
@@ -627,5 +1443,50 @@ PyMODINIT_FUNC PyInit_blkid (void) {
         return NULL;
     }
 
+    Py_INCREF (&ProbeResultType);
+    if (PyModule_AddObject (module, "ProbeResult", (PyObject *) &ProbeResultType) < 0) {
+        Py_DECREF (&ProbeType);
+        Py_DECREF (&TopologyType);
+        Py_DECREF (&PartlistType);
+        Py_DECREF (&ParttableType);
+        Py_DECREF (&PartitionType);
+        Py_DECREF (&CacheType);
+        Py_DECREF (&DeviceType);
+        Py_DECREF (&ProbeResultType);
+        Py_DECREF (module);
+        return NULL;
+    }
+
+    Py_INCREF (&ProbeTagsType);
+    if (PyModule_AddObject (module, "ProbeTags", (PyObject *) &ProbeTagsType) < 0) {
+        Py_DECREF (&ProbeType);
+        Py_DECREF (&TopologyType);
+        Py_DECREF (&PartlistType);
+        Py_DECREF (&ParttableType);
+        Py_DECREF (&PartitionType);
+        Py_DECREF (&CacheType);
+        Py_DECREF (&DeviceType);
+        Py_DECREF (&ProbeResultType);
+        Py_DECREF (&ProbeTagsType);
+        Py_DECREF (module);
+        return NULL;
+    }
+
+    Py_INCREF (&CacheSnapshotType);
+    if (PyModule_AddObject (module, "CacheSnapshot", (PyObject *) &CacheSnapshotType) < 0) {
+        Py_DECREF (&ProbeType);
+        Py_DECREF (&TopologyType);
+        Py_DECREF (&PartlistType);
+        Py_DECREF (&ParttableType);
+        Py_DECREF (&PartitionType);
+        Py_DECREF (&CacheType);
+        Py_DECREF (&DeviceType);
+        Py_DECREF (&ProbeResultType);
+        Py_DECREF (&ProbeTagsType);
+        Py_DECREF (&CacheSnapshotType);
+        Py_DECREF (module);
+        return NULL;
+    }
+
     return module;
 }
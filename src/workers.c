@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2020  Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "workers.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*********************** JOB QUEUE ***********************/
+void job_queue_init (JobQueue *queue) {
+    pthread_mutex_init (&(queue->mutex), NULL);
+    pthread_cond_init (&(queue->cond), NULL);
+    queue->head = NULL;
+    queue->tail = NULL;
+    queue->closed = false;
+    queue->notify_fd = -1;
+}
+
+/* frees all jobs still in the queue */
+void job_queue_destroy (JobQueue *queue) {
+    Job *job = NULL;
+
+    while (queue->head) {
+        job = queue->head;
+        queue->head = job->next;
+        job->free (job);
+    }
+    queue->tail = NULL;
+
+    pthread_cond_destroy (&(queue->cond));
+    pthread_mutex_destroy (&(queue->mutex));
+}
+
+void job_queue_push (JobQueue *queue, Job *job) {
+    job->next = NULL;
+
+    pthread_mutex_lock (&(queue->mutex));
+    if (queue->tail)
+        queue->tail->next = job;
+    else
+        queue->head = job;
+    queue->tail = job;
+    pthread_cond_signal (&(queue->cond));
+
+    /* notify while still holding the lock, the job can't be taken (and its owner
+     * possibly freed together with the fd) before the notification is done */
+    if (queue->notify_fd >= 0) {
+        uint64_t one = 1;
+        while (write (queue->notify_fd, &one, sizeof (one)) < 0 && errno == EINTR)
+            ;
+    }
+    pthread_mutex_unlock (&(queue->mutex));
+}
+
+/* Returns the first job from the queue waiting at most 'timeout_ms' (-1 means
+ * wait forever, 0 don't wait at all). Returns NULL on timeout or when the queue
+ * was closed, jobs left in a closed queue are freed by job_queue_destroy(). */
+Job *job_queue_pop (JobQueue *queue, int timeout_ms) {
+    Job *job = NULL;
+    struct timespec deadline;
+    int ret = 0;
+
+    if (timeout_ms > 0) {
+        clock_gettime (CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock (&(queue->mutex));
+    while (!queue->head && !queue->closed && timeout_ms != 0 && ret == 0) {
+        if (timeout_ms < 0)
+            pthread_cond_wait (&(queue->cond), &(queue->mutex));
+        else
+            ret = pthread_cond_timedwait (&(queue->cond), &(queue->mutex), &deadline);
+    }
+
+    if (queue->head && !queue->closed) {
+        job = queue->head;
+        queue->head = job->next;
+        if (!queue->head)
+            queue->tail = NULL;
+        job->next = NULL;
+    }
+    pthread_mutex_unlock (&(queue->mutex));
+
+    return job;
+}
+
+void job_queue_close (JobQueue *queue) {
+    pthread_mutex_lock (&(queue->mutex));
+    queue->closed = true;
+    pthread_cond_broadcast (&(queue->cond));
+    pthread_mutex_unlock (&(queue->mutex));
+}
+
+/*********************** WORKER POOL ***********************/
+static void *worker_pool_thread (void *data) {
+    WorkerPool *pool = (WorkerPool *) data;
+    Job *job = NULL;
+
+    while ((job = job_queue_pop (&(pool->pending), -1)) != NULL) {
+        job->run (job);
+
+        if (job->done)
+            job_queue_push (job->done, job);
+        else
+            job->free (job);
+    }
+
+    return NULL;
+}
+
+WorkerPool *worker_pool_new (int nthreads) {
+    WorkerPool *pool = NULL;
+    sigset_t blocked;
+    sigset_t orig;
+
+    if (nthreads < 1)
+        nthreads = worker_pool_default_size ();
+
+    pool = malloc (sizeof (WorkerPool));
+    if (!pool)
+        return NULL;
+
+    pool->threads = malloc (sizeof (pthread_t) * nthreads);
+    if (!pool->threads) {
+        free (pool);
+        return NULL;
+    }
+
+    job_queue_init (&(pool->pending));
+
+    /* signals should be always handled by the Python threads, workers inherit the mask */
+    sigfillset (&blocked);
+    pthread_sigmask (SIG_SETMASK, &blocked, &orig);
+
+    for (pool->nthreads = 0; pool->nthreads < nthreads; pool->nthreads++) {
+        if (pthread_create (&(pool->threads[pool->nthreads]), NULL, worker_pool_thread, pool) != 0)
+            break;
+    }
+
+    pthread_sigmask (SIG_SETMASK, &orig, NULL);
+
+    if (pool->nthreads == 0) {
+        job_queue_destroy (&(pool->pending));
+        free (pool->threads);
+        free (pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/* 'done' is the queue the job is moved to after it was run, if NULL the job is freed */
+void worker_pool_submit (WorkerPool *pool, Job *job, JobQueue *done) {
+    job->done = done;
+    job_queue_push (&(pool->pending), job);
+}
+
+/* Jobs that are already running are finished, jobs that didn't start yet are
+ * dropped. Must be called without the GIL if the jobs may need it. */
+void worker_pool_free (WorkerPool *pool) {
+    job_queue_close (&(pool->pending));
+
+    for (int i = 0; i < pool->nthreads; i++)
+        pthread_join (pool->threads[i], NULL);
+
+    job_queue_destroy (&(pool->pending));
+    free (pool->threads);
+    free (pool);
+}
+
+int worker_pool_default_size (void) {
+    long ncpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (ncpus < 1)
+        return 1;
+
+    return (int) ncpus;
+}
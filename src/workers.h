@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2020  Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/* Jobs are embedded as the first member of a bigger structure holding the job
+ * specific data. 'run' is called on a worker thread without the GIL, so it must
+ * not touch any Python objects. */
+typedef struct Job Job;
+typedef struct JobQueue JobQueue;
+
+struct Job {
+    Job *next;
+    void (*run) (Job *job);
+    void (*free) (Job *job);
+    JobQueue *done;
+};
+
+struct JobQueue {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    Job *head;
+    Job *tail;
+    bool closed;
+    int notify_fd;  /* eventfd signalled for every pushed job, -1 if not used */
+};
+
+void job_queue_init (JobQueue *queue);
+void job_queue_destroy (JobQueue *queue);
+void job_queue_push (JobQueue *queue, Job *job);
+Job *job_queue_pop (JobQueue *queue, int timeout_ms);
+void job_queue_close (JobQueue *queue);
+
+typedef struct {
+    JobQueue pending;
+    pthread_t *threads;
+    int nthreads;
+} WorkerPool;
+
+WorkerPool *worker_pool_new (int nthreads);
+void worker_pool_submit (WorkerPool *pool, Job *job, JobQueue *done);
+void worker_pool_free (WorkerPool *pool);
+int worker_pool_default_size (void);
+
+#endif /* WORKERS_H */
@@ -96,3 +96,30 @@ class BlkidTestCase(unittest.TestCase):
 
         device = blkid.evaluate_spec("LABEL=definitely-not-a-valid-label")
         self.assertIsNone(device)
+
+    def test_probe_many(self):
+        results = dict(blkid.probe_many([self.loop_dev, "/not/a/device"],
+                                        superblocks_flags=blkid.SUBLKS_TYPE | blkid.SUBLKS_UUID,
+                                        topology=True, workers=2))
+        self.assertEqual(len(results), 2)
+
+        self.assertEqual(results[self.loop_dev]["TYPE"], "ext3")
+        self.assertEqual(results[self.loop_dev]["UUID"], "35f66dab-477e-4090-a872-95ee0e493ad6")
+        self.assertEqual(results[self.loop_dev]["LOGICAL_SECTOR_SIZE"], "512")
+        self.assertNotIn("LABEL", results[self.loop_dev])
+
+        self.assertIsInstance(results["/not/a/device"], FileNotFoundError)
+
+        # same device many times, results should be in completion order but all there
+        results = list(blkid.probe_many([self.loop_dev] * 32, workers=4))
+        self.assertEqual(len(results), 32)
+        for path, result in results:
+            self.assertEqual(path, self.loop_dev)
+            self.assertEqual(result["LABEL"], "test-ext3")
+
+        self.assertFalse(list(blkid.probe_many([])))
+
+        # abandoned iteration must not block or leak
+        it = blkid.probe_many([self.loop_dev] * 32, workers=2)
+        next(it)
+        del it
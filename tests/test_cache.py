@@ -1,6 +1,8 @@
 import os
+import time
 import unittest
 import tempfile
+import threading
 
 from . import utils
 
@@ -64,5 +66,280 @@ class CacheTestCase(unittest.TestCase):
         # we don't have new devices, so just a sanity check
         cache.probe_all(new_only=True)
 
+    def test_lookup(self):
+        cache = blkid.Cache(filename=self.cache_file)
+        cache.probe_all()
+
+        device = cache.lookup("LABEL", "test-ext3")
+        self.assertIsNotNone(device)
+        self.assertEqual(device.devname, self.loop_dev)
+        self.assertEqual(cache.lookup("UUID", "35f66dab-477e-4090-a872-95ee0e493ad6").devname, self.loop_dev)
+        self.assertIsNone(cache.lookup("LABEL", "not-in-cache"))
+        self.assertIsNone(cache.lookup("NOT-A-TAG", "test-ext3"))
+
+        # same devices as the list, created lazily
+        devices = cache.iter_devices()
+        self.assertEqual([d.devname for d in devices], [d.devname for d in cache.devices])
+        self.assertEqual(list(devices), [])
+
+        devices = cache.iter_devices()
+        next(devices)
+        cache.gc()
+        with self.assertRaises(RuntimeError):
+            next(devices)
+
+        # indexes are rebuilt after the cache changed
+        self.assertEqual(cache.lookup("LABEL", "test-ext3").devname, self.loop_dev)
+        cache.close()
+        with self.assertRaises(ValueError):
+            cache.lookup("LABEL", "test-ext3")
+
+    def test_resolve_many(self):
+        cache = blkid.Cache(filename=self.cache_file)
+        cache.probe_all()
+
+        specs = ["LABEL=test-ext3", 'UUID="35f66dab-477e-4090-a872-95ee0e493ad6"', "LABEL=not-in-cache",
+                 self.loop_dev]
+        self.assertEqual(cache.resolve_many(specs), {specs[0]: self.loop_dev, specs[1]: self.loop_dev,
+                                                     specs[2]: None, specs[3]: self.loop_dev})
+        self.assertEqual(cache.resolve_many([]), {})
+
+        # evaluation using the already loaded cache
+        self.assertEqual(blkid.evaluate_tag("LABEL", "test-ext3", cache=cache), self.loop_dev)
+        self.assertEqual(blkid.evaluate_spec("LABEL=test-ext3", cache=cache), self.loop_dev)
+        self.assertIsNone(blkid.evaluate_spec("LABEL=not-in-cache", cache=cache))
+        self.assertEqual(cache.lookup("LABEL", "test-ext3").devname, self.loop_dev)
+
+        with self.assertRaises(TypeError):
+            blkid.evaluate_tag("LABEL", "test-ext3", cache="cache")
+
+        cache.close()
+        with self.assertRaises(ValueError):
+            blkid.evaluate_spec("LABEL=test-ext3", cache=cache)
+
+    def test_probe_all_workers(self):
+        with self.assertRaises(ValueError):
+            blkid.Cache(filename=self.cache_file).probe_all(workers=-1)
+
+        with tempfile.NamedTemporaryFile() as serial_file, tempfile.NamedTemporaryFile() as parallel_file:
+            serial = blkid.Cache(filename=serial_file.name)
+            serial.probe_all()
+
+            parallel = blkid.Cache(filename=parallel_file.name)
+            parallel.probe_all(workers=4)
+
+            # same devices found as with the serial libblkid scan
+            self.assertEqual(sorted(d.devname for d in parallel.devices),
+                             sorted(d.devname for d in serial.devices))
+
+            device = parallel.get_device(self.loop_dev)
+            self.assertIsNotNone(device)
+            self.assertEqual(device.tags["LABEL"], "test-ext3")
+
+            # nothing new since the last scan
+            parallel.probe_all(new_only=True, workers=2)
+            self.assertIsNotNone(parallel.find_device("LABEL", "test-ext3"))
+
+            # other threads run during the scan, but can't use the cache
+            def _scan():
+                for _i in range(5):
+                    parallel.probe_all(workers=2)
+
+            thread = threading.Thread(target=_scan)
+            thread.start()
+            while thread.is_alive():
+                try:
+                    self.assertEqual(parallel.get_device(self.loop_dev).devname, self.loop_dev)
+                except RuntimeError as e:
+                    self.assertEqual(str(e), "Cache is being updated by another thread")
+            thread.join()
+            self.assertIsNotNone(parallel.find_device("LABEL", "test-ext3"))
+
+            serial.close()
+            parallel.close()
+
+    def test_verify_all(self):
+        test_dir = os.path.abspath(os.path.dirname(__file__))
+        loop_dev = utils.loop_setup(os.path.join(test_dir, self.test_image))
+        try:
+            with tempfile.NamedTemporaryFile() as cache_file:
+                cache = blkid.Cache(filename=cache_file.name)
+                cache.probe_all()
+                self.assertIsNotNone(cache.get_device(loop_dev))
+
+                with self.assertRaises(ValueError):
+                    cache.verify_all(max_age=-1)
+
+                counts = cache.verify_all(workers=2)
+                self.assertEqual(counts["removed"], 0)
+                self.assertEqual(counts["refreshed"] + counts["unchanged"], len(cache.devices))
+                self.assertGreaterEqual(counts["unchanged"], 2)
+
+                # everything was verified just now
+                counts = cache.verify_all(max_age=3600)
+                self.assertEqual(counts, {"refreshed": 0, "unchanged": 0, "removed": 0, "stale": 0})
+
+                detached, loop_dev = loop_dev, None
+                utils.loop_teardown(detached)
+
+                counts = cache.verify_all()
+                self.assertEqual(counts["removed"], 1)
+                self.assertNotIn(detached, [d.devname for d in cache.devices])
+                cache.close()
+        finally:
+            if loop_dev:
+                utils.loop_teardown(loop_dev)
+
+    def test_verify_all_tags(self):
+        with tempfile.NamedTemporaryFile() as image, tempfile.NamedTemporaryFile() as cache_file:
+            # a copy of the image decompressed by setUpClass, the test writes to it
+            with open(os.path.join(os.path.dirname(__file__), self.test_image[:-3]), "rb") as f:
+                image.write(f.read())
+            image.flush()
+
+            ret, loop_dev = utils.run_command("losetup --show -f %s" % image.name)
+            if ret != 0:
+                self.skipTest("failed to create loop device: %s" % loop_dev)
+            self.addCleanup(utils.loop_teardown, loop_dev)
+
+            cache = blkid.Cache(filename=cache_file.name)
+            cache.probe_all()
+            self.assertEqual(cache.get_device(loop_dev)["BLOCK_SIZE"], "1024")
+            self.assertEqual(cache.verify_all(workers=2)["refreshed"], 0)
+
+            # a tag other than type, UUID or label changed (s_log_block_size)
+            with open(loop_dev, "r+b") as f:
+                f.seek(1024 + 24)
+                f.write((2).to_bytes(4, "little"))
+
+            counts = cache.verify_all(workers=2)
+            self.assertEqual(counts["refreshed"], 1)
+            self.assertEqual(counts["stale"], 0)
+            self.assertEqual(cache.get_device(loop_dev)["BLOCK_SIZE"], "4096")
+            cache.close()
+
+    def test_device_tags(self):
+        cache = blkid.Cache(filename=self.cache_file)
+        cache.probe_all()
+
+        device = cache.get_device(self.loop_dev)
+        self.assertEqual(device["LABEL"], "test-ext3")
+        self.assertIn("UUID", device)
+        self.assertNotIn("NOT_A_TAG", device)
+        with self.assertRaises(KeyError):
+            device["NOT_A_TAG"]
+        with self.assertRaises(TypeError):
+            device[1]
+
+        # changes of the returned dictionary don't affect the device
+        tags = device.tags
+        tags["LABEL"] = "changed"
+        self.assertEqual(device.tags["LABEL"], "test-ext3")
+        self.assertEqual(device["LABEL"], "test-ext3")
+
+        # still valid after the device was verified again
+        device.verify()
+        self.assertEqual(device.tags["TYPE"], "ext3")
+        self.assertEqual(device["TYPE"], "ext3")
+
+    def test_uevents(self):
+        cache = blkid.Cache(filename=self.cache_file)
+        with self.assertRaises(ValueError):
+            cache.apply_uevents()
+
+        cache.watch()
+        self.assertGreaterEqual(cache.fileno(), 0)
+
+        test_dir = os.path.abspath(os.path.dirname(__file__))
+        loop_dev = utils.loop_setup(os.path.join(test_dir, self.test_image))
+        try:
+            # the new device is added without probing all devices
+            events = []
+            deadline = time.monotonic() + 5
+            while loop_dev not in (devname for _action, devname in events) and time.monotonic() < deadline:
+                events += cache.apply_uevents(timeout=1)
+
+            self.assertIn(loop_dev, [devname for _action, devname in events])
+            device = cache.get_device(loop_dev)
+            self.assertIsNotNone(device)
+            self.assertEqual(device.tags["LABEL"], "test-ext3")
+        finally:
+            utils.loop_teardown(loop_dev)
+
+        # detached loop device has no filesystem anymore
+        deadline = time.monotonic() + 5
+        while cache.get_device(loop_dev) and time.monotonic() < deadline:
+            cache.apply_uevents(timeout=1)
+        self.assertIsNone(cache.get_device(loop_dev))
+
+        cache.close()
+        with self.assertRaises(ValueError):
+            cache.fileno()
+
+    def test_save_close(self):
+        with blkid.Cache(filename=self.cache_file) as cache:
+            cache.probe_all()
+            device = cache.get_device(self.loop_dev)
+            self.assertIsNotNone(device)
+
+            # devices stay usable after the cache is reloaded
+            cache.save()
+            self.assertFalse(cache.closed)
+            self.assertEqual(device.tags["LABEL"], "test-ext3")
+
+        self.assertTrue(cache.closed)
+        with self.assertRaises(ValueError):
+            cache.devices
+        with self.assertRaises(ValueError):
+            device.tags
+        self.assertEqual(device.devname, self.loop_dev)
+        cache.close()
+
+        with open(self.cache_file) as f:
+            self.assertIn(self.loop_dev, f.read())
+
+        cache = blkid.Cache(filename=self.cache_file)
+        device = cache.get_device(self.loop_dev)
+        self.assertIsNotNone(device)
+        self.assertEqual(device.tags["LABEL"], "test-ext3")
+
+        with self.assertRaises(ValueError):
+            blkid.Device().tags
+
+    def test_snapshot(self):
+        cache = blkid.Cache(filename=self.cache_file)
+        cache.probe_all()
+
+        with tempfile.TemporaryDirectory() as tmpdir:
+            path = os.path.join(tmpdir, "blkid.snapshot")
+            cache.save_snapshot(path)
+
+            with blkid.CacheSnapshot(path) as snapshot:
+                self.assertEqual(len(snapshot), len(cache.devices))
+                self.assertEqual(snapshot.devices, [d.devname for d in cache.devices])
+                self.assertEqual(snapshot.get_device(self.loop_dev), cache.get_device(self.loop_dev).tags)
+                self.assertIsNone(snapshot.get_device("/dev/not-in-cache"))
+                self.assertEqual(snapshot.find_device("LABEL", "test-ext3"), self.loop_dev)
+                self.assertIsNone(snapshot.find_device("LABEL", "not-in-cache"))
+
+            self.assertTrue(snapshot.closed)
+            with self.assertRaises(ValueError):
+                snapshot.get_device(self.loop_dev)
+
+            # device record offset (right after the 24 bytes header) overflowing with the record size
+            with open(path, "r+b") as f:
+                f.seek(24)
+                f.write(b"\xfe" + b"\xff" * 7)
+            with self.assertRaises(ValueError):
+                blkid.CacheSnapshot(path)
+
+            with open(path, "r+b") as f:
+                f.write(b"garbage!")
+            with self.assertRaises(ValueError):
+                blkid.CacheSnapshot(path)
+
+            with self.assertRaises(OSError):
+                blkid.CacheSnapshot(os.path.join(tmpdir, "missing"))
+
 if __name__ == "__main__":
     unittest.main()
@@ -1,4 +1,6 @@
+import gc
 import os
+import tempfile
 import unittest
 
 from . import utils
@@ -34,6 +36,300 @@ class PartitionsTestCase(unittest.TestCase):
         plist = pr.partitions
         self.assertEqual(plist.numof_partitions, 5)
 
+    def test_partlist_sequence(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+
+        pr.enable_partitions(True)
+
+        ret = pr.do_safeprobe()
+        self.assertTrue(ret)
+
+        plist = pr.partitions
+        self.assertEqual(len(plist), 5)
+        self.assertEqual(plist[0].uuid, "1dcf10bc-637e-4c52-8203-087ae10a820b")
+        self.assertEqual(plist[-1].partno, plist[4].partno)
+        with self.assertRaises(IndexError):
+            plist[5]
+
+        parts = list(plist)
+        self.assertEqual(len(parts), 5)
+        self.assertEqual([p.start for p in parts], [plist.get_partition(i).start for i in range(5)])
+
+        columns = plist.to_columns()
+        self.assertEqual(set(columns.keys()), {"start", "size", "partno", "type", "flags"})
+        for name, column in columns.items():
+            self.assertEqual(column.format, "Q" if name == "flags" else "q")
+            self.assertEqual(column.itemsize, 8)
+            self.assertTrue(column.readonly)
+            self.assertEqual(column.tolist(), [getattr(p, name) for p in parts])
+        self.assertEqual(columns["start"][0], 34)
+        self.assertEqual(columns["size"][0], 2014)
+
+    def test_partition_objects(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+
+        pr.enable_partitions(True)
+
+        ret = pr.do_safeprobe()
+        self.assertTrue(ret)
+
+        # one object per partition
+        plist = pr.partitions
+        self.assertIs(plist.get_partition(1), plist.get_partition(1))
+        self.assertIs(plist[1], plist.get_partition(1))
+        self.assertIs(plist.get_partition(0).table, plist.get_partition(0).table)
+
+        # getting the partitions again doesn't re-probe under existing objects
+        part = plist.get_partition(0)
+        table = part.table
+        del plist
+        gc.collect()
+        plist = pr.partitions
+        self.assertEqual(table.type, "gpt")
+        self.assertEqual(part.start, 34)
+        self.assertEqual(plist.get_partition(0).start, 34)
+
+        # partitions and tables keep the probe alive
+        part = plist.get_partition(0)
+        table = plist.table
+        del pr, plist
+        gc.collect()
+        self.assertEqual(part.start, 34)
+        self.assertEqual(table.type, "gpt")
+
+    def test_find_partition(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+
+        pr.enable_partitions(True)
+
+        ret = pr.do_safeprobe()
+        self.assertTrue(ret)
+
+        plist = pr.partitions
+        part = plist.find_by_uuid("1dcf10bc-637e-4c52-8203-087ae10a820b")
+        self.assertIs(part, plist.get_partition(0))
+        self.assertIs(plist.find_by_uuid("1DCF10BC-637E-4C52-8203-087AE10A820B"), part)
+        self.assertIsNone(plist.find_by_uuid("00000000-0000-0000-0000-000000000000"))
+
+        self.assertIs(plist.find_by_name("ThisIsName"), part)
+        self.assertIsNone(plist.find_by_name("NotAName"))
+
+    def test_find_partition_devno(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+
+        pr.enable_partitions(True)
+
+        ret = pr.do_safeprobe()
+        self.assertTrue(ret)
+
+        plist = pr.partitions
+        part = plist.get_partition(0)
+
+        # the whole disk is not a partition
+        self.assertIsNone(plist.find_by_devno(os.stat(self.loop_dev).st_rdev))
+
+        disk_name = os.path.basename(self.loop_dev)
+        sysfs_path = "/sys/block/%s/%s/dev" % (disk_name, disk_name + "p1")
+        if not os.path.exists(sysfs_path):
+            self.skipTest("partition devices of %s are not available (no partscan)" % self.loop_dev)
+
+        major, minor = utils.read_file(sysfs_path).strip().split(":")
+        devno = os.makedev(int(major), int(minor))
+        self.assertIs(plist.find_by_devno(devno), part)
+        self.assertIs(plist.find_by_devno(devno), part)
+
+    def test_partlist_snapshot(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+
+        pr.enable_partitions(True)
+
+        ret = pr.do_safeprobe()
+        self.assertTrue(ret)
+
+        snapshot = pr.partitions.snapshot()
+        other = pr.partitions.snapshot()
+        self.assertEqual(snapshot, other)
+        self.assertEqual(hash(snapshot), hash(other))
+
+        # valid without the probe
+        del pr
+        gc.collect()
+
+        self.assertEqual(len(snapshot), 5)
+        self.assertEqual(snapshot.type, "gpt")
+        self.assertEqual(snapshot.id, "dd27f98d-7519-4c9e-8041-f2bfa7b1ef61")
+        self.assertEqual(snapshot.offset, 512)
+
+        part = snapshot[0]
+        self.assertEqual(part["uuid"], "1dcf10bc-637e-4c52-8203-087ae10a820b")
+        self.assertEqual(part["type_string"], "ebd0a0a2-b9e5-4433-87c0-68b6b72699c7")
+        self.assertEqual(part["name"], "ThisIsName")
+        self.assertEqual(part["partno"], 1)
+        self.assertEqual(part["start"], 34)
+        self.assertEqual(part["size"], 2014)
+        self.assertEqual(part["flags"], 0)
+        self.assertTrue(part["is_primary"])
+        self.assertFalse(part["is_extended"])
+        self.assertEqual(snapshot[-1], snapshot[4])
+        with self.assertRaises(IndexError):
+            snapshot[5]
+
+        # a new probe of the same disk gives an equal snapshot
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+        pr.enable_partitions(True)
+        pr.set_partitions_flags(blkid.PARTS_ENTRY_DETAILS)
+        self.assertTrue(pr.do_safeprobe())
+        self.assertEqual(pr.partitions.snapshot(), snapshot)
+        self.assertIn(snapshot, {pr.partitions.snapshot()})
+
+    def test_partitions_stale(self):
+        with open(self.loop_dev, "rb") as f:
+            data = f.read()
+
+        pr = blkid.Probe()
+        pr.enable_partitions(True)
+        pr.set_buffer(data)
+        self.assertTrue(pr.do_safeprobe())
+
+        plist = pr.partitions
+        part = plist[0]
+        table = part.table
+        snapshot = plist.snapshot()
+
+        # probing again frees the partitions in libblkid, the old objects must not use them
+        pr.set_buffer(data)
+        self.assertTrue(pr.do_safeprobe())
+        self.assertIsNot(pr.partitions, plist)
+
+        with self.assertRaisesRegex(ValueError, "snapshot"):
+            table.id
+        with self.assertRaises(ValueError):
+            part.uuid
+        with self.assertRaises(ValueError):
+            part.table
+        with self.assertRaises(ValueError):
+            len(plist)
+        with self.assertRaises(ValueError):
+            plist.find_by_uuid("1dcf10bc-637e-4c52-8203-087ae10a820b")
+
+        # new objects and the snapshot work
+        self.assertEqual(pr.partitions.table.id, snapshot.id)
+        self.assertEqual(pr.partitions[0].uuid, snapshot[0]["uuid"])
+
+    def test_check_alignment(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+
+        pr.enable_partitions(True)
+
+        ret = pr.do_safeprobe()
+        self.assertTrue(ret)
+
+        report = blkid.check_alignment(pr)
+        self.assertEqual(report["alignment_offset"], pr.topology.alignment_offset)
+        self.assertEqual(report["minimum_io_size"], pr.topology.minimum_io_size)
+        self.assertEqual(report["optimal_io_size"], pr.topology.optimal_io_size)
+        self.assertEqual(report["physical_sector_size"], pr.topology.physical_sector_size)
+        self.assertEqual(report["granularity"], max(pr.topology.physical_sector_size, pr.topology.minimum_io_size))
+
+        # same check done in Python
+        expected = []
+        for part in pr.partitions:
+            offset = (part.start * 512 - report["alignment_offset"]) % report["granularity"]
+            if offset:
+                expected.append(part.partno)
+        self.assertEqual([m[0] for m in report["misaligned"]], expected)
+
+        with self.assertRaises(TypeError):
+            blkid.check_alignment(self.loop_dev)
+
+        with self.assertRaises(ValueError):
+            blkid.check_alignment(blkid.Probe())
+
+    def test_check_alignment_misaligned(self):
+        ver_code, _version, _date = blkid.get_library_version()
+        if ver_code < 2300:
+            self.skipTest("setting sector size requires libblkid >= 2.30")
+
+        # DOS partition table with partitions at sector 63 (misaligned) and 2048
+        mbr = bytearray(512)
+        for i, (start, size) in enumerate(((63, 1985), (2048, 4096))):
+            entry = 446 + i * 16
+            mbr[entry + 4] = 0x83
+            mbr[entry + 8:entry + 12] = start.to_bytes(4, "little")
+            mbr[entry + 12:entry + 16] = size.to_bytes(4, "little")
+        mbr[510:512] = b"\x55\xaa"
+
+        with tempfile.NamedTemporaryFile() as image:
+            image.write(mbr)
+            image.truncate(8 * 1024 * 1024)
+            image.flush()
+
+            # 4 KiB sectors give 4 KiB granularity, the table is read with 512-byte sectors
+            ret, loop_dev = utils.run_command("losetup --show --sector-size 4096 -f %s" % image.name)
+            if ret != 0:
+                self.skipTest("failed to create loop device with 4 KiB sectors: %s" % loop_dev)
+            self.addCleanup(utils.loop_teardown, loop_dev)
+
+            pr = blkid.Probe()
+            pr.set_device(loop_dev)
+            pr.sector_size = 512
+
+            pr.enable_partitions(True)
+            self.assertTrue(pr.do_safeprobe())
+            table = pr.partitions.table
+
+            report = blkid.check_alignment(pr)
+            self.assertEqual(report["granularity"], 4096)
+            self.assertEqual(report["misaligned"], [(1, 63 * 512, 63 * 512 % 4096, 0, None)])
+
+            # optimal I/O size not a multiple of the granularity is ignored
+            report = blkid.check_alignment(pr, optimal_io_size=6144)
+            self.assertEqual(report["optimal_io_size"], 0)
+            self.assertEqual(report["misaligned"], [(1, 63 * 512, 63 * 512 % 4096, 0, None)])
+
+            report = blkid.check_alignment(pr, optimal_io_size=1024 * 1024)
+            self.assertEqual(report["optimal_io_size"], 1024 * 1024)
+            self.assertEqual(report["misaligned"], [(1, 63 * 512, 63 * 512 % 4096, 0, 63 * 512)])
+
+            # the partitions are not probed again under existing objects
+            self.assertEqual(table.type, "dos")
+            self.assertEqual(len(pr.partitions), 2)
+
+            # topology and partitions probing is not done under raw values
+            self.assertTrue(pr.do_safeprobe())
+            with pr.lookup_raw("PTTYPE"):
+                with self.assertRaises(BufferError):
+                    blkid.check_alignment(pr)
+
+    def test_partition_rss(self):
+        def rss():
+            with open("/proc/self/statm") as f:
+                return int(f.read().split()[1]) * os.sysconf("SC_PAGE_SIZE")
+
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+        pr.enable_partitions(True)
+        self.assertTrue(pr.do_safeprobe())
+
+        def access(count):
+            for _i in range(count):
+                plist = pr.partitions
+                plist.get_partition(_i % 5).table.type
+                plist.table.get_parent()
+
+        access(10000)
+        before = rss()
+        access(1000000)
+        # leaking even a single small object per access would be tens of MiB
+        self.assertLess(rss() - before, 4 * 1024 * 1024)
+
     def test_partitions_filter(self):
         pr = blkid.Probe()
         pr.set_device(self.loop_dev)
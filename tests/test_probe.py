@@ -1,4 +1,9 @@
+import asyncio
+import gc
+import mmap
 import os
+import tempfile
+import threading
 import unittest
 
 from . import utils
@@ -48,6 +53,98 @@ class ProbeTestCase(unittest.TestCase):
 
         pr.reset_probe()
 
+    def test_buffer(self):
+        with open(self.loop_dev, "rb") as f:
+            data = bytearray(f.read(1024**2))
+
+        pr = blkid.Probe()
+        pr.enable_superblocks(True)
+        pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_UUID)
+
+        for buf in (bytes(data), memoryview(data), data):
+            pr.set_buffer(buf)
+            self.assertEqual(pr.size, len(data))
+            self.assertTrue(pr.do_safeprobe())
+            self.assertEqual(pr.lookup_value("TYPE"), b"ext3")
+            self.assertEqual(pr.lookup_value("UUID"), b"35f66dab-477e-4090-a872-95ee0e493ad6")
+
+        # data were copied, changing the buffer doesn't affect the probe
+        data[:] = bytes(len(data))
+        self.assertTrue(pr.do_safeprobe())
+        self.assertEqual(pr.lookup_value("TYPE"), b"ext3")
+
+        with mmap.mmap(-1, len(data)) as mm:
+            pr.set_buffer(mm)
+            self.assertFalse(pr.do_safeprobe())
+
+        pr.set_buffer(b"", size=0)
+        self.assertFalse(pr.do_safeprobe())
+
+        with self.assertRaises(TypeError):
+            pr.set_buffer("ext3")
+
+    def test_fd(self):
+        fd = os.open(self.loop_dev, os.O_RDONLY | os.O_CLOEXEC)
+        try:
+            pr = blkid.Probe()
+            pr.enable_superblocks(True)
+
+            with self.assertRaises(ValueError):
+                pr.set_fd(-1)
+
+            # not owned, the fd stays open after close
+            pr.set_fd(fd)
+            self.assertEqual(pr.fd, fd)
+            self.assertTrue(pr.do_safeprobe())
+            self.assertEqual(pr.lookup_value("TYPE"), b"ext3")
+            pr.close()
+            self.assertEqual(pr.fd, -1)
+            os.fstat(fd)
+
+            with self.assertRaises(ValueError):
+                pr.do_safeprobe()
+
+            # closing twice is fine
+            pr.close()
+        finally:
+            os.close(fd)
+
+        # probing area together with ownership
+        fd = os.open(self.loop_dev, os.O_RDONLY | os.O_CLOEXEC)
+        pr.set_fd(fd, offset=4096, size=8192, owned=True)
+        self.assertEqual(pr.offset, 4096)
+        self.assertEqual(pr.size, 8192)
+        pr.close()
+        with self.assertRaises(OSError):
+            os.fstat(fd)
+
+        # owned fd is closed when another device is assigned
+        fd = os.open(self.loop_dev, os.O_RDONLY | os.O_CLOEXEC)
+        pr.set_fd(fd, owned=True)
+        pr.set_device(self.loop_dev)
+        self.assertNotEqual(pr.fd, -1)
+        with self.assertRaises(OSError):
+            os.fstat(fd)
+
+        # device opened by set_device is closed on reassign and by the context manager
+        old_fd = pr.fd
+        with pr:
+            pr.set_device(self.loop_dev)
+            self.assertTrue(pr.do_safeprobe())
+            new_fd = pr.fd
+            with self.assertRaises(OSError):
+                os.fstat(old_fd)
+        self.assertEqual(pr.fd, -1)
+        with self.assertRaises(OSError):
+            os.fstat(new_fd)
+
+        # failed open keeps the previous device
+        pr.set_device(self.loop_dev)
+        with self.assertRaises(OSError):
+            pr.set_device("/non/existing")
+        self.assertTrue(pr.do_safeprobe())
+        pr.close()
+
     def test_probing(self):
         pr = blkid.Probe()
 
@@ -146,6 +243,295 @@ class ProbeTestCase(unittest.TestCase):
         self.assertIn(("TYPE", "ext3"), items)
         self.assertIn(("UUID", "35f66dab-477e-4090-a872-95ee0e493ad6"), items)
 
+    def test_result(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+
+        pr.enable_superblocks(True)
+        pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_USAGE | blkid.SUBLKS_UUID)
+
+        result = pr.result()
+        self.assertIsInstance(result, blkid.ProbeResult)
+        self.assertEqual(len(result), 0)
+        self.assertEqual(dict(result), {})
+
+        self.assertTrue(pr.do_safeprobe())
+        result = pr.result()
+        self.assertEqual(len(result), len(pr))
+        self.assertEqual(result["TYPE"], "ext3")
+        self.assertEqual(result.get("USAGE"), "filesystem")
+        self.assertIsNone(result.get("LABEL"))
+        self.assertEqual(result.get("LABEL", "none"), "none")
+        self.assertIn("UUID", result)
+        self.assertNotIn("LABEL", result)
+        self.assertNotIn(1, result)
+        self.assertEqual(sorted(result), sorted(result.keys()))
+        self.assertEqual(dict(result), dict(pr.items()))
+        self.assertEqual(list(result.values()), [v for _k, v in result.items()])
+
+        with self.assertRaises(KeyError):
+            result["LABEL"]
+
+        # snapshot is not affected by reusing the probe
+        pr.close()
+        pr.set_buffer(bytes(1024**2))
+        self.assertFalse(pr.do_safeprobe())
+        self.assertEqual(len(pr), 0)
+        self.assertEqual(result["UUID"], "35f66dab-477e-4090-a872-95ee0e493ad6")
+        self.assertIn("ext3", repr(result))
+
+    def test_tags(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+
+        pr.enable_superblocks(True)
+        pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_USAGE | blkid.SUBLKS_UUID | blkid.SUBLKS_LABEL |
+                                  blkid.SUBLKS_SECTYPE)
+
+        tags = pr.tags()
+        self.assertIsInstance(tags, blkid.ProbeTags)
+        self.assertEqual(tags, (None,) * len(tags))
+
+        self.assertTrue(pr.do_safeprobe())
+        tags = pr.tags()
+        self.assertEqual(tags.type, "ext3")
+        self.assertEqual(tags.uuid, "35f66dab-477e-4090-a872-95ee0e493ad6")
+        self.assertEqual(tags.label, "test-ext3")
+        self.assertEqual(tags.usage, "filesystem")
+        self.assertIsNone(tags.pttype)
+        self.assertIsNone(tags.partuuid)
+
+        result = pr.result()
+        self.assertEqual(result.tags, tags)
+        self.assertIs(result.tags, result.tags)
+
+        # well-known and other keys work the same way
+        key = "".join(["TY", "PE"])
+        self.assertEqual(pr[key], pr["TYPE"])
+        self.assertEqual(result[key], result["TYPE"])
+        self.assertEqual(result["SEC_TYPE"], "ext2")
+
+    def test_lookup_raw(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+
+        pr.enable_superblocks(True)
+        pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_UUID | blkid.SUBLKS_UUIDRAW | blkid.SUBLKS_MAGIC)
+        self.assertTrue(pr.do_safeprobe())
+
+        with self.assertRaises(RuntimeError):
+            pr.lookup_raw("LABEL")
+
+        fstype = pr.lookup_raw("TYPE")
+        self.assertIsInstance(fstype, memoryview)
+        self.assertTrue(fstype.readonly)
+        self.assertEqual(fstype.tobytes(), b"ext3\0")
+
+        uuid_raw = pr.lookup_raw("UUID_RAW")
+        self.assertEqual(len(uuid_raw), 16)
+        self.assertEqual(uuid_raw.hex(), "35f66dab477e4090a87295ee0e493ad6")
+
+        magic = pr.lookup_raw("SBMAGIC")
+        self.assertEqual(magic.tobytes(), b"\x53\xef")
+
+        # values can't change while there are views
+        with self.assertRaises(BufferError):
+            pr.do_safeprobe()
+        with self.assertRaises(BufferError):
+            pr.set_device(self.loop_dev)
+        with self.assertRaises(BufferError):
+            pr.reset_probe()
+        self.assertEqual(fstype.tobytes(), b"ext3\0")
+
+        # the view is the only export of the value
+        with self.assertRaises(BufferError):
+            memoryview(fstype.obj)
+
+        fstype.release()
+        uuid_raw.release()
+        del magic
+
+        self.assertTrue(pr.do_safeprobe())
+        with pr.lookup_raw("TYPE") as fstype:
+            self.assertEqual(bytes(fstype), b"ext3\0")
+        pr.close()
+
+    def test_iter_probe(self):
+        pr = blkid.Probe()
+
+        with self.assertRaises(ValueError):
+            pr.iter_probe()
+
+        pr.set_device(self.loop_dev)
+        pr.enable_superblocks(True)
+        pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_USAGE | blkid.SUBLKS_MAGIC)
+
+        # same results as a do_probe() loop
+        expected = []
+        while pr.do_probe():
+            expected.append(dict(pr.items()))
+
+        results = list(pr.iter_probe())
+        self.assertTrue(all(isinstance(r, blkid.ProbeResult) for r in results))
+        self.assertEqual([dict(r) for r in results], expected)
+        self.assertEqual(results[0]["TYPE"], "ext3")
+        self.assertIn("SBMAGIC_OFFSET", results[0])
+
+        # iteration starts from the beginning every time
+        self.assertEqual(len(list(pr.iter_probe())), len(expected))
+
+        pr.set_buffer(bytes(1024**2))
+        self.assertEqual(list(pr.iter_probe()), [])
+
+    def test_scan_offsets(self):
+        pr = blkid.Probe()
+
+        with self.assertRaises(ValueError):
+            pr.scan_offsets(0, 0, 512)
+
+        with open(self.loop_dev, "rb") as f:
+            data = f.read(1024**2)
+
+        # the filesystem from the test image "embedded" at 1 MiB and 2.5 MiB
+        pr.set_buffer(bytes(1024**2) + data + bytes(512 * 1024) + data)
+        uuid = "35f66dab-477e-4090-a872-95ee0e493ad6"
+        expected = [(1024**2, "ext3", uuid), (int(2.5 * 1024**2), "ext3", uuid)]
+
+        for workers in (1, 4):
+            self.assertEqual(pr.scan_offsets(0, 0, 64 * 1024, workers=workers), expected)
+
+        self.assertEqual(pr.scan_offsets(1024**2, 2 * 1024**2, 512), expected[:1])
+        self.assertEqual(pr.scan_offsets(512, 1024**2, 512), [])
+
+        # the devices reopened by the workers are closed
+        nfds = len(os.listdir("/proc/self/fd"))
+        for _i in range(20):
+            pr.scan_offsets(0, 0, 64 * 1024, workers=4)
+        self.assertEqual(len(os.listdir("/proc/self/fd")), nfds)
+
+        with self.assertRaises(ValueError):
+            pr.scan_offsets(0, 0, 0)
+
+        # the probe itself is not changed
+        self.assertEqual(pr.offset, 0)
+        self.assertFalse(pr.do_safeprobe())
+
+    def test_stats(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+        pr.enable_superblocks(True)
+        pr.enable_partitions(True)
+
+        # disabled by default
+        self.assertTrue(pr.do_safeprobe())
+        self.assertIsNone(pr.stats)
+
+        pr.enable_stats(True)
+        stats = pr.stats
+        self.assertEqual(stats["calls"], 0)
+        self.assertIsNone(stats["call"])
+
+        pr.set_device(self.loop_dev)
+        self.assertTrue(pr.do_safeprobe())
+        stats = pr.stats
+        self.assertEqual(stats["call"], "do_safeprobe")
+        self.assertEqual(stats["calls"], 1)
+        self.assertEqual(stats["chains"], ["superblocks", "partitions"])
+        self.assertGreater(stats["wall_time"], 0)
+        self.assertGreater(stats["cpu_time"], 0)
+        if stats["bytes_read"] is not None:
+            self.assertGreater(stats["bytes_read"], 0)
+            self.assertGreater(stats["read_syscalls"], 0)
+
+        pr.enable_partitions(False)
+        pr.do_probe()
+        stats = pr.stats
+        self.assertEqual(stats["call"], "do_probe")
+        self.assertEqual(stats["calls"], 2)
+        self.assertEqual(stats["chains"], ["superblocks"])
+        self.assertGreaterEqual(stats["total_wall_time"], stats["wall_time"])
+
+        # every iteration step is one probing call, including the final one finding nothing
+        results = list(pr.iter_probe())
+        stats = pr.stats
+        self.assertEqual(stats["call"], "iter_probe")
+        self.assertEqual(stats["calls"], 2 + len(results) + 1)
+
+        # enabling again resets the stats
+        pr.enable_stats(True)
+        self.assertEqual(pr.stats["calls"], 0)
+
+        pr.enable_stats(False)
+        self.assertIsNone(pr.stats)
+
+    def test_memo(self):
+        blkid.enable_probe_memo()
+        self.addCleanup(blkid.enable_probe_memo, False)
+
+        def probe(dev):
+            pr = blkid.Probe()
+            pr.set_device(dev)
+            pr.enable_superblocks(True)
+            pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_UUID)
+            pr.enable_stats(True)
+            return pr
+
+        pr = probe(self.loop_dev)
+        self.assertTrue(pr.do_safeprobe())
+        self.assertEqual(pr.stats["calls"], 1)
+        expected = dict(pr.result())
+
+        # served from the memo by a new probe, no probing at all
+        pr = probe(self.loop_dev)
+        self.assertTrue(pr.do_safeprobe())
+        self.assertEqual(pr.stats["calls"], 0)
+        self.assertEqual(dict(pr.result()), expected)
+        self.assertEqual(len(pr), len(expected))
+        self.assertEqual(pr["TYPE"], b"ext3")
+        self.assertEqual(pr.lookup_value("UUID"), expected["UUID"].encode())
+        self.assertEqual(pr.tags().type, "ext3")
+        with pr.lookup_raw("TYPE") as fstype:
+            self.assertEqual(bytes(fstype), b"ext3\0")
+
+        # different flags or a filter are probed again
+        pr = probe(self.loop_dev)
+        pr.set_superblocks_flags(blkid.SUBLKS_TYPE)
+        self.assertTrue(pr.do_safeprobe())
+        self.assertEqual(pr.stats["calls"], 1)
+
+        pr = probe(self.loop_dev)
+        pr.filter_superblocks_type(blkid.FLTR_ONLYIN, ["ext3"])
+        self.assertTrue(pr.do_safeprobe())
+        pr.do_safeprobe()
+        self.assertEqual(pr.stats["calls"], 2)
+
+        blkid.clear_probe_memo()
+        pr = probe(self.loop_dev)
+        self.assertTrue(pr.do_safeprobe())
+        self.assertEqual(pr.stats["calls"], 1)
+
+        # new media on the same device number gets a new disk sequence number
+        with tempfile.NamedTemporaryFile() as empty:
+            empty.truncate(4096 * 512)
+            empty.flush()
+
+            loop_dev = utils.loop_setup(os.path.join(os.path.dirname(__file__), self.test_image))
+            try:
+                pr = probe(loop_dev)
+                self.assertTrue(pr.do_safeprobe())
+                pr.close()
+
+                ret, out = utils.run_command("losetup -d %s && losetup %s %s" % (loop_dev, loop_dev, empty.name))
+                if ret != 0:
+                    self.skipTest("Failed to re-attach %s: %s" % (loop_dev, out))
+
+                pr = probe(loop_dev)
+                self.assertFalse(pr.do_safeprobe())
+                self.assertEqual(pr.stats["calls"], 1)
+                pr.close()
+            finally:
+                utils.loop_teardown(loop_dev)
+
     def test_probe_filter_type(self):
         pr = blkid.Probe()
         pr.set_device(self.loop_dev)
@@ -287,6 +673,275 @@ class WipeTestCase(unittest.TestCase):
         ret = pr.do_probe()
         self.assertFalse(ret)
 
+    def test_wipe_many(self):
+        report = blkid.wipe_many([self.loop_dev, "/non/existing"], dryrun=True)
+        self.assertEqual(len(report), 2)
+        self.assertIsInstance(report["/non/existing"], FileNotFoundError)
+
+        signatures = report[self.loop_dev]
+        self.assertEqual(len(signatures), 1)
+        self.assertEqual(signatures[0]["type"], "ext3")
+        self.assertEqual(signatures[0]["usage"], "filesystem")
+        self.assertEqual(signatures[0]["offset"], 0x438)
+        self.assertEqual(signatures[0]["magic"], b"\x53\xef")
+
+        # dry run doesn't change the device
+        pr = blkid.Probe()
+        pr.set_device(self.loop_dev)
+        pr.enable_superblocks(True)
+        self.assertTrue(pr.do_safeprobe())
+        pr.close()
+
+        report = blkid.wipe_many([self.loop_dev], workers=2)
+        self.assertEqual(report[self.loop_dev], signatures)
+
+        pr.set_device(self.loop_dev)
+        self.assertFalse(pr.do_safeprobe())
+
+        # nothing left to wipe
+        report = blkid.wipe_many([self.loop_dev])
+        self.assertEqual(report[self.loop_dev], [])
+        self.assertEqual(blkid.wipe_many([]), {})
+
+    def test_wipe_many_gpt(self):
+        test_dir = os.path.abspath(os.path.dirname(__file__))
+        loop_dev = utils.loop_setup(os.path.join(test_dir, "gpt.img.xz"))
+        self.addCleanup(utils.loop_teardown, loop_dev, filename=os.path.join(test_dir, "gpt.img.xz"))
+
+        # only the primary header is visible before it is erased
+        report = blkid.wipe_many([loop_dev], dryrun=True)
+        self.assertEqual([(s["type"], s["offset"]) for s in report[loop_dev]], [("gpt", 0x200)])
+
+        # the backup header and the protective MBR are found and erased too
+        report = blkid.wipe_many([loop_dev])
+        self.assertEqual([(s["type"], s["offset"]) for s in report[loop_dev]],
+                         [("gpt", 0x200), ("gpt", 0x9ffe00), ("PMBR", 0x1fe)])
+        self.assertEqual(report[loop_dev][2]["magic"], b"\x55\xaa")
+
+        pr = blkid.Probe()
+        pr.set_device(loop_dev)
+        pr.enable_superblocks(True)
+        pr.enable_partitions(True)
+        self.assertFalse(pr.do_safeprobe())
+        pr.close()
+
+        self.assertEqual(blkid.wipe_many([loop_dev]), {loop_dev: []})
+
+    def test_wipe_memo(self):
+        blkid.enable_probe_memo()
+        self.addCleanup(blkid.enable_probe_memo, False)
+
+        def probe(flags=os.O_RDONLY):
+            pr = blkid.Probe()
+            pr.set_device(self.loop_dev, flags=flags)
+            pr.enable_superblocks(True)
+            pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_MAGIC)
+            return pr
+
+        self.assertTrue(probe().do_safeprobe())
+
+        # the media (and its disk sequence number) doesn't change, only the signatures
+        pr = probe(os.O_RDWR)
+        while pr.do_probe():
+            pr.do_wipe(False)
+        pr.close()
+        self.assertFalse(probe().do_safeprobe())
+
+        # restore the ext3 magic, the memo doesn't know about writes outside of blkid
+        with open(self.loop_dev, "r+b") as dev:
+            dev.seek(0x438)
+            dev.write(b"\x53\xef")
+        blkid.clear_probe_memo()
+        self.assertTrue(probe().do_safeprobe())
+
+        # a dry run doesn't drop the memoized results
+        report = blkid.wipe_many([self.loop_dev], dryrun=True)
+        self.assertEqual(len(report[self.loop_dev]), 1)
+        pr = probe()
+        pr.enable_stats(True)
+        self.assertTrue(pr.do_safeprobe())
+        self.assertEqual(pr.stats["calls"], 0)
+        pr.close()
+
+        blkid.wipe_many([self.loop_dev])
+        self.assertFalse(probe().do_safeprobe())
+
+
+@unittest.skipUnless(os.geteuid() == 0, "requires root access")
+class ThreadedProbeTestCase(unittest.TestCase):
+
+    test_image = "test.img.xz"
+    num_devices = 4
+    loop_devs = []
+
+    @classmethod
+    def setUpClass(cls):
+        test_dir = os.path.abspath(os.path.dirname(__file__))
+        cls.loop_devs = [utils.loop_setup(os.path.join(test_dir, cls.test_image)) for _i in range(cls.num_devices)]
+
+    @classmethod
+    def tearDownClass(cls):
+        test_dir = os.path.abspath(os.path.dirname(__file__))
+        for loop_dev in cls.loop_devs:
+            utils.loop_teardown(loop_dev, filename=os.path.join(test_dir, cls.test_image))
+
+    def _run_threads(self, target, args_list):
+        errors = []
+
+        def _wrapper(*args):
+            try:
+                target(*args)
+            except Exception as e:  # pylint: disable=broad-except
+                errors.append(e)
+
+        threads = [threading.Thread(target=_wrapper, args=args) for args in args_list]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        if errors:
+            raise errors[0]
+
+    def test_parallel_probes(self):
+        def _probe(device):
+            pr = blkid.Probe()
+            pr.set_device(device)
+            pr.enable_superblocks(True)
+            pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_USAGE | blkid.SUBLKS_UUID)
+
+            for _i in range(200):
+                self.assertTrue(pr.do_safeprobe())
+                self.assertEqual(pr["TYPE"], b"ext3")
+                self.assertEqual(pr["UUID"], b"35f66dab-477e-4090-a872-95ee0e493ad6")
+
+        self._run_threads(_probe, [(dev,) for dev in self.loop_devs])
+
+    def test_shared_probe(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_devs[0])
+        pr.enable_superblocks(True)
+        pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_USAGE | blkid.SUBLKS_UUID)
+        pr.enable_topology(True)
+
+        def _probe():
+            for _i in range(200):
+                pr.do_safeprobe()
+                # other threads re-probe at any time, but we should never see partial results
+                items = dict(pr.items())
+                self.assertEqual(items["TYPE"], "ext3")
+                self.assertEqual(items["UUID"], "35f66dab-477e-4090-a872-95ee0e493ad6")
+                self.assertEqual(pr.size, 2097152)
+
+        self._run_threads(_probe, [() for _i in range(self.num_devices)])
+
+        self.assertTrue(pr.do_safeprobe())
+        self.assertEqual(pr.lookup_value("TYPE"), b"ext3")
+
+    def test_shared_probe_lookup_raw(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_devs[0])
+        pr.enable_superblocks(True)
+        self.assertTrue(pr.do_safeprobe())
+
+        def _probe():
+            for _i in range(500):
+                try:
+                    pr.do_safeprobe()
+                except BufferError:
+                    pass
+
+        def _lookup():
+            for _i in range(500):
+                # the probing in other threads fails instead of changing the value under the view
+                with pr.lookup_raw("TYPE") as fstype:
+                    self.assertEqual(fstype.tobytes(), b"ext3\0")
+
+        self._run_threads(lambda func: func(), [(_probe,), (_lookup,), (_probe,), (_lookup,)])
+
+    def test_async_probe(self):
+        pr = blkid.Probe()
+        pr.set_device(self.loop_devs[0])
+        pr.enable_superblocks(True)
+        pr.set_superblocks_flags(blkid.SUBLKS_TYPE | blkid.SUBLKS_USAGE | blkid.SUBLKS_UUID)
+        pr.enable_topology(True)
+
+        # must be called with a running event loop
+        with self.assertRaises(RuntimeError):
+            pr.do_safeprobe_async()
+
+        async def _probe():
+            ret = await pr.do_safeprobe_async()
+            self.assertTrue(ret)
+            self.assertEqual(pr.lookup_value("TYPE"), b"ext3")
+            self.assertIsNotNone(pr.topology)
+
+            # topology object is dropped on re-probe
+            topology = pr.topology
+            self.assertTrue(await pr.do_fullprobe_async())
+            self.assertIsNot(pr.topology, topology)
+
+            results = {}
+            async for path, result in blkid.probe_many_async(self.loop_devs + ["/non/existing"]):
+                results[path] = result
+
+            return results
+
+        results = asyncio.run(_probe())
+        self.assertEqual(len(results), len(self.loop_devs) + 1)
+        for dev in self.loop_devs:
+            self.assertEqual(results[dev]["TYPE"], "ext3")
+        self.assertIsInstance(results["/non/existing"], FileNotFoundError)
+
+        # no results, iteration ends right away
+        async def _empty():
+            return [r async for r in blkid.probe_many_async([])]
+
+        self.assertEqual(asyncio.run(_empty()), [])
+
+        pr = blkid.Probe()
+        with self.assertRaises(ValueError):
+            asyncio.run(pr.do_safeprobe_async())
+
+    def test_async_loop_close(self):
+        def eventfds():
+            count = 0
+            for fd in os.listdir("/proc/self/fd"):
+                try:
+                    count += os.readlink("/proc/self/fd/" + fd) == "anon_inode:[eventfd]"
+                except FileNotFoundError:
+                    pass
+            return count
+
+        pr = blkid.Probe()
+        pr.set_device(self.loop_devs[0])
+        pr.enable_superblocks(True)
+
+        async def _probe():
+            return await pr.do_safeprobe_async()
+
+        async def _forget():
+            pr.do_safeprobe_async()
+
+        # the context of the loop and its eventfd are released with the loop
+        nfds = eventfds()
+        for _i in range(5):
+            self.assertTrue(asyncio.run(_probe()))
+            gc.collect()
+        self.assertEqual(eventfds(), nfds)
+
+        # the future of a job finished after the loop was closed keeps the loop alive,
+        # the job is dropped when the next loop submits a job
+        asyncio.run(_forget())
+        for _i in range(3):
+            self.assertTrue(asyncio.run(_probe()))
+            gc.collect()
+        self.assertEqual(eventfds(), nfds)
+
+        # the dropped job doesn't leave the probe pending
+        with pr.lookup_raw("TYPE") as fstype:
+            self.assertEqual(fstype.tobytes(), b"ext3\0")
+
 
 if __name__ == "__main__":
     unittest.main()